@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "lib_tar.h"
+
+/**
+ * Requests per second and latency of the synchronous tar_read_file() (one thread per request in flight)
+ * against the async engine (io_uring and pool of threads), at queue depths from 1 to 256.
+ * Usage: bench_aio tar_file [no_requests] [read_size]
+ */
+
+#define MAX_DEPTH 256
+
+char **files;
+size_t no_files;
+size_t read_size;
+
+int collect_file(const tar_header_t *header, uint64_t offset, void *arg) {
+    if (header->typeflag != REGTYPE && header->typeflag != AREGTYPE) { return 0; }
+    files = realloc(files, sizeof(char *) * (no_files + 1));
+    files[no_files] = strndup(header->name, 100);
+    no_files++;
+    return 0;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+void report(const char *name, unsigned depth, double *latencies, size_t n, double elapsed) {
+    qsort(latencies, n, sizeof(double), cmp_double);
+    printf("%-8s depth %3u : %9.0f req/s   p50 %7.1f us   p99 %7.1f us   p99.9 %7.1f us\n", name, depth, n / elapsed,
+           latencies[n / 2] * 1e6, latencies[n * 99 / 100] * 1e6, latencies[n * 999 / 1000] * 1e6);
+}
+
+typedef struct sync_arg {
+    tar_t *tar;
+    double *latencies;
+    size_t n;
+    unsigned int seed;
+} sync_arg_t;
+
+void *sync_worker(void *ptr) {
+    sync_arg_t *arg = ptr;
+    uint8_t *dest = malloc(read_size);
+    for (size_t i = 0; i < arg->n; i++) {
+        size_t len = read_size;
+        double start = now();
+        tar_read_file(arg->tar, files[rand_r(&arg->seed) % no_files], 0, dest, &len);
+        arg->latencies[i] = now() - start;
+    }
+    free(dest);
+    return NULL;
+}
+
+void bench_sync(tar_t *tar, unsigned depth, size_t n, double *latencies) {
+    pthread_t threads[MAX_DEPTH];
+    sync_arg_t args[MAX_DEPTH];
+    size_t per_thread = n / depth;
+    double start = now();
+    for (unsigned t = 0; t < depth; t++) {
+        args[t] = (sync_arg_t) {tar, &latencies[t * per_thread], per_thread, t + 1};
+        pthread_create(&threads[t], NULL, sync_worker, &args[t]);
+    }
+    for (unsigned t = 0; t < depth; t++) { pthread_join(threads[t], NULL); }
+    report("sync", depth, latencies, per_thread * depth, now() - start);
+}
+
+void bench_async(tar_t *tar, unsigned depth, size_t n, double *latencies, int flags) {
+    tar_aio_t *aio = tar_aio_create(tar, depth, flags);
+    tar_aio_req_t reqs[MAX_DEPTH];
+    tar_aio_req_t *completed[MAX_DEPTH];
+    double starts[MAX_DEPTH];
+    uint8_t *dests = malloc(read_size * depth);
+    unsigned int seed = 1;
+    size_t submitted = 0;
+    size_t done = 0;
+
+    double start = now();
+    for (unsigned i = 0; i < depth && submitted < n; i++, submitted++) {
+        reqs[i] = (tar_aio_req_t) {files[rand_r(&seed) % no_files], 0, &dests[i * read_size], read_size};
+        reqs[i].user_data = (void *) (uintptr_t) i;
+        starts[i] = now();
+        tar_aio_submit(aio, &reqs[i]);
+    }
+    while (done < n) {
+        int got = tar_aio_complete(aio, completed, depth, 1);
+        double end = now();
+        for (int c = 0; c < got; c++) {
+            unsigned i = (uintptr_t) completed[c]->user_data;
+            latencies[done++] = end - starts[i];
+            if (submitted < n) {
+                reqs[i] = (tar_aio_req_t) {files[rand_r(&seed) % no_files], 0, &dests[i * read_size], read_size};
+                reqs[i].user_data = (void *) (uintptr_t) i;
+                starts[i] = now();
+                tar_aio_submit(aio, &reqs[i]);
+                submitted++;
+            }
+        }
+    }
+    report(tar_aio_backend(aio) == TAR_AIO_URING ? "io_uring" : "threads", depth, latencies, n, now() - start);
+    tar_aio_destroy(aio);
+    free(dests);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("Usage: %s tar_file [no_requests] [read_size]\n", argv[0]);
+        return -1;
+    }
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1) {
+        perror("open(tar_file)");
+        return -1;
+    }
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+    read_size = argc > 3 ? strtoul(argv[3], NULL, 10) : 4096;
+
+    tar_foreach_header(fd, collect_file, NULL);
+    if (no_files == 0) {
+        printf("No file in %s\n", argv[1]);
+        return -1;
+    }
+    tar_t *tar = tar_open(fd, 0);
+    double *latencies = malloc(sizeof(double) * n);
+    for (unsigned depth = 1; depth <= MAX_DEPTH; depth *= 2) {
+        bench_sync(tar, depth, n, latencies);
+        bench_async(tar, depth, n, latencies, 0);
+        bench_async(tar, depth, n, latencies, TAR_AIO_THREADS);
+    }
+    free(latencies);
+    tar_close(tar);
+    return 0;
+}
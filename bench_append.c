@@ -0,0 +1,151 @@
+#define _GNU_SOURCE     // copy_file_range()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+
+/**
+ * Cost of appending members to an indexed archive and getting a handle on the result, one line per method:
+ *   bench_append [-m members] [-s size] [-r runs] [-o file] [-f json|csv] [-t tag] tar_file...
+ *
+ * -m  members appended to a copy of each archive, default 1000
+ * -s  size of each member, default 4096
+ * -r  runs of each method, the best and the median are reported, default 3
+ * -o  scratch copy of the archive, default bench_data/append.tar
+ * -f  output format, json (one object per line) or csv
+ * -t  a tag copied in every line, a commit for instance
+ *
+ * incremental: the handle is opened from the sidecar index, the writer indexes the members on it and writes the
+ *              sidecar index again from memory.
+ * rescan:      the writer appends without a handle, then tar_open_index() finds the index stale and scans the
+ *              archive, as after appending with an external tar.
+ */
+
+typedef struct bench {
+    const char *tag;
+    const char *out;
+    char idx_path[4096];
+    int members;
+    size_t size;
+    int runs;
+    int csv;
+    uint8_t *content;
+    double *times;
+} bench_t;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+// the scratch copy of the archive and its sidecar index, the file descriptor of the copy, -1 on error
+int scratch(bench_t *bench, const char *path) {
+    int in = open(path, O_RDONLY);
+    int out = open(bench->out, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    struct stat st;
+    if (in == -1 || out == -1 || fstat(in, &st) == -1) { return -1; }
+    for (loff_t done = 0; done < st.st_size; ) {
+        ssize_t res = copy_file_range(in, NULL, out, NULL, st.st_size - done, 0);
+        if (res <= 0) { return -1; }
+        done += res;
+    }
+    close(in);
+    unlink(bench->idx_path);
+    tar_close(tar_open_index(out, bench->idx_path, 0));
+    return out;
+}
+
+// one run of method on a fresh copy of the archive, its wall time, negative on error
+double run_once(bench_t *bench, const char *method, const char *path) {
+    int fd = scratch(bench, path);
+    if (fd == -1) { return -1; }
+    int incremental = !strcmp(method, "incremental");
+    double start = now();
+    tar_t *tar = incremental ? tar_open_index(fd, bench->idx_path, 0) : NULL;
+    tar_writer_t *writer = tar_writer_open(fd, tar, incremental ? bench->idx_path : NULL, TAR_WRITER_APPEND);
+    if (writer == NULL) { return -1; }
+    int err = 0;
+    for (int i = 0; i < bench->members && !err; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "appended/%d/m%d", i % 16, i);
+        err = tar_writer_add(writer, name, bench->content, bench->size);
+    }
+    err = tar_writer_close(writer) || err;
+    if (!incremental) { tar = tar_open_index(fd, bench->idx_path, 0); }
+    double end = now();
+    err = err || tar == NULL || !tar_exists(tar, "appended/0/m0");
+    tar_close(tar);
+    close(fd);
+    return err ? -1 : end - start;
+}
+
+void run(bench_t *bench, const char *method, const char *path) {
+    for (int i = 0; i < bench->runs; i++) {
+        bench->times[i] = run_once(bench, method, path);
+        if (bench->times[i] < 0) {
+            fprintf(stderr, "%s failed on %s\n", method, path);
+            return;
+        }
+    }
+    qsort(bench->times, bench->runs, sizeof(double), cmp_double);
+    double best = bench->times[0];
+    double median = bench->times[bench->runs / 2];
+    if (bench->csv) {
+        printf("%s,%s,%s,%d,%zu,%d,%.4f,%.4f,%.1f\n", bench->tag, path, method, bench->members, bench->size,
+               bench->runs, best, median, bench->members / median);
+    } else {
+        printf("{\"tag\":\"%s\",\"archive\":\"%s\",\"method\":\"%s\",\"members\":%d,\"member_bytes\":%zu,\"runs\":%d,"
+               "\"best_s\":%.4f,\"median_s\":%.4f,\"members_per_s\":%.1f}\n", bench->tag, path, method,
+               bench->members, bench->size, bench->runs, best, median, bench->members / median);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bench_t bench = {.tag = "", .out = "bench_data/append.tar", .members = 1000, .size = 4096, .runs = 3};
+    int opt;
+    while ((opt = getopt(argc, argv, "m:s:r:o:f:t:")) != -1) {
+        switch (opt) {
+            case 'm': bench.members = atoi(optarg); break;
+            case 's': bench.size = strtoul(optarg, NULL, 10); break;
+            case 'r': bench.runs = atoi(optarg); break;
+            case 'o': bench.out = optarg; break;
+            case 'f': bench.csv = !strcmp(optarg, "csv"); break;
+            case 't': bench.tag = optarg; break;
+            default:
+                printf("Usage: %s [-m members] [-s size] [-r runs] [-o file] [-f json|csv] [-t tag] tar_file...\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || bench.runs < 1 || bench.members < 1) {
+        printf("Usage: %s [-m members] [-s size] [-r runs] [-o file] [-f json|csv] [-t tag] tar_file...\n", argv[0]);
+        return -1;
+    }
+    snprintf(bench.idx_path, sizeof(bench.idx_path), "%s.idx", bench.out);
+    bench.content = malloc(bench.size + 1);
+    memset(bench.content, 'a', bench.size);
+    bench.times = malloc(sizeof(double) * bench.runs);
+    if (bench.csv) { printf("tag,archive,method,members,member_bytes,runs,best_s,median_s,members_per_s\n"); }
+
+    for (int i = optind; i < argc; i++) {
+        run(&bench, "incremental", argv[i]);
+        run(&bench, "rescan", argv[i]);
+    }
+    unlink(bench.out);
+    unlink(bench.idx_path);
+    free(bench.content);
+    free(bench.times);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lib_tar.h"
+
+/**
+ * Micro-benchmark of the header check: the original check_archive() loop against tar_check_headers()
+ * Usage: bench_check [no_headers] [rounds]
+ */
+
+// the loop check_archive() used before tar_check_headers()
+int reference_check(const char *buffer) {
+    long checksum_calculated;
+    long checksum_readed;
+    int i;
+
+    if (strncmp(&buffer[257], TMAGIC, TMAGLEN)) {return -1;}
+    if (strncmp(&buffer[263], TVERSION, TVERSLEN)) {return -2;}
+
+    checksum_calculated = 0;
+    for (i = 0; i < 148; i++) {
+        checksum_calculated += buffer[i];
+    }
+    checksum_calculated +=  8*' ';
+    for (i = 156; i < 512; i++) {
+        checksum_calculated += buffer[i];
+    }
+    checksum_readed = strtol(&buffer[148], NULL, 8);
+    if (checksum_calculated != checksum_readed) {return -3;}
+    return 0;
+}
+
+// a valid header with a random name, some bytes above 127 to exercise the signed sum
+void fill_header(char *header, unsigned int *seed) {
+    memset(header, 0, 512);
+    int len = 1 + rand_r(seed) % 99;
+    for (int i = 0; i < len; i++) { header[i] = 'a' + rand_r(seed) % 26; }
+    if (rand_r(seed) % 4 == 0) { header[len / 2] = (char) (0x80 + rand_r(seed) % 0x80); }
+    sprintf(&header[100], "%07o", 0644);
+    sprintf(&header[124], "%011o", rand_r(seed) % 100000);
+    header[156] = REGTYPE;
+    memcpy(&header[257], TMAGIC, TMAGLEN);
+    memcpy(&header[263], TVERSION, TVERSLEN);
+
+    long sum = 8*' ';
+    for (int i = 0; i < 512; i++) { if (i < 148 || i >= 156) { sum += header[i]; } }
+    sprintf(&header[148], "%06lo", sum);
+    header[155] = ' ';
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t no_headers = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 20;
+    unsigned int seed = 42;
+
+    char *data = malloc(no_headers * 512);
+    const char **headers = malloc(no_headers * sizeof(char *));
+    for (size_t i = 0; i < no_headers; i++) {
+        fill_header(&data[i * 512], &seed);
+        headers[i] = &data[i * 512];
+    }
+
+    // both must agree, on valid and corrupted headers
+    for (size_t i = 0; i < no_headers; i++) {
+        if (reference_check(headers[i]) != 0 || tar_check_headers(&headers[i], 1, NULL) != 0) {
+            printf("Header %zu wrongly refused :(\n", i);
+            return -1;
+        }
+    }
+    char corrupted[512];
+    for (int i = 0; i < 1000; i++) {
+        memcpy(corrupted, headers[i % no_headers], 512);
+        corrupted[rand_r(&seed) % 512] ^= 1 + rand_r(&seed) % 255;
+        const char *ptr = corrupted;
+        if (reference_check(corrupted) != tar_check_headers(&ptr, 1, NULL)) {
+            printf("Kernels disagree on a corrupted header :(\n");
+            return -1;
+        }
+    }
+
+    volatile int sink = 0;
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < no_headers; i++) { sink += reference_check(headers[i]); }
+    }
+    double reference = now() - start;
+
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+        sink += tar_check_headers(headers, no_headers, NULL);
+    }
+    double kernel = now() - start;
+
+    double total = (double) no_headers * rounds;
+    printf("reference loop    : %8.2f ns/header\n", reference / total * 1e9);
+    printf("tar_check_headers : %8.2f ns/header (x%.1f)\n", kernel / total * 1e9, reference / kernel);
+    free(headers);
+    free(data);
+    return sink;
+}
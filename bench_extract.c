@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+
+/**
+ * Wall time of tar_extract() against GNU tar -x on the same archives, one line per tool and archive:
+ *   bench_extract [-j threads] [-r runs] [-o dir] [-f json|csv] [-t tag] tar_file...
+ *
+ * -j  threads of tar_extract(), default 4
+ * -r  runs of each tool, the best and the median are reported, default 5
+ * -o  scratch directory, emptied between two runs, default bench_data/extract
+ * -f  output format, json (one object per line) or csv
+ * -t  a tag copied in every line, a commit for instance
+ *
+ * The archive stays in the page cache between runs: both tools are measured on writing, not on reading the disk.
+ * Each run ends with a sync(), so the writeback of one run is not paid by the next one.
+ */
+
+typedef struct bench {
+    const char *tag;
+    const char *out;
+    int threads;
+    int runs;
+    int csv;
+    double *times;
+} bench_t;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+// the scratch directory, emptied
+int scratch(const char *out) {
+    char cmd[4096];
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s' && mkdir -p '%s'", out, out);
+    return system(cmd);
+}
+
+// one run of tool on path, its wall time, negative on error
+double run_once(bench_t *bench, const char *tool, const char *path) {
+    if (scratch(bench->out)) { return -1; }
+    sync();
+    double start = now();
+    if (!strcmp(tool, "gnu_tar")) {
+        char cmd[4096];
+        snprintf(cmd, sizeof(cmd), "tar -xf '%s' -C '%s'", path, bench->out);
+        if (system(cmd)) { return -1; }
+    } else {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) { return -1; }
+        int res = tar_extract(fd, bench->out, bench->threads);
+        close(fd);
+        if (res < 0) { return -1; }
+    }
+    double end = now();
+    sync();
+    return end - start;
+}
+
+void run(bench_t *bench, const char *tool, const char *path, uint64_t archive_size) {
+    run_once(bench, tool, path); // warm up, the archive goes to the page cache
+    for (int i = 0; i < bench->runs; i++) {
+        bench->times[i] = run_once(bench, tool, path);
+        if (bench->times[i] < 0) {
+            fprintf(stderr, "%s failed on %s\n", tool, path);
+            return;
+        }
+    }
+    qsort(bench->times, bench->runs, sizeof(double), cmp_double);
+    double best = bench->times[0];
+    double median = bench->times[bench->runs / 2];
+    int threads = strcmp(tool, "gnu_tar") ? bench->threads : 1;
+    if (bench->csv) {
+        printf("%s,%s,%llu,%s,%d,%d,%.4f,%.4f,%.1f\n", bench->tag, path, (unsigned long long) archive_size, tool,
+               threads, bench->runs, best, median, archive_size / median / 1e6);
+    } else {
+        printf("{\"tag\":\"%s\",\"archive\":\"%s\",\"archive_bytes\":%llu,\"tool\":\"%s\",\"threads\":%d,\"runs\":%d,"
+               "\"best_s\":%.4f,\"median_s\":%.4f,\"mb_per_s\":%.1f}\n", bench->tag, path,
+               (unsigned long long) archive_size, tool, threads, bench->runs, best, median, archive_size / median / 1e6);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bench_t bench = {.tag = "", .out = "bench_data/extract", .threads = 4, .runs = 5};
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:o:f:t:")) != -1) {
+        switch (opt) {
+            case 'j': bench.threads = atoi(optarg); break;
+            case 'r': bench.runs = atoi(optarg); break;
+            case 'o': bench.out = optarg; break;
+            case 'f': bench.csv = !strcmp(optarg, "csv"); break;
+            case 't': bench.tag = optarg; break;
+            default:
+                printf("Usage: %s [-j threads] [-r runs] [-o dir] [-f json|csv] [-t tag] tar_file...\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || bench.runs < 1) {
+        printf("Usage: %s [-j threads] [-r runs] [-o dir] [-f json|csv] [-t tag] tar_file...\n", argv[0]);
+        return -1;
+    }
+    bench.times = malloc(sizeof(double) * bench.runs);
+    if (bench.csv) { printf("tag,archive,archive_bytes,tool,threads,runs,best_s,median_s,mb_per_s\n"); }
+
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st)) {
+            perror(argv[i]);
+            continue;
+        }
+        run(&bench, "gnu_tar", argv[i], st.st_size);
+        run(&bench, "tar_extract", argv[i], st.st_size);
+    }
+    scratch(bench.out);
+    rmdir(bench.out);
+    free(bench.times);
+    return 0;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <malloc.h>
+
+#include "lib_tar.h"
+
+/**
+ * Memory and lookup latency of the index of a handle against a naive hash table of the full paths:
+ *   bench_paths [-n lookups] [-f json|csv] [-t tag] tar_file...
+ *
+ * -n  lookups of existing paths, drawn with a fixed seed, default 1000000
+ * -f  output format, json (one object per line) or csv
+ * -t  a tag copied in every line, a commit for instance
+ *
+ * The bytes are those allocated by malloc() while building the index, reported per member of the archive.
+ * The naive table holds a copy of each path, the fields of its member and a bucket, as a strdup() and a node.
+ */
+
+#define BENCH_TARGETS 65536    // paths kept as the targets of the lookups
+
+typedef struct naive_entry {
+    char *path;
+    uint64_t data_offset;
+    uint64_t size;
+    struct naive_entry *next;
+    char typeflag;
+} naive_entry_t;
+
+typedef struct naive {
+    naive_entry_t **buckets;
+    size_t no_buckets;
+    size_t no_entries;
+} naive_t;
+
+typedef struct bench {
+    const char *tag;
+    const char *path;
+    int csv;
+    size_t no_lookups;
+    uint64_t no_members;
+    char *targets[BENCH_TARGETS];
+    size_t no_targets;
+    double *latencies;
+    naive_t naive;
+} bench_t;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+size_t heap_bytes(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t hash_path(const char *path) {
+    uint64_t h = 5381;
+    while (*path) { h = h * 33 + (uint8_t) *path++; }
+    return h;
+}
+
+// the path of the member, its ustar prefix first
+void member_path(const tar_header_t *header, char *out) {
+    if (header->prefix[0] != '\0') {
+        snprintf(out, 258, "%.155s/%.100s", header->prefix, header->name);
+    } else {
+        snprintf(out, 258, "%.100s", header->name);
+    }
+}
+
+naive_entry_t *naive_find(naive_t *naive, const char *path) {
+    naive_entry_t *entry = naive->buckets[hash_path(path) & (naive->no_buckets - 1)];
+    while (entry != NULL && strcmp(entry->path, path)) { entry = entry->next; }
+    return entry;
+}
+
+void naive_grow(naive_t *naive) {
+    size_t no_buckets = naive->no_buckets ? naive->no_buckets * 2 : 1024;
+    naive_entry_t **buckets = calloc(no_buckets, sizeof(naive_entry_t *));
+    for (size_t i = 0; i < naive->no_buckets; i++) {
+        for (naive_entry_t *entry = naive->buckets[i], *next; entry != NULL; entry = next) {
+            next = entry->next;
+            size_t b = hash_path(entry->path) & (no_buckets - 1);
+            entry->next = buckets[b];
+            buckets[b] = entry;
+        }
+    }
+    free(naive->buckets);
+    naive->buckets = buckets;
+    naive->no_buckets = no_buckets;
+}
+
+// adds the member to the naive table, and every 1 in 64 of them to the targets
+int collect(const tar_header_t *header, uint64_t offset, void *arg) {
+    bench_t *bench = arg;
+    if (header->typeflag == XHDTYPE || header->typeflag == XGLTYPE) { return 0; }
+    char path[258];
+    member_path(header, path);
+    if (bench->no_members++ % 64 == 0 && bench->no_targets < BENCH_TARGETS) {
+        bench->targets[bench->no_targets++] = strdup(path);
+    }
+    naive_t *naive = &bench->naive;
+    if (naive->no_entries >= naive->no_buckets) { naive_grow(naive); }
+    naive_entry_t *entry = naive_find(naive, path);
+    if (entry == NULL) {
+        entry = malloc(sizeof(naive_entry_t));
+        entry->path = strdup(path);
+        size_t b = hash_path(path) & (naive->no_buckets - 1);
+        entry->next = naive->buckets[b];
+        naive->buckets[b] = entry;
+        naive->no_entries++;
+    }
+    entry->data_offset = offset + 512;
+    entry->size = TAR_INT(header->size);
+    entry->typeflag = header->typeflag;
+    return 0;
+}
+
+void naive_free(naive_t *naive) {
+    for (size_t i = 0; i < naive->no_buckets; i++) {
+        for (naive_entry_t *entry = naive->buckets[i], *next; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry->path);
+            free(entry);
+        }
+    }
+    free(naive->buckets);
+    memset(naive, 0, sizeof(naive_t));
+}
+
+void report(bench_t *bench, const char *index, size_t bytes, double build, int (*lookup)(void *, char *), void *arg) {
+    unsigned int seed = 42;
+    size_t found = 0;
+    for (size_t i = 0; i < bench->no_lookups; i++) {
+        char *path = bench->targets[rand_r(&seed) % bench->no_targets];
+        double start = now();
+        found += lookup(arg, path);
+        bench->latencies[i] = now() - start;
+    }
+    double *lat = bench->latencies;
+    size_t n = bench->no_lookups;
+    qsort(lat, n, sizeof(double), cmp_double);
+    double p50 = lat[n / 2] * 1e9, p99 = lat[n * 99 / 100] * 1e9;
+    double per_entry = (double) bytes / bench->no_members;
+    if (found != n) { fprintf(stderr, "%s: %zu paths of %zu not found\n", index, n - found, n); }
+    if (bench->csv) {
+        printf("%s,%s,%llu,%s,%zu,%.1f,%.2f,%zu,%.1f,%.1f\n", bench->tag, bench->path,
+               (unsigned long long) bench->no_members, index, bytes, per_entry, build, n, p50, p99);
+    } else {
+        printf("{\"tag\":\"%s\",\"archive\":\"%s\",\"members\":%llu,\"index\":\"%s\",\"index_bytes\":%zu,"
+               "\"bytes_per_entry\":%.1f,\"build_s\":%.2f,\"lookups\":%zu,\"p50_ns\":%.1f,\"p99_ns\":%.1f}\n",
+               bench->tag, bench->path, (unsigned long long) bench->no_members, index, bytes, per_entry, build, n,
+               p50, p99);
+    }
+    fflush(stdout);
+}
+
+int lookup_naive(void *arg, char *path) { return naive_find(arg, path) != NULL; }
+int lookup_handle(void *arg, char *path) { return tar_exists(arg, path) == 1; }
+
+int run(bench_t *bench) {
+    int fd = open(bench->path, O_RDONLY);
+    if (fd == -1) {
+        perror(bench->path);
+        return -1;
+    }
+    bench->no_members = 0;
+    bench->no_targets = 0;
+    size_t before = heap_bytes();
+    double start = now();
+    tar_foreach_header(fd, collect, bench);
+    double build = now() - start;
+    size_t targets = 0;
+    for (size_t i = 0; i < bench->no_targets; i++) { targets += malloc_usable_size(bench->targets[i]); }
+    if (bench->no_targets == 0) {
+        printf("No member in %s\n", bench->path);
+        return -1;
+    }
+    report(bench, "naive_hash", heap_bytes() - before - targets, build, lookup_naive, &bench->naive);
+    naive_free(&bench->naive);
+
+    before = heap_bytes();
+    start = now();
+    tar_t *tar = tar_open(fd, 0);
+    build = now() - start;
+    if (tar == NULL) {
+        printf("Could not open %s\n", bench->path);
+        return -1;
+    }
+    report(bench, "handle", heap_bytes() - before, build, lookup_handle, tar);
+    tar_close(tar);
+    for (size_t i = 0; i < bench->no_targets; i++) { free(bench->targets[i]); }
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static bench_t bench = {.tag = "", .no_lookups = 1000000};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:t:")) != -1) {
+        switch (opt) {
+            case 'n': bench.no_lookups = strtoul(optarg, NULL, 10); break;
+            case 'f': bench.csv = !strcmp(optarg, "csv"); break;
+            case 't': bench.tag = optarg; break;
+            default:
+                printf("Usage: %s [-n lookups] [-f json|csv] [-t tag] tar_file...\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || bench.no_lookups == 0) {
+        printf("Usage: %s [-n lookups] [-f json|csv] [-t tag] tar_file...\n", argv[0]);
+        return -1;
+    }
+    bench.latencies = malloc(sizeof(double) * bench.no_lookups);
+    if (bench.csv) { printf("tag,archive,members,index,index_bytes,bytes_per_entry,build_s,lookups,p50_ns,p99_ns\n"); }
+    for (int i = optind; i < argc; i++) {
+        bench.path = argv[i];
+        if (run(&bench)) { return -1; }
+    }
+    free(bench.latencies);
+    return 0;
+}
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lib_tar.h"
+
+/**
+ * Throughput of serving a member to a socket, tar_send_member() against a tar_read_file() + write() loop:
+ *   bench_send [-s unix|tcp] [-b buffer] [-r runs] [-m member] [-f json|csv] [-t tag] tar_file
+ *
+ * -s  socket, a Unix socket pair or a loopback TCP connection, default unix
+ * -b  buffer of the read + write loop, default 65536
+ * -r  times the member is sent by each method, default 5
+ * -m  the member sent, default the largest regular file of the archive
+ * -f  output format, json (one object per line) or csv
+ * -t  a tag copied in every line, a commit for instance
+ *
+ * A thread reads and drops everything on the other end of the socket. The archive is in the page cache.
+ */
+
+#define DRAIN_BUFFER (1 << 20)
+
+typedef struct bench {
+    const char *tag;
+    const char *path;
+    const char *socket;
+    tar_t *tar;
+    char member[256];
+    uint64_t member_size;
+    size_t buffer_size;
+    int runs;
+    int csv;
+} bench_t;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int largest(const tar_header_t *header, uint64_t offset, void *arg) {
+    bench_t *bench = arg;
+    uint64_t size = TAR_INT(header->size);
+    if ((header->typeflag == REGTYPE || header->typeflag == AREGTYPE) && size > bench->member_size) {
+        bench->member_size = size;
+        strncpy(bench->member, header->name, 100);
+    }
+    return 0;
+}
+
+void *drain(void *arg) {
+    int fd = (int) (intptr_t) arg;
+    char *buffer = malloc(DRAIN_BUFFER);
+    while (read(fd, buffer, DRAIN_BUFFER) > 0) {}
+    free(buffer);
+    return NULL;
+}
+
+// a connected pair of sockets, fds[0] is written, fds[1] is drained
+int connect_pair(const char *kind, int fds[2]) {
+    if (!strcmp(kind, "unix")) { return socketpair(AF_UNIX, SOCK_STREAM, 0, fds); }
+    struct sockaddr_in addr = {.sin_family = AF_INET};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server == -1 || bind(server, (struct sockaddr *) &addr, addr_len) || listen(server, 1)
+        || getsockname(server, (struct sockaddr *) &addr, &addr_len)) {
+        return -1;
+    }
+    fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[0] == -1 || connect(fds[0], (struct sockaddr *) &addr, addr_len)) { return -1; }
+    fds[1] = accept(server, NULL, NULL);
+    close(server);
+    return fds[1] == -1 ? -1 : 0;
+}
+
+// sends the member once, the bytes sent
+uint64_t send_once(bench_t *bench, const char *method, int out, uint8_t *buffer) {
+    if (!strcmp(method, "send_member")) {
+        size_t len = SIZE_MAX;
+        tar_send_member(bench->tar, bench->member, out, 0, &len);
+        return len;
+    }
+    uint64_t done = 0;
+    while (done < bench->member_size) {
+        size_t len = bench->buffer_size;
+        ssize_t res = tar_read_file(bench->tar, bench->member, done, buffer, &len);
+        if (res < 0 || len == 0) { break; }
+        for (size_t written = 0; written < len; ) {
+            ssize_t err = write(out, &buffer[written], len - written);
+            if (err <= 0) { return done; }
+            written += err;
+        }
+        done += len;
+    }
+    return done;
+}
+
+void run(bench_t *bench, const char *method) {
+    int fds[2];
+    if (connect_pair(bench->socket, fds)) {
+        perror("socket");
+        return;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, drain, (void *) (intptr_t) fds[1]);
+    uint8_t *buffer = malloc(bench->buffer_size);
+    send_once(bench, method, fds[0], buffer); // warm up
+    double best = 0;
+    double total = 0;
+    uint64_t bytes = 0;
+    for (int i = 0; i < bench->runs; i++) {
+        double start = now();
+        bytes += send_once(bench, method, fds[0], buffer);
+        double time = now() - start;
+        total += time;
+        if (i == 0 || time < best) { best = time; }
+    }
+    close(fds[0]);
+    pthread_join(thread, NULL);
+    close(fds[1]);
+    free(buffer);
+
+    size_t buffer_size = strcmp(method, "send_member") ? bench->buffer_size : 0;
+    if (bench->csv) {
+        printf("%s,%s,%s,%llu,%s,%s,%zu,%d,%.4f,%.1f,%.1f\n", bench->tag, bench->path, bench->member,
+               (unsigned long long) bench->member_size, bench->socket, method, buffer_size, bench->runs, best,
+               bench->member_size / best / 1e6, bytes / total / 1e6);
+    } else {
+        printf("{\"tag\":\"%s\",\"archive\":\"%s\",\"member\":\"%s\",\"member_bytes\":%llu,\"socket\":\"%s\","
+               "\"method\":\"%s\",\"buffer\":%zu,\"runs\":%d,\"best_s\":%.4f,\"best_mb_per_s\":%.1f,\"mb_per_s\":%.1f}\n",
+               bench->tag, bench->path, bench->member, (unsigned long long) bench->member_size, bench->socket, method,
+               buffer_size, bench->runs, best, bench->member_size / best / 1e6, bytes / total / 1e6);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bench_t bench = {.tag = "", .socket = "unix", .buffer_size = 65536, .runs = 5};
+    const char *member = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:r:m:f:t:")) != -1) {
+        switch (opt) {
+            case 's': bench.socket = optarg; break;
+            case 'b': bench.buffer_size = strtoul(optarg, NULL, 10); break;
+            case 'r': bench.runs = atoi(optarg); break;
+            case 'm': member = optarg; break;
+            case 'f': bench.csv = !strcmp(optarg, "csv"); break;
+            case 't': bench.tag = optarg; break;
+            default:
+                printf("Usage: %s [-s unix|tcp] [-b buffer] [-r runs] [-m member] [-f json|csv] [-t tag] tar_file\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || bench.runs < 1 || bench.buffer_size == 0) {
+        printf("Usage: %s [-s unix|tcp] [-b buffer] [-r runs] [-m member] [-f json|csv] [-t tag] tar_file\n", argv[0]);
+        return -1;
+    }
+    bench.path = argv[optind];
+    int fd = open(bench.path, O_RDONLY);
+    if (fd == -1) {
+        perror("open(tar_file)");
+        return -1;
+    }
+    bench.tar = tar_open(fd, 0);
+    if (bench.tar == NULL) {
+        printf("Could not open %s\n", bench.path);
+        return -1;
+    }
+    if (member != NULL) {
+        uint8_t none;
+        size_t zero = 0;
+        strncpy(bench.member, member, sizeof(bench.member) - 1);
+        ssize_t size = tar_read_file(bench.tar, bench.member, 0, &none, &zero);
+        bench.member_size = size > 0 ? size : 0;
+    } else {
+        tar_foreach_header(fd, largest, &bench);
+    }
+    if (bench.member_size == 0) {
+        printf("No file to send in %s\n", bench.path);
+        return -1;
+    }
+    if (bench.csv) { printf("tag,archive,member,member_bytes,socket,method,buffer,runs,best_s,best_mb_per_s,mb_per_s\n"); }
+
+    run(&bench, "send_member");
+    run(&bench, "read_write");
+    tar_close(bench.tar);
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "lib_tar.h"
+
+/**
+ * Latency percentiles and throughput of the API on one archive, warm and cold cache, one line per operation:
+ *   bench_tar [-n calls] [-N scan_calls] [-c warm|cold|both] [-f json|csv] [-t tag] tar_file
+ *
+ * -n  calls of each handle operation (tar_exists()...), default 10000
+ * -N  calls of each fd operation (exists()...), each one scans the archive, default 20
+ * -c  cache state: warm runs one call first, cold drops the archive from the page cache before every call
+ * -f  output format, json (one object per line) or csv
+ * -t  a tag copied in every line, a commit for instance, to follow the results over time
+ *
+ * The targets of the calls are drawn with a fixed seed among the members of the archive, so two runs on the same
+ * archive make the same calls.
+ */
+
+#define BENCH_READ (64 * 1024)  // bytes read by each read_file()
+
+typedef struct names {
+    char **names;
+    size_t no_names;
+} names_t;
+
+// the members of the archive, by type
+names_t files, dirs, links, all;
+uint8_t *read_buffer;
+char **list_entries;
+
+typedef struct bench {
+    const char *path;
+    const char *tag;
+    int fd;
+    tar_t *tar;
+    int cold;
+    int csv;
+    uint64_t archive_size;
+    double *latencies;
+    uint64_t bytes;         // read by the operation being measured
+} bench_t;
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void names_add(names_t *names, const char *name) {
+    if ((names->no_names & (names->no_names - 1)) == 0) {
+        names->names = realloc(names->names, sizeof(char *) * (names->no_names ? names->no_names * 2 : 1));
+    }
+    names->names[names->no_names++] = strndup(name, 100);
+}
+
+int collect(const tar_header_t *header, uint64_t offset, void *arg) {
+    if (header->typeflag == XHDTYPE || header->typeflag == XGLTYPE) { return 0; } // the paddings of tar_relayout
+    names_add(&all, header->name);
+    if (header->typeflag == REGTYPE || header->typeflag == AREGTYPE) { names_add(&files, header->name); }
+    if (header->typeflag == DIRTYPE) { names_add(&dirs, header->name); }
+    if (header->typeflag == SYMTYPE) { names_add(&links, header->name); }
+    return 0;
+}
+
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+typedef int (*op_t)(bench_t *bench, char *name);
+
+int op_check_archive(bench_t *bench, char *name) { return check_archive(bench->fd); }
+int op_exists(bench_t *bench, char *name) { return exists(bench->fd, name); }
+int op_is_dir(bench_t *bench, char *name) { return is_dir(bench->fd, name); }
+int op_is_file(bench_t *bench, char *name) { return is_file(bench->fd, name); }
+int op_is_symlink(bench_t *bench, char *name) { return is_symlink(bench->fd, name); }
+int op_tar_open(bench_t *bench, char *name) { tar_close(tar_open(bench->fd, 0)); return 0; }
+// a one-shot lookup: a lazy handle only scans up to the member
+int op_tar_open_lazy(bench_t *bench, char *name) {
+    tar_t *tar = tar_open(bench->fd, TAR_LAZY);
+    int res = tar_exists(tar, name);
+    tar_close(tar);
+    return res;
+}
+int op_tar_exists(bench_t *bench, char *name) { return tar_exists(bench->tar, name); }
+int op_tar_is_dir(bench_t *bench, char *name) { return tar_is_dir(bench->tar, name); }
+int op_tar_is_file(bench_t *bench, char *name) { return tar_is_file(bench->tar, name); }
+int op_tar_is_symlink(bench_t *bench, char *name) { return tar_is_symlink(bench->tar, name); }
+
+int op_list(bench_t *bench, char *name) {
+    size_t no_entries = 1024;
+    return list(bench->fd, name, list_entries, &no_entries);
+}
+
+int op_tar_list(bench_t *bench, char *name) {
+    size_t no_entries = 1024;
+    return tar_list(bench->tar, name, list_entries, &no_entries);
+}
+
+// the same listing in an arena, nothing is allocated nor truncated
+int op_tar_list_arena(bench_t *bench, char *name) {
+    static tar_name_t names[1024];
+    static char arena[1024 * 260];
+    size_t no_names = 1024, arena_size = sizeof(arena);
+    tar_cursor_t cursor = TAR_CURSOR_START;
+    return tar_list_arena(bench->tar, name, &cursor, names, &no_names, arena, &arena_size);
+}
+
+int op_read_file(bench_t *bench, char *name) {
+    size_t len = BENCH_READ;
+    int res = read_file(bench->fd, name, 0, read_buffer, &len);
+    bench->bytes += len;
+    return res;
+}
+
+int op_tar_read_file(bench_t *bench, char *name) {
+    size_t len = BENCH_READ;
+    int res = tar_read_file(bench->tar, name, 0, read_buffer, &len);
+    bench->bytes += len;
+    return res;
+}
+
+int count_match(const tar_match_t *match, void *arg) {
+    (*(size_t *) arg)++;
+    return 0;
+}
+
+// every entry under a directory, at any depth
+int op_tar_find_prefix(bench_t *bench, char *name) {
+    size_t no_matches = 0;
+    return tar_find_prefix(bench->tar, name, count_match, &no_matches);
+}
+
+// the files of a directory and its sub-directories whose name starts with 'm1'
+int op_tar_find_glob(bench_t *bench, char *name) {
+    char pattern[256];
+    size_t no_matches = 0;
+    snprintf(pattern, sizeof(pattern), "%s*m1*", name);
+    return tar_find_glob(bench->tar, pattern, count_match, &no_matches);
+}
+
+void run(bench_t *bench, const char *op_name, const char *api, op_t op, names_t *targets, size_t no_calls) {
+    if (targets->no_names == 0 || no_calls == 0) { return; }
+    unsigned int seed = 42;
+    if (!bench->cold) { op(bench, targets->names[0]); } // warm up
+    bench->bytes = 0;
+
+    double total = 0;
+    for (size_t i = 0; i < no_calls; i++) {
+        char *name = targets->names[rand_r(&seed) % targets->no_names];
+        if (bench->cold) { posix_fadvise(bench->fd, 0, 0, POSIX_FADV_DONTNEED); }
+        double start = now();
+        op(bench, name);
+        bench->latencies[i] = now() - start;
+        total += bench->latencies[i];
+    }
+
+    double *lat = bench->latencies;
+    qsort(lat, no_calls, sizeof(double), cmp_double);
+    double p50 = lat[no_calls / 2] * 1e6;
+    double p90 = lat[no_calls * 90 / 100] * 1e6;
+    double p99 = lat[no_calls * 99 / 100] * 1e6;
+    double p999 = lat[no_calls * 999 / 1000] * 1e6;
+    double max = lat[no_calls - 1] * 1e6;
+    const char *cache = bench->cold ? "cold" : "warm";
+    if (bench->csv) {
+        printf("%s,%s,%s,%zu,%llu,%s,%s,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.3f\n", bench->tag, bench->path, api,
+               all.no_names, (unsigned long long) bench->archive_size, op_name, cache, no_calls, p50, p90, p99, p999,
+               max, no_calls / total, bench->bytes / total / 1e6);
+    } else {
+        printf("{\"tag\":\"%s\",\"archive\":\"%s\",\"api\":\"%s\",\"entries\":%zu,\"archive_bytes\":%llu,\"op\":\"%s\","
+               "\"cache\":\"%s\",\"calls\":%zu,\"p50_us\":%.3f,\"p90_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+               "\"max_us\":%.3f,\"calls_per_s\":%.1f,\"mb_per_s\":%.3f}\n", bench->tag, bench->path, api, all.no_names,
+               (unsigned long long) bench->archive_size, op_name, cache, no_calls, p50, p90, p99, p999, max,
+               no_calls / total, bench->bytes / total / 1e6);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    bench_t bench = {.tag = ""};
+    size_t no_calls = 10000;
+    size_t no_scan_calls = 20;
+    const char *caches = "both";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:N:c:f:t:")) != -1) {
+        switch (opt) {
+            case 'n': no_calls = strtoul(optarg, NULL, 10); break;
+            case 'N': no_scan_calls = strtoul(optarg, NULL, 10); break;
+            case 'c': caches = optarg; break;
+            case 'f': bench.csv = !strcmp(optarg, "csv"); break;
+            case 't': bench.tag = optarg; break;
+            default:
+                printf("Usage: %s [-n calls] [-N scan_calls] [-c warm|cold|both] [-f json|csv] [-t tag] tar_file\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc) {
+        printf("Usage: %s [-n calls] [-N scan_calls] [-c warm|cold|both] [-f json|csv] [-t tag] tar_file\n", argv[0]);
+        return -1;
+    }
+    bench.path = argv[optind];
+    bench.fd = open(bench.path, O_RDONLY);
+    if (bench.fd == -1) {
+        perror("open(tar_file)");
+        return -1;
+    }
+    struct stat st;
+    fstat(bench.fd, &st);
+    bench.archive_size = st.st_size;
+    tar_foreach_header(bench.fd, collect, NULL);
+    bench.tar = tar_open(bench.fd, 0);
+    if (bench.tar == NULL) {
+        printf("Could not open %s\n", bench.path);
+        return -1;
+    }
+    read_buffer = malloc(BENCH_READ);
+    list_entries = malloc(sizeof(char *) * 1024);
+    for (int i = 0; i < 1024; i++) { list_entries[i] = malloc(TAR_PATH_MAX); }
+    bench.latencies = malloc(sizeof(double) * (no_calls > no_scan_calls ? no_calls : no_scan_calls));
+    names_t archive = {(char *[]) {""}, 1};
+    if (bench.csv) {
+        printf("tag,archive,api,entries,archive_bytes,op,cache,calls,p50_us,p90_us,p99_us,p999_us,max_us,calls_per_s,mb_per_s\n");
+    }
+
+    for (int cold = 0; cold <= 1; cold++) {
+        if ((cold && !strcmp(caches, "warm")) || (!cold && !strcmp(caches, "cold"))) { continue; }
+        bench.cold = cold;
+        run(&bench, "check_archive", "fd", op_check_archive, &archive, no_scan_calls);
+        run(&bench, "exists", "fd", op_exists, &all, no_scan_calls);
+        run(&bench, "is_dir", "fd", op_is_dir, &dirs, no_scan_calls);
+        run(&bench, "is_file", "fd", op_is_file, &files, no_scan_calls);
+        run(&bench, "is_symlink", "fd", op_is_symlink, &links, no_scan_calls);
+        run(&bench, "list", "fd", op_list, &dirs, no_scan_calls);
+        run(&bench, "read_file", "fd", op_read_file, &files, no_scan_calls);
+        run(&bench, "tar_open", "handle", op_tar_open, &archive, no_scan_calls);
+        run(&bench, "tar_open_lazy", "handle", op_tar_open_lazy, &all, no_scan_calls);
+        run(&bench, "tar_exists", "handle", op_tar_exists, &all, no_calls);
+        run(&bench, "tar_is_dir", "handle", op_tar_is_dir, &dirs, no_calls);
+        run(&bench, "tar_is_file", "handle", op_tar_is_file, &files, no_calls);
+        run(&bench, "tar_is_symlink", "handle", op_tar_is_symlink, &links, no_calls);
+        run(&bench, "tar_list", "handle", op_tar_list, &dirs, no_calls);
+        run(&bench, "tar_list_arena", "handle", op_tar_list_arena, &dirs, no_calls);
+        run(&bench, "tar_read_file", "handle", op_tar_read_file, &files, no_calls);
+        run(&bench, "tar_find_prefix", "handle", op_tar_find_prefix, &dirs, no_calls);
+        run(&bench, "tar_find_glob", "handle", op_tar_find_glob, &dirs, no_calls);
+    }
+    tar_close(bench.tar);
+    return 0;
+}
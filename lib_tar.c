@@ -1,4 +1,6 @@
+#define _GNU_SOURCE     // copy_file_range(), splice()
 #include "lib_tar.h"
+#include "lib_tar_index.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -6,6 +8,155 @@
 #include <math.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <fnmatch.h>
+#include <errno.h>
+#include <zlib.h>
+#ifdef TAR_ZSTD
+#include <zstd.h>
+#endif
+
+/* ========== STATISTICS ==========
+ * Built with TAR_STATS, each thread counts in its own block, found through a thread-local pointer and linked in a list
+ * for tar_stats_get(). A counter is only written by its thread, with a relaxed store: no lock and no shared cache line
+ * on the hot paths. Without TAR_STATS, STAT_ADD() and STAT_CALL() are empty.
+ */
+#ifdef TAR_STATS
+#include <time.h>
+
+typedef struct stats_block {
+    tar_stats_t stats;
+    struct stats_block *prev;
+    struct stats_block *next;
+} stats_block_t;
+
+#define STATS_WORDS (sizeof(tar_stats_t) / sizeof(uint64_t))
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+static stats_block_t *stats_blocks;         // of the live threads
+static tar_stats_t stats_retired;           // counted by the threads that exited
+static tar_stats_t stats_base;              // the totals at the last tar_stats_reset()
+static __thread stats_block_t *stats_local;
+
+// sum += sign * stats, read word by word while the owner of stats may be counting
+static void stats_sum(tar_stats_t *sum, tar_stats_t *stats, int sign) {
+    uint64_t *to = (uint64_t *) sum;
+    uint64_t *from = (uint64_t *) stats;
+    for (size_t i = 0; i < STATS_WORDS; i++) { to[i] += sign * __atomic_load_n(&from[i], __ATOMIC_RELAXED); }
+}
+
+// a thread exits: its counts go to stats_retired
+static void stats_exit(void *arg) {
+    stats_block_t *block = arg;
+    pthread_mutex_lock(&stats_lock);
+    stats_sum(&stats_retired, &block->stats, 1);
+    if (block->prev != NULL) { block->prev->next = block->next; } else { stats_blocks = block->next; }
+    if (block->next != NULL) { block->next->prev = block->prev; }
+    pthread_mutex_unlock(&stats_lock);
+    free(block);
+}
+
+static void stats_init(void) {
+    pthread_key_create(&stats_key, stats_exit);
+}
+
+// the block of the calling thread, registered on its first count, NULL if out of memory (nothing is counted)
+static tar_stats_t *stats_thread(void) {
+    if (stats_local != NULL) { return &stats_local->stats; }
+    pthread_once(&stats_once, stats_init);
+    stats_block_t *block = calloc(1, sizeof(stats_block_t));
+    if (block == NULL) { return NULL; }
+    pthread_mutex_lock(&stats_lock);
+    block->next = stats_blocks;
+    if (stats_blocks != NULL) { stats_blocks->prev = block; }
+    stats_blocks = block;
+    pthread_mutex_unlock(&stats_lock);
+    pthread_setspecific(stats_key, block);
+    stats_local = block;
+    return &block->stats;
+}
+
+#define STAT_ADD(field, n) do { \
+        tar_stats_t *stats_ = stats_thread(); \
+        if (stats_ != NULL) { __atomic_store_n(&stats_->field, stats_->field + (n), __ATOMIC_RELAXED); } \
+    } while (0)
+
+typedef struct stats_timer {
+    int op;
+    struct timespec start;
+} stats_timer_t;
+
+static stats_timer_t stats_timer_start(int op) {
+    stats_timer_t timer = {op};
+    clock_gettime(CLOCK_MONOTONIC, &timer.start);
+    return timer;
+}
+
+// called when the function that declared the timer returns, whatever the return
+static void stats_timer_end(stats_timer_t *timer) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t ns = (end.tv_sec - timer->start.tv_sec) * 1000000000ULL + end.tv_nsec - timer->start.tv_nsec;
+    int bucket = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+    if (bucket >= TAR_STATS_BUCKETS) { bucket = TAR_STATS_BUCKETS - 1; }
+    STAT_ADD(calls[timer->op], 1);
+    STAT_ADD(latency[timer->op][bucket], 1);
+}
+
+// counts the call of the enclosing function and its latency, first statement of an entry point
+#define STAT_CALL(op) stats_timer_t stats_timer_ __attribute__((cleanup(stats_timer_end))) = stats_timer_start(op)
+
+int tar_stats_get(tar_stats_t *stats) {
+    memset(stats, 0, sizeof(tar_stats_t));
+    pthread_mutex_lock(&stats_lock);
+    for (stats_block_t *block = stats_blocks; block != NULL; block = block->next) { stats_sum(stats, &block->stats, 1); }
+    stats_sum(stats, &stats_retired, 1);
+    stats_sum(stats, &stats_base, -1);
+    pthread_mutex_unlock(&stats_lock);
+    return 0;
+}
+
+void tar_stats_reset(void) {
+    // the blocks belong to their threads and are never cleared, the totals of now are subtracted from then on
+    tar_stats_t now;
+    memset(&now, 0, sizeof(tar_stats_t));
+    pthread_mutex_lock(&stats_lock);
+    for (stats_block_t *block = stats_blocks; block != NULL; block = block->next) { stats_sum(&now, &block->stats, 1); }
+    stats_sum(&now, &stats_retired, 1);
+    stats_base = now;
+    pthread_mutex_unlock(&stats_lock);
+}
+#else
+#define STAT_ADD(field, n) ((void) 0)
+#define STAT_CALL(op) ((void) 0)
+
+int tar_stats_get(tar_stats_t *stats) {
+    memset(stats, 0, sizeof(tar_stats_t));
+    return -1;
+}
+
+void tar_stats_reset(void) {}
+#endif
+
+const char *tar_op_name(int op) {
+    static const char *const names[TAR_NO_OPS] = {
+        "check_archive", "exists", "is_dir", "is_file", "is_symlink", "list", "read_file", "tar_check_headers",
+        "tar_foreach_header", "tar_lookup_batch", "tar_read_batch", "tar_open", "tar_check", "tar_exists", "tar_is_dir",
+        "tar_is_file", "tar_is_symlink", "tar_list", "tar_list_page", "tar_read_file", "tar_file_view",
+        "tar_index_write", "tar_open_index", "tar_verify", "tar_aio_submit", "tar_aio_complete", "tar_extract",
+        "tar_send_member", "tar_find_prefix", "tar_find_glob", "tar_open_layers", "tar_relayout", "tar_list_arena",
+        "tar_writer_open", "tar_writer_add", "tar_writer_flush",
+    };
+    return op >= 0 && op < TAR_NO_OPS ? names[op] : NULL;
+}
+
 
 int ceilC(double val){
     if (val == 0.) {return 0;}
@@ -16,8 +167,8 @@ int ceilC(double val){
 
 unsigned long hash(char *str) {
     char *ptr = &str[0];
-    int hash = 0;
-    for(int i = 0; i < strlen(str); i++) {
+    unsigned long hash = 0;
+    while (*ptr != '\0') {
         hash = ((hash << 5) + hash) + *ptr; /* hash * 33 + c */
         ptr++;
     }
@@ -26,10 +177,844 @@ unsigned long hash(char *str) {
 
 
 void reset(int tar_fd) {
+    STAT_ADD(seek_calls, 1);
     lseek(tar_fd, 0, SEEK_SET);
 }
 
 
+/* ========== HEADER CHECK KERNELS ==========
+ * The checksum is the sum of the (signed) bytes of the header, the checksum field counting as 8 spaces.
+ * Every kernel sums the 512 bytes, then replaces the checksum field by the spaces.
+ */
+
+// an octal field as written by tar: leading spaces, octal digits, then a space or a '\0'
+// Kept scalar: the fields hold at most 11 digits, and an 8-byte SWAR parse (digit and space masks, then
+// multiply-combine) ran at 7-8 ns per checksum field and 11-13 ns per size field against 5-6 and 7-8 ns here.
+static uint64_t octal_field(const char *field, size_t len) {
+    uint64_t val = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ') { i++; }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        val = (val << 3) | (field[i] - '0');
+    }
+    return val;
+}
+
+static long checksum_field_sum(const char *header) {
+    long sum = 0;
+    for (int i = 148; i < 156; i++) { sum += header[i]; }
+    return sum;
+}
+
+static long checksum_scalar(const char *header) {
+    long sum = 0;
+    for (int i = 0; i < 512; i++) { sum += header[i]; }
+    return sum - checksum_field_sum(header) + 8*' ';
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// _mm_sad_epu8 sums unsigned bytes: flipping the sign bit adds 128 to each signed byte
+static long checksum_sse2(const char *header) {
+    const __m128i bias = _mm_set1_epi8((char) 0x80);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (int i = 0; i < 512; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &header[i]), bias);
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    long sum = _mm_cvtsi128_si64(acc) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc));
+    return sum - 128 * 512 - checksum_field_sum(header) + 8*' ';
+}
+
+__attribute__((target("avx2")))
+static long checksum_avx2(const char *header) {
+    const __m256i bias = _mm256_set1_epi8((char) 0x80);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    for (int i = 0; i < 512; i += 32) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &header[i]), bias);
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+    }
+    __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    long sum = _mm_cvtsi128_si64(half) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(half, half));
+    return sum - 128 * 512 - checksum_field_sum(header) + 8*' ';
+}
+#endif
+
+static long (*checksum_kernel)(const char *header) = checksum_scalar;
+static pthread_once_t checksum_once = PTHREAD_ONCE_INIT;
+
+// pick the best kernel supported by the CPU, once
+static void checksum_dispatch(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { checksum_kernel = checksum_avx2; }
+    else { checksum_kernel = checksum_sse2; } // every x86_64 has SSE2
+#endif
+}
+
+/**
+ * Checks the magic, version and checksum of many headers in one call.
+ *
+ * @param headers An array of pointers to 512 bytes headers.
+ * @param no_headers The number of headers in `headers`.
+ * @param bad Set to the index of the first invalid header, if any. May be NULL.
+ *
+ * @return zero if every header is valid, otherwise the error of the first invalid header:
+ *         -1 for an invalid magic value, -2 for an invalid version value, -3 for an invalid checksum value.
+ */
+int tar_check_headers(const char *const *headers, size_t no_headers, size_t *bad) {
+    STAT_CALL(TAR_OP_CHECK_HEADERS);
+    // magic and version are contiguous, both are checked with one 8 bytes compare
+    static const char magic_version[8] = TMAGIC "\0" TVERSION;
+    pthread_once(&checksum_once, checksum_dispatch);
+    for (size_t i = 0; i < no_headers; i++) {
+        const char *header = headers[i];
+        int err = 0;
+        if (memcmp(&header[257], magic_version, 8)) {
+            err = memcmp(&header[257], TMAGIC, TMAGLEN) ? -1 : -2; // check magic value
+        } else if (checksum_kernel(header) != (long) octal_field(&header[148], 8)) {
+            err = -3;
+        }
+        if (err) {
+            if (bad != NULL) { *bad = i; }
+            return err;
+        }
+    }
+    return 0;
+}
+
+// return 0 if the header is valid, -1 (magic), -2 (version) or -3 (checksum) otherwise
+static int check_header(const char *buffer) {
+    return tar_check_headers(&buffer, 1, NULL);
+}
+
+// fill in the checksum field of a header, summed by the kernel that checks it
+static void header_checksum(char *header) {
+    pthread_once(&checksum_once, checksum_dispatch);
+    snprintf(&header[148], 8, "%06lo", checksum_kernel(header));
+    header[155] = ' ';
+}
+
+
+/* ========== COMPRESSED ARCHIVES ==========
+ * A .tar.gz or .tar.zst archive is read through a stream decompressing it from a checkpoint.
+ * The first scan records a checkpoint every TAR_Z_SPAN uncompressed bytes, zran-style for gzip
+ * (the position in the deflate stream and the last 32 KiB of output) and at the frame boundaries for zstd,
+ * so a later read only decompresses from the checkpoint before it.
+ */
+
+#define TAR_Z_NONE 0
+#define TAR_Z_GZIP 1
+#define TAR_Z_ZSTD 2
+#define TAR_Z_SPAN (1 << 20)    // uncompressed bytes between two checkpoints, at least
+#define TAR_Z_WINDOW 32768      // the history deflate may refer to, and the output buffer of a stream
+#define TAR_Z_IN (1 << 16)      // compressed bytes read at once
+
+typedef struct tar_checkpoint {
+    uint64_t out;       // offset in the uncompressed archive
+    uint64_t in;        // offset in the compressed file of the first byte to decompress from
+    uint32_t bits;      // gzip: bits of the byte before `in` still to decompress
+    uint32_t raw;       // gzip: 1 inside a deflate stream, the window of the checkpoint is then needed
+} tar_checkpoint_t;
+
+typedef struct tar_zsrc {
+    uint64_t id;                    // unique in the process, a stream cached by a thread is only reused by its source
+    int fd;
+    int format;                     // TAR_Z_GZIP or TAR_Z_ZSTD
+    tar_checkpoint_t *checkpoints;  // sorted by out, the first one is the start of the file
+    uint32_t no_checkpoints;
+    uint32_t max_checkpoints;
+    uint8_t *windows;               // gzip: TAR_Z_WINDOW bytes of history for each checkpoint
+    int frozen;                     // the table is complete, it is only read from now on
+    int mapped;                     // the table points in a sidecar index
+} tar_zsrc_t;
+
+typedef struct tar_zstream {
+    tar_zsrc_t *src;
+    uint64_t src_id;        // the id of src, which may be freed while the stream is cached
+    int format;
+    uint64_t in;            // offset in the compressed file of the next byte to read
+    uint64_t out;           // offset in the uncompressed archive of the next byte to give
+    uint8_t *pending;       // decompressed bytes not given yet, in ring
+    size_t no_pending;
+    size_t ring_pos;        // where the next bytes are decompressed in ring
+    int raw;                // gzip: in a deflate stream without its gzip header, its trailer is still to skip
+    int skip;               // gzip: bytes of trailer left to skip
+    int boundary;           // nothing decompressed since the start of a member or frame, the file may end here
+    z_stream strm;
+#ifdef TAR_ZSTD
+    ZSTD_DCtx *dctx;
+    ZSTD_inBuffer zin;
+#endif
+    uint8_t ring[TAR_Z_WINDOW];
+    uint8_t inbuf[TAR_Z_IN];
+} tar_zstream_t;
+
+// pread() until len bytes are read or the end of the file, never moves the offset of fd
+static ssize_t pread_full(int fd, void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t err = pread(fd, (uint8_t *) buf + done, len - done, (off_t) (offset + done));
+        STAT_ADD(read_calls, 1);
+        if (err == -1) { return -1; }
+        STAT_ADD(bytes_read, err);
+        if (err == 0) { break; }
+        done += err;
+    }
+    return done;
+}
+
+// TAR_Z_GZIP or TAR_Z_ZSTD from the magic number at the start of the file, TAR_Z_NONE for a plain archive
+static int zsrc_format(int fd) {
+    uint8_t magic[4];
+    if (pread_full(fd, magic, 4, 0) != 4) { return TAR_Z_NONE; }
+    if (magic[0] == 0x1f && magic[1] == 0x8b) { return TAR_Z_GZIP; }
+#ifdef TAR_ZSTD
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) { return TAR_Z_ZSTD; }
+#endif
+    return TAR_Z_NONE;
+}
+
+static uint64_t zsrc_next_id;
+
+// a new source with a unique id, NULL if out of memory
+static tar_zsrc_t *zsrc_new(int fd, int format) {
+    tar_zsrc_t *src = calloc(1, sizeof(tar_zsrc_t));
+    if (src == NULL) { return NULL; }
+    src->id = __atomic_add_fetch(&zsrc_next_id, 1, __ATOMIC_RELAXED);
+    src->fd = fd;
+    src->format = format;
+    return src;
+}
+
+static void zsrc_drop_cached(tar_zsrc_t *src);
+
+static void zsrc_free(tar_zsrc_t *src) {
+    if (src == NULL) { return; }
+    zsrc_drop_cached(src);
+    if (!src->mapped) {
+        free(src->checkpoints);
+        free(src->windows);
+    }
+    free(src);
+}
+
+static int zsrc_add(tar_zsrc_t *src, uint64_t out, uint64_t in, uint32_t bits, uint32_t raw, const uint8_t *window) {
+    if (src->no_checkpoints == src->max_checkpoints) {
+        uint32_t max = src->max_checkpoints ? src->max_checkpoints * 2 : 64;
+        tar_checkpoint_t *checkpoints = realloc(src->checkpoints, sizeof(tar_checkpoint_t) * max);
+        if (checkpoints == NULL) { return -1; }
+        src->checkpoints = checkpoints;
+        if (src->format == TAR_Z_GZIP) {
+            uint8_t *windows = realloc(src->windows, (size_t) TAR_Z_WINDOW * max);
+            if (windows == NULL) { return -1; }
+            src->windows = windows;
+        }
+        src->max_checkpoints = max;
+    }
+    tar_checkpoint_t *checkpoint = &src->checkpoints[src->no_checkpoints];
+    *checkpoint = (tar_checkpoint_t) {out, in, bits, raw};
+    if (src->format == TAR_Z_GZIP && window != NULL) {
+        memcpy(&src->windows[(size_t) TAR_Z_WINDOW * src->no_checkpoints], window, TAR_Z_WINDOW);
+    }
+    src->no_checkpoints++;
+    return 0;
+}
+
+// the compressed source of the archive at fd, with its first checkpoint, NULL if the archive is not compressed
+static tar_zsrc_t *zsrc_open(int fd, int *err) {
+    *err = 0;
+    int format = zsrc_format(fd);
+    if (format == TAR_Z_NONE) { return NULL; }
+    tar_zsrc_t *src = zsrc_new(fd, format);
+    if (src == NULL) { *err = -1; return NULL; }
+    if (zsrc_add(src, 0, 0, 0, 0, NULL)) { zsrc_free(src); *err = -1; return NULL; }
+    return src;
+}
+
+static void zstream_free(tar_zstream_t *z) {
+    if (z == NULL) { return; }
+    if (z->format == TAR_Z_GZIP) { inflateEnd(&z->strm); }
+#ifdef TAR_ZSTD
+    if (z->format == TAR_Z_ZSTD) { ZSTD_freeDCtx(z->dctx); }
+#endif
+    free(z);
+}
+
+// the index of the last checkpoint at or before offset
+static uint32_t zsrc_checkpoint(tar_zsrc_t *src, uint64_t offset) {
+    uint32_t lo = 0;
+    uint32_t hi = src->no_checkpoints;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (src->checkpoints[mid].out <= offset) { lo = mid; } else { hi = mid; }
+    }
+    return lo;
+}
+
+// restarts z from the last checkpoint at or before offset, keeping its decompressor, -1 on error
+static int zstream_restart(tar_zstream_t *z, uint64_t offset) {
+    tar_zsrc_t *src = z->src;
+    uint32_t i = zsrc_checkpoint(src, offset);
+    tar_checkpoint_t *checkpoint = &src->checkpoints[i];
+    z->in = checkpoint->in;
+    z->out = checkpoint->out;
+    z->pending = NULL;
+    z->no_pending = z->ring_pos = 0;
+    z->raw = checkpoint->raw;
+    z->skip = 0;
+    z->boundary = !checkpoint->raw;
+    if (src->format == TAR_Z_GZIP) {
+        z->strm.avail_in = 0;
+        if (inflateReset2(&z->strm, checkpoint->raw ? -15 : 31) != Z_OK) { return -1; }
+        if (checkpoint->raw) {
+            uint8_t byte;
+            if (checkpoint->bits && (pread_full(src->fd, &byte, 1, checkpoint->in - 1) != 1
+                                     || inflatePrime(&z->strm, checkpoint->bits, byte >> (8 - checkpoint->bits)) != Z_OK)) {
+                return -1;
+            }
+            inflateSetDictionary(&z->strm, &src->windows[(size_t) TAR_Z_WINDOW * i], TAR_Z_WINDOW);
+        }
+    }
+#ifdef TAR_ZSTD
+    if (src->format == TAR_Z_ZSTD) {
+        z->zin = (ZSTD_inBuffer) {z->inbuf, 0, 0};
+        if (ZSTD_isError(ZSTD_DCtx_reset(z->dctx, ZSTD_reset_session_only))) { return -1; }
+    }
+#endif
+    return 0;
+}
+
+// a stream decompressing from the last checkpoint at or before offset, NULL on error
+static tar_zstream_t *zstream_open(tar_zsrc_t *src, uint64_t offset) {
+    tar_zstream_t *z = calloc(1, sizeof(tar_zstream_t));
+    if (z == NULL) { return NULL; }
+    z->src = src;
+    z->src_id = src->id;
+    z->format = src->format;
+    if (src->format == TAR_Z_GZIP && inflateInit2(&z->strm, 31) != Z_OK) { free(z); return NULL; }
+#ifdef TAR_ZSTD
+    if (src->format == TAR_Z_ZSTD && (z->dctx = ZSTD_createDCtx()) == NULL) { free(z); return NULL; }
+#endif
+    if (zstream_restart(z, offset)) {
+        zstream_free(z);
+        return NULL;
+    }
+    return z;
+}
+
+// the compressed bytes after the ones already given to the decompressor, 0 at the end of the file, -1 on error
+static ssize_t zstream_input(tar_zstream_t *z) {
+    ssize_t res = pread_full(z->src->fd, z->inbuf, TAR_Z_IN, z->in);
+    if (res > 0) { z->in += res; }
+    return res;
+}
+
+/*
+ * Records a checkpoint at the uncompressed offset out, if the last one is far enough behind.
+ * ring_end is where the ring stops at out: the stream started at or before the last checkpoint,
+ * so the ring holds a whole window of history once a span has been decompressed.
+ */
+static int zstream_checkpoint(tar_zstream_t *z, uint64_t out, size_t ring_end, uint64_t in, uint32_t bits, uint32_t raw) {
+    tar_zsrc_t *src = z->src;
+    if (src->frozen || out < src->checkpoints[src->no_checkpoints - 1].out + TAR_Z_SPAN) { return 0; }
+    if (src->format != TAR_Z_GZIP) { return zsrc_add(src, out, in, bits, raw, NULL); }
+
+    uint8_t window[TAR_Z_WINDOW];
+    ring_end %= TAR_Z_WINDOW;
+    memcpy(window, &z->ring[ring_end], TAR_Z_WINDOW - ring_end);
+    memcpy(&window[TAR_Z_WINDOW - ring_end], z->ring, ring_end);
+    return zsrc_add(src, out, in, bits, raw, window);
+}
+
+// decompress the next bytes of a gzip archive into the ring, 0 at the end of the file, -1 on error
+static ssize_t zstream_next_gzip(tar_zstream_t *z) {
+    z_stream *strm = &z->strm;
+    strm->next_out = &z->ring[z->ring_pos];
+    strm->avail_out = TAR_Z_WINDOW - z->ring_pos;
+    while (strm->avail_out == TAR_Z_WINDOW - z->ring_pos) {
+        if (strm->avail_in == 0) {
+            ssize_t res = zstream_input(z);
+            if (res == -1) { return -1; }
+            if (res == 0) { return z->boundary && z->skip == 0 ? 0 : -1; } // the end of the file, or a truncated member
+            strm->next_in = z->inbuf;
+            strm->avail_in = res;
+        }
+        if (z->skip > 0) {
+            // the trailer of a member decompressed as raw deflate, the next member has a gzip header
+            uInt skip = strm->avail_in < (uInt) z->skip ? strm->avail_in : (uInt) z->skip;
+            strm->next_in += skip;
+            strm->avail_in -= skip;
+            z->skip -= skip;
+            continue;
+        }
+        if (z->boundary && z->raw) {
+            // the member ended after a raw checkpoint: decompress the next one with its header
+            if (inflateReset2(strm, 31) != Z_OK) { return -1; }
+            z->raw = 0;
+        }
+
+        int ret = inflate(strm, Z_BLOCK);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) { return -1; }
+        z->boundary = 0;
+        size_t produced = TAR_Z_WINDOW - z->ring_pos - strm->avail_out;
+        if (ret == Z_STREAM_END) {
+            // another member may follow, concatenated
+            z->boundary = 1;
+            if (z->raw) { z->skip = 8; }
+            else if (inflateReset(strm) != Z_OK) { return -1; }
+        } else if ((strm->data_type & 128) && !(strm->data_type & 64)
+                   && zstream_checkpoint(z, z->out + produced, z->ring_pos + produced, z->in - strm->avail_in,
+                                         strm->data_type & 7, 1)) {
+            return -1; // the end of a deflate block, where the decompressor can be restarted
+        }
+    }
+    return TAR_Z_WINDOW - z->ring_pos - strm->avail_out;
+}
+
+#ifdef TAR_ZSTD
+// decompress the next bytes of a zstd archive into the ring, 0 at the end of the file, -1 on error
+static ssize_t zstream_next_zstd(tar_zstream_t *z) {
+    ZSTD_outBuffer zout = {&z->ring[z->ring_pos], TAR_Z_WINDOW - z->ring_pos, 0};
+    while (zout.pos == 0) {
+        if (z->zin.pos == z->zin.size) {
+            ssize_t res = zstream_input(z);
+            if (res == -1) { return -1; }
+            if (res == 0) { return z->boundary ? 0 : -1; } // the end of the file, or a truncated frame
+            z->zin = (ZSTD_inBuffer) {z->inbuf, res, 0};
+        }
+        size_t ret = ZSTD_decompressStream(z->dctx, &zout, &z->zin);
+        if (ZSTD_isError(ret)) { return -1; }
+        z->boundary = ret == 0;
+        // the end of a frame, the next one is decompressed from scratch
+        if (ret == 0 && zstream_checkpoint(z, z->out + zout.pos, 0, z->in - (z->zin.size - z->zin.pos), 0, 0)) {
+            return -1;
+        }
+    }
+    return zout.pos;
+}
+#endif
+
+/*
+ * Decompresses the archive from offset into buf, offset must not be before the position of the stream.
+ * Returns the number of bytes read, less than len at the end of the archive, -1 on error.
+ */
+static ssize_t zstream_read(tar_zstream_t *z, void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    if (offset < z->out) { return -1; }
+    while (done < len) {
+        if (z->no_pending == 0) {
+            ssize_t res = -1;
+            if (z->ring_pos == TAR_Z_WINDOW) { z->ring_pos = 0; }
+            if (z->src->format == TAR_Z_GZIP) { res = zstream_next_gzip(z); }
+#ifdef TAR_ZSTD
+            if (z->src->format == TAR_Z_ZSTD) { res = zstream_next_zstd(z); }
+#endif
+            if (res == -1) { return -1; }
+            if (res == 0) { break; }
+            z->pending = &z->ring[z->ring_pos];
+            z->no_pending = res;
+            z->ring_pos += res;
+        }
+        // skip up to offset, then copy
+        size_t n = z->no_pending;
+        if (z->out < offset + done) {
+            n = offset + done - z->out < n ? offset + done - z->out : n;
+        } else {
+            n = len - done < n ? len - done : n;
+            memcpy((uint8_t *) buf + done, z->pending, n);
+            done += n;
+        }
+        z->pending += n;
+        z->no_pending -= n;
+        z->out += n;
+    }
+    return done;
+}
+
+/*
+ * Every thread keeps the stream of its last zsrc_pread(), about 100 KiB of decompressor state and buffers.
+ * The next read of the same source goes on from where it stopped when no checkpoint lies in between,
+ * otherwise the stream is restarted from the checkpoint before the read, without allocating again.
+ */
+static pthread_once_t zstream_once = PTHREAD_ONCE_INIT;
+static pthread_key_t zstream_key;
+static __thread tar_zstream_t *zstream_cached;
+
+static void zstream_exit(void *arg) {
+    zstream_free(arg);
+}
+
+static void zstream_init(void) {
+    pthread_key_create(&zstream_key, zstream_exit);
+}
+
+static void zstream_cache(tar_zstream_t *z) {
+    pthread_once(&zstream_once, zstream_init);
+    zstream_cached = z;
+    pthread_setspecific(zstream_key, z);
+}
+
+// the stream of the calling thread goes away with its source, the ones of other threads are replaced on their next read
+static void zsrc_drop_cached(tar_zsrc_t *src) {
+    if (zstream_cached != NULL && zstream_cached->src_id == src->id) {
+        zstream_free(zstream_cached);
+        zstream_cache(NULL);
+    }
+}
+
+// pread() on the uncompressed archive, from the position of the cached stream or the checkpoint before offset
+static ssize_t zsrc_pread(tar_zsrc_t *src, void *buf, size_t len, uint64_t offset) {
+    tar_zstream_t *z = zstream_cached;
+    if (z != NULL && z->format != src->format) {
+        zstream_free(z);
+        zstream_cache(NULL);
+        z = NULL;
+    }
+    if (z == NULL) {
+        if ((z = zstream_open(src, offset)) == NULL) { return -1; }
+    } else if (z->src_id != src->id || offset < z->out || src->checkpoints[zsrc_checkpoint(src, offset)].out > z->out) {
+        z->src = src;
+        z->src_id = src->id;
+        if (zstream_restart(z, offset)) {
+            zstream_free(z);
+            zstream_cache(NULL);
+            return -1;
+        }
+    }
+    zstream_cache(z);
+    ssize_t res = zstream_read(z, buf, len, offset);
+    if (res == -1) {
+        zstream_free(z);
+        zstream_cache(NULL);
+    }
+    return res;
+}
+
+
+/* ========== HEADER SCANNER ==========
+ * Every walk over the headers goes through a scan: the archive is read in large aligned chunks,
+ * and the headers are taken from the chunk, the content of the members in between is skipped in memory.
+ */
+
+#define TAR_BLOCKS(size) (((size) + 511) / 512)
+#define TAR_MAX_HOPS 16
+#define TAR_SCAN_CHUNK (1 << 20)
+#define TAR_SCAN_ALIGN 4096
+#define TAR_CHECK_BATCH 64
+#define TAR_SIZE_MAX (UINT64_MAX >> 2) // no offset computed from a size can overflow
+#define IS_LINK(typeflag) ((typeflag) == SYMTYPE || (typeflag) == LNKTYPE)
+
+typedef struct tar_scan {
+    int fd;
+    const uint8_t *map;     // the archive mapped by the handle, the headers are then taken in place
+    size_t map_size;
+    uint8_t *chunk;         // TAR_SCAN_CHUNK bytes of the archive, starting at chunk_start
+    uint64_t chunk_start;
+    size_t chunk_len;
+    uint64_t pos;           // offset of the next header
+    int err;                // -1 once a read failed
+    tar_zstream_t *z;       // for a compressed archive, the chunks are decompressed by this stream
+    tar_zsrc_t *own_src;    // the source of z, when the scan opened it
+} tar_scan_t;
+
+// the size of the content of the member
+// a numeric field, in octal or in GNU base-256 (first byte 0x80, then big-endian) for the values too large for octal
+static uint64_t numeric_field(const char *field, size_t len) {
+    const uint8_t *bytes = (const uint8_t *) field;
+    if (!(bytes[0] & 0x80)) { return octal_field(field, len); }
+    if (bytes[0] == 0xff) { return 0; } // negative, meaningless for a size
+    uint64_t val = bytes[0] & 0x7f;
+    for (size_t i = 1; i < len; i++) {
+        if (val >> 54) { return TAR_SIZE_MAX; } // past the end of any archive, the scan stops there
+        val = (val << 8) | bytes[i];
+    }
+    return val < TAR_SIZE_MAX ? val : TAR_SIZE_MAX;
+}
+
+static uint64_t header_size(const char *header) {
+    return numeric_field(&header[124], 12);
+}
+
+// the path of the member in out (TAR_PATH_MAX bytes): its name, after its ustar prefix and a '/' if it has one
+static size_t header_path(const char *header, char *out) {
+    size_t len = 0;
+    if (header[345] != '\0') {
+        len = strnlen(&header[345], 155);
+        memcpy(out, &header[345], len);
+        out[len++] = '/';
+    }
+    size_t name_len = strnlen(header, 100);
+    memcpy(&out[len], header, name_len);
+    len += name_len;
+    out[len] = '\0';
+    return len;
+}
+
+// whether the path of the member is path[0..len[
+static int header_is(const char *header, const char *path, size_t len) {
+    if (header[345] == '\0') { return len <= 100 && !strncmp(header, path, 100) && (len == 100 || header[len] == '\0'); }
+    char name[TAR_PATH_MAX];
+    return header_path(header, name) == len && !memcmp(name, path, len);
+}
+
+/*
+ * The path of the entry a link points to, without its trailing '/'.
+ * A hard link or an absolute symlink is relative to the root of the archive, any other symlink to the directory
+ * of the link. The '.' and '..' components are removed, a '..' out of the archive stays at its root.
+ * Returns the length of the path written in out (TAR_PATH_MAX bytes), -1 if it is too long.
+ */
+static int link_target(const char *name, char typeflag, const char *linkname, char *out) {
+    int len = 0;
+    if (typeflag == SYMTYPE && linkname[0] != '/') {
+        len = strnlen(name, TAR_PATH_MAX - 1);
+        if (len > 0 && name[len - 1] == '/') { len--; }
+        while (len > 0 && name[len - 1] != '/') { len--; }
+        if (len > 0) { len--; }
+        memcpy(out, name, len);
+    }
+    for (const char *comp = linkname; *comp; ) {
+        int comp_len = strcspn(comp, "/");
+        if (comp_len == 2 && comp[0] == '.' && comp[1] == '.') {
+            if (!(len == 1 && out[0] == '.')) { // keep the "./" some archives put before every path
+                while (len > 0 && out[len - 1] != '/') { len--; }
+                if (len > 0) { len--; }
+            }
+        } else if (comp_len > 1 || (comp_len == 1 && (comp[0] != '.' || (len == 0 && typeflag == LNKTYPE)))) {
+            if (len + comp_len + 1 >= TAR_PATH_MAX) { return -1; }
+            if (len > 0) { out[len++] = '/'; }
+            memcpy(&out[len], comp, comp_len);
+            len += comp_len;
+        }
+        comp += comp_len;
+        if (*comp == '/') { comp++; }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// start a scan at the header at pos, return -1 on error
+// src is the compressed source of the archive, NULL to detect it
+static int scan_init(tar_scan_t *scan, int fd, const uint8_t *map, size_t map_size, tar_zsrc_t *src, uint64_t pos) {
+    memset(scan, 0, sizeof(tar_scan_t));
+    scan->fd = fd;
+    scan->map = map;
+    scan->map_size = map_size;
+    scan->pos = pos;
+    if (map != NULL) { return 0; }
+    scan->chunk = malloc(TAR_SCAN_CHUNK);
+    if (scan->chunk == NULL) { return -1; }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int err = 0;
+    if (src == NULL) { src = scan->own_src = zsrc_open(fd, &err); }
+    if (err || (src != NULL && (scan->z = zstream_open(src, pos)) == NULL)) {
+        zsrc_free(scan->own_src);
+        free(scan->chunk);
+        return -1;
+    }
+    return 0;
+}
+
+static void scan_free(tar_scan_t *scan) {
+    zstream_free(scan->z);
+    zsrc_free(scan->own_src);
+    free(scan->chunk);
+    scan->chunk = NULL;
+    scan->z = NULL;
+    scan->own_src = NULL;
+}
+
+// the next header, valid until the next call, NULL at the end of the archive or on a read error (scan->err)
+static const char *scan_next(tar_scan_t *scan, uint64_t *offset) {
+    const char *header;
+    if (scan->map != NULL) {
+        if (scan->pos + 512 > scan->map_size) { return NULL; } // end of the file
+        header = (const char *) &scan->map[scan->pos];
+    } else {
+        if (scan->z != NULL && scan->pos + 512 > scan->chunk_start + scan->chunk_len) {
+            // a stream only goes forward: keep the end of the chunk still ahead, decompress the rest after it
+            size_t keep = 0;
+            if (scan->pos < scan->chunk_start + scan->chunk_len) {
+                keep = scan->chunk_start + scan->chunk_len - scan->pos;
+                memmove(scan->chunk, &scan->chunk[scan->pos - scan->chunk_start], keep);
+            }
+            ssize_t res = zstream_read(scan->z, &scan->chunk[keep], TAR_SCAN_CHUNK - keep, scan->pos + keep);
+            if (res == -1) { scan->chunk_len = 0; scan->err = -1; return NULL; } // error on reading
+            scan->chunk_start = scan->pos;
+            scan->chunk_len = keep + res;
+            if (scan->pos + 512 > scan->chunk_start + scan->chunk_len) { return NULL; } // end of the file
+        } else if (scan->pos < scan->chunk_start || scan->pos + 512 > scan->chunk_start + scan->chunk_len) {
+            // the header is not in the chunk: read the next one, aligned, and ask the kernel for the one after
+            scan->chunk_start = scan->pos & ~(uint64_t) (TAR_SCAN_ALIGN - 1);
+            ssize_t res = pread_full(scan->fd, scan->chunk, TAR_SCAN_CHUNK, scan->chunk_start);
+            if (res == -1) { scan->chunk_len = 0; scan->err = -1; return NULL; } // error on reading
+            scan->chunk_len = res;
+            if (scan->pos + 512 > scan->chunk_start + scan->chunk_len) { return NULL; } // end of the file
+            posix_fadvise(scan->fd, scan->chunk_start + TAR_SCAN_CHUNK, TAR_SCAN_CHUNK, POSIX_FADV_WILLNEED);
+        }
+        header = (const char *) &scan->chunk[scan->pos - scan->chunk_start];
+    }
+    if (header[0] == '\0') { return NULL; }
+    STAT_ADD(headers_scanned, 1);
+    if (offset != NULL) { *offset = scan->pos; }
+    scan->pos += 512 + TAR_BLOCKS(header_size(header)) * 512;
+    return header;
+}
+
+// gather up to TAR_CHECK_BATCH headers, copied in buffers unless they are in a mapping (the chunk may be read again)
+static size_t scan_batch(tar_scan_t *scan, char buffers[][512], const char **headers, uint64_t *offsets) {
+    size_t no_headers;
+    uint64_t offset;
+    for (no_headers = 0; no_headers < TAR_CHECK_BATCH; no_headers++) {
+        const char *header = scan_next(scan, &offset);
+        if (header == NULL) { break; }
+        if (scan->map == NULL) {
+            memcpy(buffers[no_headers], header, 512);
+            header = buffers[no_headers];
+        }
+        headers[no_headers] = header;
+        if (offsets != NULL) { offsets[no_headers] = offset; }
+    }
+    return no_headers;
+}
+
+// the last header named path, copied in header, if it has one of the types (any type if no_types is 0)
+// return 1 if found, 0 if not, -1 on a read error
+// A path added again later replaces the member before, as tar extracts them: every header is read, unless first is
+// set because only the existence of the path matters, which a later member of the same path cannot change.
+static int scan_find(int tar_fd, char *path, const char *types, size_t no_types, int first, char *header,
+                     uint64_t *offset) {
+    tar_scan_t scan;
+    const char *current;
+    uint64_t current_offset;
+    size_t len = strlen(path);
+    int found = 0;
+    if (scan_init(&scan, tar_fd, NULL, 0, NULL, 0)) { return -1; }
+    while ((current = scan_next(&scan, &current_offset)) != NULL) {
+        if (current[156] == XHDTYPE || current[156] == XGLTYPE || !header_is(current, path, len)) { continue; }
+        memcpy(header, current, 512);
+        if (offset != NULL) { *offset = current_offset; }
+        found = 1;
+        if (first) { break; }
+    }
+    scan_free(&scan);
+    if (scan.err) { return -1; }
+    return found && (no_types == 0 || memchr(types, header[156], no_types) != NULL);
+}
+
+// the last header of a directory of the path followed by scan_follow(), the link that path has to go through first
+typedef struct follow_dir {
+    int end;                // the directory is path[0..end[
+    char typeflag;          // '\0' while no header of the directory was met
+    char linkname[101];
+} follow_dir_t;
+
+/*
+ * The entry the link in header finally points to, its header copied over the one of the link, looked up without a
+ * handle: one scan of the headers for each link followed, a symlink met in the directories of a target first, as
+ * index_walk() does. A target is the last member at its path, or at its path followed by a '/'.
+ * Returns 1 if found, 0 if the chain is broken, loops or goes through more than TAR_MAX_HOPS links after the first,
+ * -1 on a read error.
+ */
+static int scan_follow(int tar_fd, char *header, uint64_t *offset) {
+    char name[TAR_PATH_MAX];
+    char path[TAR_PATH_MAX];
+    char linkname[101];
+    follow_dir_t dirs[TAR_PATH_MAX / 2];
+    header_path(header, name);
+    memcpy(linkname, &header[157], 100);
+    linkname[100] = '\0';
+    int len = link_target(name, header[156], linkname, path);
+    for (int hops = 0; len >= 0 && hops <= TAR_MAX_HOPS; hops++) {
+        int no_dirs = 0;
+        for (int i = 0; i < len; i++) {
+            if (path[i] == '/') { dirs[no_dirs++] = (follow_dir_t) {.end = i}; }
+        }
+        tar_scan_t scan;
+        const char *current;
+        uint64_t current_offset;
+        int found = 0; // 2 for a member at path, 1 at path/ only
+        if (scan_init(&scan, tar_fd, NULL, 0, NULL, 0)) { return -1; }
+        while ((current = scan_next(&scan, &current_offset)) != NULL) {
+            if (current[156] == XHDTYPE || current[156] == XGLTYPE) { continue; } // pax records, not members
+            int name_len = header_path(current, name);
+            int slash = name_len > 0 && name[name_len - 1] == '/';
+            name_len -= slash;
+            if (name_len > len || memcmp(name, path, name_len)) { continue; }
+            if (name_len == len && (!slash || found < 2)) {
+                memcpy(header, current, 512);
+                *offset = current_offset;
+                found = 2 - slash;
+                continue;
+            }
+            for (int d = 0; d < no_dirs && dirs[d].end <= name_len; d++) {
+                if (dirs[d].end != name_len) { continue; }
+                dirs[d].typeflag = current[156];
+                memcpy(dirs[d].linkname, &current[157], 100);
+                dirs[d].linkname[100] = '\0';
+            }
+        }
+        scan_free(&scan);
+        if (scan.err) { return -1; }
+
+        // the first directory that is a link leads the rest of the path from its target
+        int d = 0;
+        while (d < no_dirs && !IS_LINK(dirs[d].typeflag)) { d++; }
+        if (d < no_dirs) {
+            char target[TAR_PATH_MAX];
+            path[dirs[d].end] = '\0';
+            int dir_len = link_target(path, dirs[d].typeflag, dirs[d].linkname, target);
+            path[dirs[d].end] = '/';
+            int rest = len - dirs[d].end - (dir_len == 0); // a link to the root drops the '/' after it
+            if (dir_len < 0 || dir_len + rest >= TAR_PATH_MAX) { return 0; }
+            memmove(&path[dir_len], &path[len - rest], rest);
+            memcpy(path, target, dir_len);
+            len = dir_len + rest;
+            path[len] = '\0';
+            continue;
+        }
+        if (!found) { return 0; }
+        if (!IS_LINK(header[156])) { return 1; }
+        memcpy(name, path, len + 1);
+        memcpy(linkname, &header[157], 100);
+        len = link_target(name, header[156], linkname, path);
+    }
+    return 0;
+}
+
+/**
+ * Calls callback on every header of the archive, in order.
+ * The archive is read in chunks of 1 MiB with pread(): the offset of tar_fd is not moved.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a tar archive file.
+ * @param callback Called with each header, its offset in the archive and arg. The header is only valid during the call.
+ *                 It returns zero to go on with the next header, any positive value stops the scan.
+ * @param arg Passed to callback.
+ *
+ * @return zero once every header has been visited,
+ *         the value returned by callback if it stopped the scan,
+ *         -4 if the archive could not be read.
+ */
+int tar_foreach_header(int tar_fd, int (*callback)(const tar_header_t *header, uint64_t offset, void *arg), void *arg) {
+    STAT_CALL(TAR_OP_FOREACH_HEADER);
+    tar_scan_t scan;
+    const char *header;
+    uint64_t offset;
+    int res = 0;
+    if (scan_init(&scan, tar_fd, NULL, 0, NULL, 0)) { return -4; }
+    while (res == 0 && (header = scan_next(&scan, &offset)) != NULL) {
+        res = callback((const tar_header_t *) header, offset, arg);
+    }
+    scan_free(&scan);
+    if (res == 0 && scan.err) { return -4; } // error on reading
+    return res;
+}
+
+
 /**
  * Checks whether the archive is valid.
  *
@@ -46,38 +1031,21 @@ void reset(int tar_fd) {
  *         -3 if the archive contains a header with an invalid checksum value
  */
 int check_archive(int tar_fd) {
-    char buffer[512];
+    STAT_CALL(TAR_OP_CHECK_ARCHIVE);
+    tar_scan_t scan;
+    const char *header;
     int nb_headers = 0;
     int err;
-    long checksum_calculated;
-    long checksum_readed;
-    int blocks_skip;
-    int i;
-
-    while (1){
-        err = read(tar_fd, buffer, 512);
-        if (err == -1) { reset(tar_fd); return -4; } // error on reading
-        if (err < 512 && err > -1) { reset(tar_fd); return nb_headers; } // end of the file
-        if (buffer[0] == 0) {reset(tar_fd); return nb_headers;}
-        if (strncmp(&buffer[257], TMAGIC, TMAGLEN)) {reset(tar_fd); return -1;} // check magic value
-        if (strncmp(&buffer[263], TVERSION, TVERSLEN)) {reset(tar_fd); return -2;}
 
+    if (scan_init(&scan, tar_fd, NULL, 0, NULL, 0)) { return -4; }
+    while ((header = scan_next(&scan, NULL)) != NULL) {
+        err = check_header(header);
+        if (err) { scan_free(&scan); return err; }
         nb_headers++;
-
-        checksum_calculated = 0;
-        for (i = 0; i < 148; i++) {
-            checksum_calculated += buffer[i];
-        }
-        checksum_calculated +=  8*' ';
-        for (i = 156; i < 512; i++) {
-            checksum_calculated += buffer[i];
-        }
-        checksum_readed = strtol(&buffer[148], NULL, 8);
-        if (checksum_calculated != checksum_readed) {reset(tar_fd); return -3;}
-
-        blocks_skip = ceilC(strtol(&buffer[124], NULL, 8) / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
     }
+    scan_free(&scan);
+    if (scan.err) { return -4; } // error on reading
+    return nb_headers;
 }
 
 
@@ -91,23 +1059,9 @@ int check_archive(int tar_fd) {
  *         any other value otherwise.
  */
 int exists(int tar_fd, char *path) {
-    unsigned long path_name = hash(path);
-    unsigned long current_name;
-    char buffer[512];
-    int err;
-    int blocks_skip;
-
-    while(1) {
-        err = read(tar_fd, buffer, 512);
-        if (err == -1) {reset(tar_fd); return -1; } // error on reading
-        if (buffer[0] == '\0') {reset(tar_fd); return 0;}
-        if (err < 512 && err > -1) { reset(tar_fd); return 0; } // end of the file
-
-        current_name = hash(&buffer[0]);
-        if (current_name == path_name) {reset(tar_fd); return 1;}
-        blocks_skip = ceilC(strtol(&buffer[124], NULL, 8) / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
-    }
+    STAT_CALL(TAR_OP_EXISTS);
+    char header[512];
+    return scan_find(tar_fd, path, NULL, 0, 1, header, NULL);
 }
 
 
@@ -121,23 +1075,10 @@ int exists(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_dir(int tar_fd, char *path) {
-    unsigned long path_name = hash(path);
-    unsigned long current_name;
-    char buffer[512];
-    int err;
-    int blocks_skip;
-
-    while(1) {
-        err = read(tar_fd, buffer, 512);
-        if (err == -1) {reset(tar_fd); return -1; } // error on reading
-        if (buffer[0] == '\0') {reset(tar_fd); return 0;}
-        if (err < 512 && err > -1) { reset(tar_fd); return 0; } // end of the file
-
-        current_name = hash(&buffer[0]);
-        if (current_name == path_name && buffer[156] == DIRTYPE) {reset(tar_fd); return 1;}
-        blocks_skip = ceilC(strtol(&buffer[124], NULL, 8) / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
-    };
+    STAT_CALL(TAR_OP_IS_DIR);
+    static const char types[] = {DIRTYPE};
+    char header[512];
+    return scan_find(tar_fd, path, types, sizeof(types), 0, header, NULL);
 }
 
 
@@ -151,23 +1092,16 @@ int is_dir(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_file(int tar_fd, char *path) {
-    unsigned long path_name = hash(path);
-    unsigned long current_name;
-    char buffer[512];
-    int err;
-    int blocks_skip;
-
-    while(1) {
-        err = read(tar_fd, buffer, 512);
-        if (err == -1) {reset(tar_fd); return -1; } // error on reading
-        if (buffer[0] == '\0') {reset(tar_fd); return 0;}
-        if (err < 512 && err > -1) { reset(tar_fd); return 0; } // end of the file
-
-        current_name = hash(&buffer[0]);
-        if (current_name == path_name && (buffer[156] == REGTYPE || buffer[156] == AREGTYPE)) {reset(tar_fd); return 1;}
-        blocks_skip = ceilC(strtol(&buffer[124], NULL, 8) / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
-    };
+    STAT_CALL(TAR_OP_IS_FILE);
+    static const char types[] = {REGTYPE, AREGTYPE, LNKTYPE};
+    char header[512];
+    uint64_t offset;
+    int found = scan_find(tar_fd, path, types, sizeof(types), 0, header, &offset);
+    if (found != 1 || header[156] != LNKTYPE) { return found; }
+
+    // a hard link is the file it links to, if that one is in the archive
+    found = scan_follow(tar_fd, header, &offset);
+    return found == 1 ? header[156] == REGTYPE || header[156] == AREGTYPE : found;
 }
 
 
@@ -180,48 +1114,180 @@ int is_file(int tar_fd, char *path) {
  *         any other value otherwise.
  */
 int is_symlink(int tar_fd, char *path) {
-    unsigned long path_name = hash(path);
-    unsigned long current_name;
-    char buffer[512];
-    int err;
-    int blocks_skip;
-
-    while(1) {
-        err = read(tar_fd, buffer, 512);
-        if (err == -1) {reset(tar_fd); return -1; } // error on reading
-        if (buffer[0] == '\0') {reset(tar_fd); return 0;}
-        if (err < 512 && err > -1) { reset(tar_fd); return 0; } // end of the file
-
-        current_name = hash(&buffer[0]);
-        if (current_name == path_name && buffer[156] == SYMTYPE) {reset(tar_fd); return 1;} // replace by '1' for hard link
-        blocks_skip = ceilC(strtol(&buffer[124], NULL, 8) / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
-    };
+    STAT_CALL(TAR_OP_IS_SYMLINK);
+    static const char types[] = {SYMTYPE};
+    char header[512];
+    return scan_find(tar_fd, path, types, sizeof(types), 0, header, NULL);
 }
 
 
-// return 0 if it is a subdir, 1 if not
-int notinsubdir(char *filename){
-    int i=1; // On est certains qu'il y a au moins 1 char => (si "dir" : c'est un "/" qu'il faut ignorer) || (si "dir/": c'est un char normal, osef)
-    while(filename[i] != '\0'){
-        if (filename[i] == '/' && filename[i+1] != '\0'){ return 0; }
-        i++;
+static uint32_t component_hash(const char *str, size_t len);
+
+// an entry of the directory listed by list_scan(), in the order they are met
+typedef struct list_name {
+    uint32_t offset;    // of its path in the names
+    uint32_t len;
+    uint32_t next;      // next name of the same bucket, UINT32_MAX if none
+    char typeflag;
+    uint8_t under_name; // an entry of the directory member "dir" instead of "dir/"
+} list_name_t;
+
+typedef struct list_names {
+    list_name_t *names;
+    uint32_t no_names;
+    uint32_t max_names;
+    uint32_t *buckets;  // the size is a power of 2, twice the names at least
+    uint32_t no_buckets;
+    char *strings;
+    size_t strings_len;
+    size_t strings_max;
+} list_names_t;
+
+// the index of the name path[0..len[ in names, UINT32_MAX if not met yet
+static uint32_t list_names_find(list_names_t *names, const char *path, size_t len) {
+    if (names->no_buckets == 0) { return UINT32_MAX; }
+    uint32_t i = names->buckets[component_hash(path, len) & (names->no_buckets - 1)];
+    for (; i != UINT32_MAX; i = names->names[i].next) {
+        if (names->names[i].len == len && !memcmp(&names->strings[names->names[i].offset], path, len)) { return i; }
     }
-    return 1;
+    return UINT32_MAX;
+}
+
+// add the name path[0..len[ to names, -1 if out of memory
+static int list_names_add(list_names_t *names, const char *path, size_t len, char typeflag, int under_name) {
+    if (names->no_names * 2 >= names->no_buckets) {
+        uint32_t no_buckets = names->no_buckets ? names->no_buckets * 2 : 64;
+        uint32_t *buckets = malloc(sizeof(uint32_t) * no_buckets);
+        list_name_t *more = realloc(names->names, sizeof(list_name_t) * (no_buckets / 2));
+        if (more != NULL) { names->names = more; }
+        if (buckets == NULL || more == NULL) { free(buckets); return -1; }
+        for (uint32_t b = 0; b < no_buckets; b++) { buckets[b] = UINT32_MAX; }
+        for (uint32_t i = 0; i < names->no_names; i++) {
+            list_name_t *name = &names->names[i];
+            uint32_t b = component_hash(&names->strings[name->offset], name->len) & (no_buckets - 1);
+            name->next = buckets[b];
+            buckets[b] = i;
+        }
+        free(names->buckets);
+        names->buckets = buckets;
+        names->no_buckets = no_buckets;
+    }
+    if (names->strings_len + len > names->strings_max) {
+        size_t max = names->strings_max ? names->strings_max * 2 : 4096;
+        while (names->strings_len + len > max) { max *= 2; }
+        char *strings = realloc(names->strings, max);
+        if (strings == NULL) { return -1; }
+        names->strings = strings;
+        names->strings_max = max;
+    }
+    list_name_t *name = &names->names[names->no_names];
+    name->offset = names->strings_len;
+    name->len = len;
+    name->typeflag = typeflag;
+    name->under_name = under_name;
+    memcpy(&names->strings[names->strings_len], path, len);
+    names->strings_len += len;
+    uint32_t b = component_hash(path, len) & (names->no_buckets - 1);
+    name->next = names->buckets[b];
+    names->buckets[b] = names->no_names++;
+    return 0;
 }
 
-int indirbutnotdir(char *real_name, char *current_name, size_t size_real){
-    size_t i=0;
-    for (; i<size_real; i++){
-        if (current_name[i] != real_name[i]){ return 0; }
+// whether a member replacing another turns a directory into something else, or the reverse
+static int list_kind_changed(char before, char after) {
+    return (before == DIRTYPE) != (after == DIRTYPE);
+}
+
+/*
+ * list() in a single scan of the headers, without the index of a handle. The entries of the directory are filed as
+ * index_add() files them: an entry goes under "dir/" if it was met, else under the directory member "dir" if there is
+ * one, else under an implicit "dir/"; a deeper member adds its directory "dir/c/" unless "dir/c/" or a directory
+ * member "dir/c" was met. The directory listed is then "dir" if it was met, else "dir/", as list_dir() looks it up.
+ * Returns the result of list(), or -2 when a handle has to answer: the directory is a link, a path has an empty
+ * component, or a member turned a directory into something else (the entries below are then filed by a deeper level).
+ */
+static int list_scan(int tar_fd, char *path, char **entries, size_t *no_entries) {
+    char dir[TAR_PATH_MAX + 1];
+    size_t dir_len = strnlen(path, TAR_PATH_MAX - 1);
+    memcpy(dir, path, dir_len);
+    if (dir_len > 0 && dir[dir_len - 1] == '/') { dir_len--; }
+    if (dir_len > 0 && (dir[0] == '/' || memmem(dir, dir_len, "//", 2) != NULL)) { return -2; }
+    dir[dir_len] = '/';
+    size_t prefix_len = dir_len > 0 ? dir_len + 1 : 0; // "dir/", nothing for the root
+
+    int dir_seen = 0, slash_seen = dir_len == 0;    // the members "dir" and "dir/", the root is always there
+    char dir_type = AREGTYPE, slash_type = DIRTYPE;
+    list_names_t names;
+    memset(&names, 0, sizeof(names));
+    tar_scan_t scan;
+    const char *header;
+    uint64_t offset;
+    char name[TAR_PATH_MAX];
+    int res = 0;
+    if (scan_init(&scan, tar_fd, NULL, 0, NULL, 0)) { *no_entries = 0; return 0; }
+    while (res == 0 && (header = scan_next(&scan, &offset)) != NULL) {
+        char typeflag = header[156];
+        if (typeflag == XHDTYPE || typeflag == XGLTYPE) { continue; } // pax records, not members
+        size_t len = header_path(header, name);
+        if (len < prefix_len || memcmp(name, dir, prefix_len)) {
+            if (len != dir_len || memcmp(name, dir, dir_len)) { continue; }
+            res = dir_seen && list_kind_changed(dir_type, typeflag) ? -2 : 0;
+            dir_seen = 1;
+            dir_type = typeflag;
+            continue;
+        }
+        if (len == prefix_len) {
+            res = slash_seen && list_kind_changed(slash_type, typeflag) ? -2 : 0;
+            slash_seen = 1;
+            slash_type = typeflag;
+            continue;
+        }
+        const char *rest = &name[prefix_len];
+        if (rest[0] == '/' || memmem(rest, len - prefix_len, "//", 2) != NULL) { res = -2; break; }
+
+        const char *slash = memchr(rest, '/', len - prefix_len);
+        size_t entry_len = slash == NULL ? len : (size_t) (slash - name) + 1; // "dir/c", or "dir/c/" for a directory
+        uint32_t known = list_names_find(&names, name, entry_len);
+        if (entry_len == len && known != UINT32_MAX) { // a member added again (the last one wins)
+            res = list_kind_changed(names.names[known].typeflag, typeflag) ? -2 : 0;
+            names.names[known].typeflag = typeflag;
+            continue;
+        }
+        if (entry_len < len) { // the directory of a deeper member
+            uint32_t member = list_names_find(&names, name, entry_len - 1);
+            if (known != UINT32_MAX || (member != UINT32_MAX && names.names[member].typeflag == DIRTYPE)) { continue; }
+            typeflag = DIRTYPE;
+        }
+        int under_name = !slash_seen && dir_seen && dir_type == DIRTYPE;
+        if (!under_name) { slash_seen = 1; } // an implicit "dir/" if not met yet
+        if (list_names_add(&names, name, entry_len, typeflag, under_name)) { res = -1; }
     }
-    if (current_name[i] == '\0' || (current_name[i] == '/' && current_name[i+1] == '\0')){ return 0; }
-    return 1;
+    scan_free(&scan);
+
+    size_t found = 0;
+    int under_name = dir_seen;
+    char listed_type = dir_seen ? dir_type : slash_type;
+    if (res == 0 && !scan.err && (dir_seen || slash_seen)) {
+        res = IS_LINK(listed_type) ? -2 : listed_type == DIRTYPE;
+    }
+    for (uint32_t i = 0; res == 1 && i < names.no_names && found < *no_entries; i++) {
+        if (names.names[i].under_name != under_name) { continue; }
+        memcpy(entries[found], &names.strings[names.names[i].offset], names.names[i].len);
+        entries[found++][names.names[i].len] = '\0';
+    }
+    free(names.names);
+    free(names.buckets);
+    free(names.strings);
+    if (res == -2) { return -2; }
+    *no_entries = found;
+    return res == 1;
 }
 
 /**
  * Lists the entries at a given path in the archive.
  * list() does not recurse into the directories listed at the given path.
+ * The headers are read once, without building an index; if the directory is a link, or its entries are filed in
+ * ways a single scan cannot follow, a handle is built then dropped, which costs a tar_open() of the whole archive.
  *
  * Example:
  *  dir/          list(..., "dir/", ...) lists "dir/a", "dir/b", "dir/c/" and "dir/e/"
@@ -233,71 +1299,31 @@ int indirbutnotdir(char *real_name, char *current_name, size_t size_real){
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
  * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
- * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param entries An array of char arrays of TAR_PATH_MAX bytes each, they receive the whole paths of the entries.
  * @param no_entries An in-out argument.
  *                   The caller set it to the number of entries in `entries`.
  *                   The callee set it to the number of entries listed.
  *
  * @return zero if no directory at the given path exists in the archive,
- *         any other value otherwise.
+ *         any other value otherwise, for an existing but empty directory too.
  */
 int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
-    char buffer[512]; // because it is structured by blocks of 512 bytes !
-    char real_name[100]; // au cas où c'est un symlink
-    strncpy(real_name, path, 100);
-    size_t size = strlen(real_name);
-
-    uint16_t blocks_skip;
-    size_t max = *no_entries;
-    int err;
-
-    size_t found = 0;
-    while (found < max){
-        err = read(tar_fd, buffer, 512);
-        if (err == -1){ printf("Error while reading\n"); return 0; }
-        // end of the file
-        if (buffer[0] == '\0') {
-            reset(tar_fd);
-            *no_entries = found;
-            return found; }
-        if (err < 512 && err > -1) { 
-            reset(tar_fd);
-            *no_entries = found;
-            return found; }
-        
-        // Si le dossier recherché est un symlink
-        if (!strcmp(real_name, &buffer[0]) && buffer[156] == SYMTYPE){
-            strncpy(real_name, &buffer[157], 100);
-            size = strlen(real_name);
-            reset(tar_fd);
-        }
-        // Si le fichier est DANS le dossier et n'est pas le dossier
-        else if (indirbutnotdir(real_name, &buffer[0], size)){
-            // Si le fichier n'est pas DANS un sous-dossier (peu importe le type de fichier, on copie son nom et wala)
-            if (notinsubdir(&buffer[size])) {
-                strncpy(entries[found], &buffer[0], 100);
-                found++;
-            }
-        }
-        // Si quelque chose a été copié, c'est qu'on a finit de parcourir les fichiers intéressants
-        else if (found > 0) {
-            reset(tar_fd);
-            *no_entries = found;
-            return 1;
-        }
-
-        // next file
-        blocks_skip = ceilC(strtol(&buffer[124], NULL, 8) / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
-    }
-
-    reset(tar_fd);
-    *no_entries = found;
-    return 1;
+    STAT_CALL(TAR_OP_LIST);
+    int res = list_scan(tar_fd, path, entries, no_entries);
+    if (res != -2) { return res; }
+    // a link to resolve, or paths the tree of a handle files in ways a single scan cannot follow
+    tar_t *tar = tar_open(tar_fd, 0);
+    if (tar == NULL) { *no_entries = 0; return 0; }
+    res = tar_list(tar, path, entries, no_entries);
+    tar_close(tar);
+    return res;
 }
 
 /**
  * Reads a file at a given path in the archive.
+ * The headers are read once, then once more for each link followed. Reading from a compressed archive builds a
+ * handle then drops it, which costs a tar_open() of the whole archive: use tar_open() and tar_read_file() to read
+ * many files.
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
  * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry.
@@ -309,52 +1335,3819 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries) {
  *
  * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
  *         -2 if the offset is outside the file total length,
+ *         -3 if the archive could not be read, `len` is then set to 0,
  *         zero if the file was read in its entirety into the destination buffer,
  *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
  *         the end of the file.
  *
  */
-ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) { // todo : if sym
-    unsigned long path_name = hash(path);
-    unsigned long current_name;
-    char buffer[512];
+ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len) {
+    STAT_CALL(TAR_OP_READ_FILE);
+    static const char types[] = {REGTYPE, AREGTYPE, SYMTYPE, LNKTYPE};
+    char header[512];
+    uint64_t header_offset;
+    int found = scan_find(tar_fd, path, types, sizeof(types), 0, header, &header_offset);
+    if (found == -1) { *len = 0; return -3; } // error on reading
+    if (found == 0) { *len = 0; return -1; }
+
+    if (zsrc_format(tar_fd) != TAR_Z_NONE) {
+        // index the archive once, every checkpoint is recorded while indexing
+        tar_t *tar = tar_open(tar_fd, 0);
+        if (tar == NULL) { *len = 0; return -3; }
+        ssize_t res = tar_read_file(tar, path, offset, dest, len);
+        tar_close(tar);
+        return res;
+    }
+    if (IS_LINK(header[156])) { found = scan_follow(tar_fd, header, &header_offset); }
+    if (found == -1) { *len = 0; return -3; } // error on reading
+    if (found == 0 || (header[156] != REGTYPE && header[156] != AREGTYPE)) { *len = 0; return -1; }
+
+    uint64_t size = header_size(header);
+    if (offset >= size) { *len = 0; return -2; }
+    size_t to_read = size - offset < *len ? size - offset : *len;
+    ssize_t err = pread_full(tar_fd, dest, to_read, header_offset + 512 + offset);
+    if (err == -1) { *len = 0; return -3; } // error on reading
+    *len = err;
+    return size - offset - err;
+}
+
+
+/* ========== BATCH LOOKUP ========== */
+
+/**
+ * Looks many paths up in a single pass over the headers of the archive.
+ * By default every header is read: a path added again later replaces the member before, as tar extracts them.
+ * With TAR_LOOKUP_FIRST, each path is answered from its first member instead, and the pass stops as soon as every
+ * path is found: enough to check that a manifest is in the archive, unless it holds members added again later.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file. Its offset is not moved.
+ * @param paths An array of paths to entries in the archive, a path may be given more than once.
+ * @param no_paths The number of paths in `paths`.
+ * @param results An array of no_paths results, results[i] is filled for paths[i] from the last header named paths[i],
+ *                or from the first one with TAR_LOOKUP_FIRST.
+ * @param flags Zero or TAR_LOOKUP_FIRST.
+ *
+ * @return the number of paths found in the archive, -4 if the archive could not be read.
+ */
+int tar_lookup_batch(int tar_fd, char **paths, size_t no_paths, tar_lookup_t *results, int flags) {
+    STAT_CALL(TAR_OP_LOOKUP_BATCH);
+    size_t no_slots = 16;
+    while (no_slots < no_paths * 2) { no_slots *= 2; }
+    size_t *slots = malloc(sizeof(size_t) * no_slots); // open addressing, the index of a path or no_paths if free
+    uint32_t *hashes = malloc(sizeof(uint32_t) * (no_paths + 1));
+    if (slots == NULL || hashes == NULL) { free(slots); free(hashes); return -4; }
+
+    for (size_t i = 0; i < no_slots; i++) { slots[i] = no_paths; }
+    for (size_t i = 0; i < no_paths; i++) {
+        memset(&results[i], 0, sizeof(tar_lookup_t));
+        hashes[i] = hash(paths[i]);
+        size_t slot = hashes[i] & (no_slots - 1);
+        while (slots[slot] != no_paths) { slot = (slot + 1) & (no_slots - 1); }
+        slots[slot] = i;
+    }
+
+    tar_scan_t scan;
+    const char *header;
+    uint64_t offset;
+    size_t found = 0;
+    char name[TAR_PATH_MAX];
+    if (scan_init(&scan, tar_fd, NULL, 0, NULL, 0)) { free(slots); free(hashes); return -4; }
+    while ((!(flags & TAR_LOOKUP_FIRST) || found < no_paths) && (header = scan_next(&scan, &offset)) != NULL) {
+        if (header[156] == XHDTYPE || header[156] == XGLTYPE) { continue; } // pax records, not members
+        size_t len = header_path(header, name);
+        uint32_t h = hash(name);
+        // every request of this path, duplicates included, found again if the path was seen before
+        for (size_t slot = h & (no_slots - 1); slots[slot] != no_paths; slot = (slot + 1) & (no_slots - 1)) {
+            size_t i = slots[slot];
+            if (hashes[i] != h || strcmp(paths[i], name) || ((flags & TAR_LOOKUP_FIRST) && results[i].found)) { continue; }
+            found += !results[i].found;
+            results[i].found = 1;
+            results[i].typeflag = header[156];
+            results[i].size = header_size(header);
+            results[i].data_offset = offset + 512;
+            len = strnlen(&header[157], 100);
+            memcpy(results[i].linkname, &header[157], len);
+            results[i].linkname[len] = '\0';
+        }
+    }
+    scan_free(&scan);
+    free(slots);
+    free(hashes);
+    if (scan.err) { return -4; } // error on reading
+    return found;
+}
+
+
+/* ========== SCATTER-GATHER READ ========== */
+
+#define TAR_GATHER_GAP 4096     // two ranges closer than this are read by the same preadv()
+#define TAR_GATHER_IOV 1024
+
+typedef struct gather_seg {
+    uint64_t start;     // offset in the archive
+    size_t len;
+    size_t req;         // index of the request
+} gather_seg_t;
+
+static int gather_seg_cmp(const void *a, const void *b) {
+    const gather_seg_t *x = a;
+    const gather_seg_t *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+// read the segments [first, last) with one preadv(), the gaps between them go to scratch
+static void gather_read(int tar_fd, gather_seg_t *segs, size_t first, size_t last, tar_read_req_t *reqs, uint8_t *scratch) {
+    struct iovec iov[TAR_GATHER_IOV];
+    int no_iov = 0;
+    size_t total = 0;
+    for (size_t i = first; i < last; i++) {
+        if (i > first && segs[i].start > segs[i - 1].start + segs[i - 1].len) {
+            iov[no_iov].iov_base = scratch;
+            iov[no_iov++].iov_len = segs[i].start - (segs[i - 1].start + segs[i - 1].len);
+            total += iov[no_iov - 1].iov_len;
+        }
+        iov[no_iov].iov_base = reqs[segs[i].req].dest;
+        iov[no_iov++].iov_len = segs[i].len;
+        total += segs[i].len;
+    }
+    ssize_t err = preadv(tar_fd, iov, no_iov, (off_t) segs[first].start);
+    STAT_ADD(read_calls, 1);
+    if (err > 0) { STAT_ADD(bytes_read, err); }
+    if (err == (ssize_t) total) { return; }
+
+    // short read (truncated archive, signal...): each segment on its own
+    for (size_t i = first; i < last; i++) {
+        tar_read_req_t *req = &reqs[segs[i].req];
+        err = pread_full(tar_fd, req->dest, segs[i].len, segs[i].start);
+        if (err == -1) { req->len = 0; req->status = -3; continue; } // error on reading
+        req->status += segs[i].len - err;
+        req->len = err;
+    }
+}
+
+/**
+ * Reads many files of the archive in one call: the paths are resolved in one pass over the headers,
+ * then the reads are sorted by offset in the archive and close ranges are merged into a few preadv().
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file. Its offset is not moved.
+ * @param reqs An array of requests, each one is filled like a call to read_file():
+ *             path, offset and dest are the arguments of read_file(), len is the in-out argument,
+ *             status is set to the value read_file() would return.
+ * @param no_reqs The number of requests in `reqs`.
+ *
+ * @return zero on success, -4 if the headers of the archive could not be read.
+ */
+int tar_read_batch(int tar_fd, tar_read_req_t *reqs, size_t no_reqs) {
+    STAT_CALL(TAR_OP_READ_BATCH);
+    if (zsrc_format(tar_fd) != TAR_Z_NONE) {
+        // no preadv() in a compressed archive: a handle decompresses each request from its checkpoint
+        tar_t *tar = tar_open(tar_fd, 0);
+        if (tar == NULL) { return -4; }
+        for (size_t i = 0; i < no_reqs; i++) {
+            reqs[i].status = tar_read_file(tar, reqs[i].path, reqs[i].offset, reqs[i].dest, &reqs[i].len);
+        }
+        tar_close(tar);
+        return 0;
+    }
+
+    char **paths = malloc(sizeof(char *) * (no_reqs + 1));
+    char (*targets)[TAR_PATH_MAX] = malloc(sizeof(*targets) * (no_reqs + 1));
+    size_t *pending = malloc(sizeof(size_t) * (no_reqs + 1));
+    tar_lookup_t *found = malloc(sizeof(tar_lookup_t) * (no_reqs + 1));
+    tar_lookup_t *results = malloc(sizeof(tar_lookup_t) * (no_reqs + 1));
+    gather_seg_t *segs = malloc(sizeof(gather_seg_t) * (no_reqs + 1));
+    uint8_t *scratch = malloc(TAR_GATHER_GAP);
+    int ret = -4;
+    if (paths == NULL || targets == NULL || pending == NULL || found == NULL || results == NULL || segs == NULL || scratch == NULL) {
+        goto out;
+    }
+
+    // resolve every path, then one more pass for each level of symlinks
+    size_t no_pending = 0;
+    for (size_t i = 0; i < no_reqs; i++) { pending[no_pending++] = i; }
+    for (int hops = 0; no_pending > 0 && hops <= TAR_MAX_HOPS; hops++) {
+        for (size_t i = 0; i < no_pending; i++) {
+            paths[i] = hops == 0 ? reqs[pending[i]].path : targets[pending[i]];
+        }
+        if (tar_lookup_batch(tar_fd, paths, no_pending, found, 0) < 0) { goto out; }
+        size_t still = 0;
+        for (size_t i = 0; i < no_pending; i++) {
+            size_t req = pending[i];
+            results[req] = found[i];
+            char target[TAR_PATH_MAX];
+            if (found[i].found && IS_LINK(found[i].typeflag)
+                && link_target(paths[i], found[i].typeflag, found[i].linkname, target) >= 0) {
+                strcpy(targets[req], target);
+                pending[still++] = req;
+            }
+        }
+        no_pending = still;
+        STAT_ADD(symlink_hops, still);
+    }
+
+    size_t no_segs = 0;
+    for (size_t i = 0; i < no_reqs; i++) {
+        tar_read_req_t *req = &reqs[i];
+        tar_lookup_t *res = &results[i];
+        if (!res->found || (res->typeflag != REGTYPE && res->typeflag != AREGTYPE)) { req->len = 0; req->status = -1; continue; }
+        if (req->offset >= res->size) { req->len = 0; req->status = -2; continue; }
+        req->len = res->size - req->offset < req->len ? res->size - req->offset : req->len;
+        req->status = res->size - req->offset - req->len;
+        if (req->len == 0) { continue; }
+        segs[no_segs].start = res->data_offset + req->offset;
+        segs[no_segs].len = req->len;
+        segs[no_segs++].req = i;
+    }
+    qsort(segs, no_segs, sizeof(gather_seg_t), gather_seg_cmp);
+
+    // merge the segments closer than TAR_GATHER_GAP, as long as the iovec array can hold them
+    size_t first = 0;
+    while (first < no_segs) {
+        size_t last = first + 1;
+        int no_iov = 1;
+        while (last < no_segs && no_iov + 2 <= TAR_GATHER_IOV) {
+            uint64_t end = segs[last - 1].start + segs[last - 1].len;
+            if (segs[last].start < end || segs[last].start - end > TAR_GATHER_GAP) { break; } // overlap or too far
+            no_iov += segs[last].start > end ? 2 : 1;
+            last++;
+        }
+        gather_read(tar_fd, segs, first, last, reqs, scratch);
+        first = last;
+    }
+    ret = 0;
+
+out:
+    free(paths);
+    free(targets);
+    free(pending);
+    free(found);
+    free(results);
+    free(segs);
+    free(scratch);
+    return ret;
+}
+
+
+/* ========== ARCHIVE HANDLE ========== */
+
+#define TAR_NOENT UINT32_MAX
+#define TAR_IMPLICIT UINT64_MAX // header_offset of a directory only known from the paths of its entries
+#define TAR_ROOT 0              // id of the root directory, always the first entry
+#define TAR_UNRESOLVED (UINT32_MAX - 1) // target of a link not resolved yet
+#define TAR_RESOLVING (UINT32_MAX - 2)  // target of a link being resolved, meeting it again is a cycle
+
+#define DATA_OFFSET(entry) ((entry)->header_offset + 512) // the content of a member follows its header
+
+typedef struct id_list {
+    uint32_t *ids;
+    uint32_t len;
+    uint32_t max;
+} id_list_t;
+
+typedef struct index_dep {
+    uint32_t hash;      // of a path looked up by the link, without its trailing '/'
+    uint32_t link;
+    uint32_t next;      // the next dep of the same bucket, TAR_NOENT if none
+} index_dep_t;
+
+/*
+ * What a writer needs to update the index of its handle after adding members, kept while it is open.
+ * The paths each link looked up while it was resolved: once a path is added or replaced, only the links that looked
+ * it up are resolved again, then the links that looked those up. A link resolved again leaves its old deps behind,
+ * they only cost a needless resolution, until every link is resolved again from scratch.
+ * Then the entries and the buckets changed since the last flush, for the sidecar index.
+ */
+typedef struct index_track {
+    index_dep_t *deps;
+    uint32_t no_deps;
+    uint32_t max_deps;
+    uint32_t *dep_buckets;  // the first dep of each bucket, max_deps of them
+    uint32_t built_deps;    // deps recorded the last time every link was resolved
+    uint32_t resolving;     // the link whose lookups are recorded, TAR_NOENT if none
+    id_list_t paths;        // the entries added or replaced
+    id_list_t entries;      // the entries changed in any way
+    id_list_t buckets;      // the buckets whose first entry changed
+    int rehashed;           // the buckets changed all at once
+    int failed;             // out of memory: every link is resolved again and the sidecar index written whole
+} index_track_t;
+
+// the sidecar index a handle was loaded from or written to, for a writer to append its deltas to
+typedef struct index_file {
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;          // bytes of the file, its deltas included, 0 if the handle has none
+    uint64_t base_len;      // bytes before the first delta
+    uint32_t max_entries;   // room for the entries and the strings added by the deltas
+    uint32_t no_buckets;
+    uint64_t strings_max;
+    uint32_t no_entries;    // the entries and the string pool of the file, its deltas applied
+    uint64_t strings_len;
+} index_file_t;
+
+struct tar_archive {
+    int fd;
+    tar_entry_t *entries;
+    uint32_t no_entries;
+    uint32_t max_entries;
+    char *strings;      // the components of the paths and the link targets, one after the other, '\0' terminated
+    size_t strings_len;
+    size_t strings_max;
+    uint32_t *components; // the components in the string pool, by hash, while entries are added; 0 is a free slot
+    uint32_t no_components;
+    uint32_t max_components;
+    uint32_t *buckets;  // index of the first entry of each bucket, the size is a power of 2
+    uint32_t no_buckets;
+    const uint8_t *map; // the whole archive if opened with TAR_MMAP, NULL otherwise
+    size_t map_size;
+    void *index_map;    // the sidecar index if loaded by tar_open_index(), the entries, buckets and strings point in it
+    size_t index_map_size;
+    uint32_t no_sorted; // the first entries of the mapped index, written in the order of their paths
+    index_file_t index_file;
+    index_track_t *track; // while a writer adds members through the handle, NULL otherwise
+    tar_zsrc_t *z;      // for a compressed archive, its checkpoints, NULL otherwise
+    uint32_t *sorted;   // the ids of the entries sorted by path, built by the first query
+    tar_scan_t *lazy;   // opened with TAR_LAZY, the scan of the headers not indexed yet, NULL once they all are
+    int lazy_err;       // -4 once that scan failed to read a header or to index it: every lookup fails from then on
+    tar_t **layers;     // for an overlay, a handle on each archive, bottom first, without index; NULL otherwise
+    uint32_t no_layers;
+    uint16_t layer;     // the layer of the entries being added
+    pthread_mutex_t sort_lock;
+};
+
+
+// copy the string in the pool and return its offset, 0 on error (offset 0 is always "")
+static uint32_t pool_add(tar_t *tar, const char *str, size_t len) {
+    if (tar->strings_len + len + 1 > tar->strings_max) {
+        size_t max = tar->strings_max ? tar->strings_max : 4096;
+        while (tar->strings_len + len + 1 > max) { max *= 2; }
+        if (max > UINT32_MAX) { return 0; }
+        char *strings = realloc(tar->strings, max);
+        if (strings == NULL) { return 0; }
+        tar->strings = strings;
+        tar->strings_max = max;
+    }
+    uint32_t off = tar->strings_len;
+    memcpy(&tar->strings[off], str, len);
+    tar->strings[off + len] = '\0';
+    tar->strings_len += len + 1;
+    return off;
+}
+
+static uint32_t component_hash(const char *str, size_t len) {
+    uint32_t h = 0;
+    for (size_t i = 0; i < len; i++) { h = ((h << 5) + h) + str[i]; }
+    return h;
+}
+
+// the offset of the component str[0..len[ in the string pool, added once however many entries share it, 0 on error
+static uint32_t pool_intern(tar_t *tar, const char *str, size_t len) {
+    if (len == 0) { return 0; }
+    if (tar->no_components * 2 >= tar->max_components) {
+        uint32_t max = tar->max_components ? tar->max_components * 2 : 1024;
+        uint32_t *components = calloc(max, sizeof(uint32_t));
+        if (components == NULL) { return 0; }
+        for (uint32_t i = 0; i < tar->max_components; i++) {
+            uint32_t off = tar->components[i];
+            if (off == 0) { continue; }
+            uint32_t slot = component_hash(&tar->strings[off], strlen(&tar->strings[off])) & (max - 1);
+            while (components[slot] != 0) { slot = (slot + 1) & (max - 1); }
+            components[slot] = off;
+        }
+        free(tar->components);
+        tar->components = components;
+        tar->max_components = max;
+    }
+    uint32_t slot = component_hash(str, len) & (tar->max_components - 1);
+    for (; tar->components[slot] != 0; slot = (slot + 1) & (tar->max_components - 1)) {
+        const char *known = &tar->strings[tar->components[slot]];
+        if (!strncmp(known, str, len) && known[len] == '\0') { return tar->components[slot]; }
+    }
+    uint32_t off = pool_add(tar, str, len);
+    if (off == 0) { return 0; }
+    tar->components[slot] = off;
+    tar->no_components++;
+    return off;
+}
+
+// the length of the path of the entry
+static size_t entry_path_len(tar_t *tar, uint32_t id) {
+    size_t len = 0;
+    for (; id != TAR_NOENT; id = tar->entries[id].parent) { len += strlen(&tar->strings[tar->entries[id].name]); }
+    return len;
+}
+
+// the path of the entry in out (TAR_PATH_MAX bytes), the components of its parents then its own; its length
+static size_t entry_path(tar_t *tar, uint32_t id, char *out) {
+    size_t len = entry_path_len(tar, id);
+    out[len] = '\0';
+    for (size_t end = len; id != TAR_NOENT; id = tar->entries[id].parent) {
+        const char *component = &tar->strings[tar->entries[id].name];
+        size_t component_len = strlen(component);
+        end -= component_len;
+        memcpy(&out[end], component, component_len);
+    }
+    return len;
+}
+
+// whether the path of the entry is path[0..len[, compared from its last component up
+static int entry_path_is(tar_t *tar, uint32_t id, const char *path, size_t len) {
+    for (; id != TAR_NOENT; id = tar->entries[id].parent) {
+        const char *component = &tar->strings[tar->entries[id].name];
+        size_t component_len = strlen(component);
+        if (component_len > len || memcmp(&path[len - component_len], component, component_len)) { return 0; }
+        len -= component_len;
+    }
+    return len == 0;
+}
+
+// the length of the path of the directory of path[0..len[, without the '/' after it
+static size_t path_parent_len(const char *path, size_t len) {
+    if (len > 0 && path[len - 1] == '/') { len--; }
+    while (len > 0 && path[len - 1] != '/') { len--; }
+    return len > 0 ? len - 1 : 0;
+}
+
+// append id to the list, -1 if out of memory
+static int id_list_add(id_list_t *list, uint32_t id) {
+    if (list->len == list->max) {
+        uint32_t max = list->max ? list->max * 2 : 64;
+        uint32_t *ids = realloc(list->ids, sizeof(uint32_t) * max);
+        if (ids == NULL) { return -1; }
+        list->ids = ids;
+        list->max = max;
+    }
+    list->ids[list->len++] = id;
+    return 0;
+}
+
+// a path looked up by the link being resolved, recorded while a writer tracks the handle
+static void track_lookup(tar_t *tar, const char *path, size_t len) {
+    index_track_t *track = tar->track;
+    if (track == NULL || track->resolving == TAR_NOENT || track->failed) { return; }
+    if (track->no_deps == track->max_deps) {
+        uint32_t max = track->max_deps ? track->max_deps * 2 : 1024;
+        index_dep_t *deps = realloc(track->deps, sizeof(index_dep_t) * max);
+        uint32_t *buckets = deps != NULL ? malloc(sizeof(uint32_t) * max) : NULL;
+        if (deps != NULL) { track->deps = deps; }
+        if (buckets == NULL) { track->failed = 1; return; }
+        for (uint32_t b = 0; b < max; b++) { buckets[b] = TAR_NOENT; }
+        for (uint32_t d = 0; d < track->no_deps; d++) {
+            uint32_t b = deps[d].hash & (max - 1);
+            deps[d].next = buckets[b];
+            buckets[b] = d;
+        }
+        free(track->dep_buckets);
+        track->dep_buckets = buckets;
+        track->max_deps = max;
+    }
+    if (len > 0 && path[len - 1] == '/') { len--; }
+    uint32_t h = component_hash(path, len);
+    uint32_t b = h & (track->max_deps - 1);
+    track->deps[track->no_deps] = (index_dep_t) {h, track->resolving, track->dep_buckets[b]};
+    track->dep_buckets[b] = track->no_deps++;
+}
+
+// an entry changed, and its path too if it is new or replaced, recorded while a writer tracks the handle
+static void track_entry(tar_t *tar, uint32_t id, int path) {
+    index_track_t *track = tar->track;
+    if (track == NULL || id == TAR_NOENT) { return; }
+    if (id_list_add(&track->entries, id) || (path && id_list_add(&track->paths, id))) { track->failed = 1; }
+}
+
+static void track_bucket(tar_t *tar, uint32_t b) {
+    if (tar->track != NULL && id_list_add(&tar->track->buckets, b)) { tar->track->failed = 1; }
+}
+
+static int index_rehash(tar_t *tar, uint32_t no_buckets) {
+    uint32_t *buckets = malloc(sizeof(uint32_t) * no_buckets);
+    if (buckets == NULL) { return -1; }
+    for (uint32_t i = 0; i < no_buckets; i++) { buckets[i] = TAR_NOENT; }
+    for (uint32_t i = 0; i < tar->no_entries; i++) {
+        uint32_t b = tar->entries[i].hash & (no_buckets - 1);
+        tar->entries[i].next = buckets[b];
+        buckets[b] = i;
+    }
+    free(tar->buckets);
+    tar->buckets = buckets;
+    tar->no_buckets = no_buckets;
+    if (tar->track != NULL) { tar->track->rehashed = 1; }
+    return 0;
+}
+
+static uint32_t index_find_id(tar_t *tar, char *path) {
+    uint32_t h = hash(path);
+    if (tar->no_buckets == 0) { return TAR_NOENT; }
+    size_t len = strlen(path);
+    for (uint32_t i = tar->buckets[h & (tar->no_buckets - 1)]; i != TAR_NOENT; i = tar->entries[i].next) {
+        if (tar->entries[i].hash == h && entry_path_is(tar, i, path, len)) {
+            return i;
+        }
+    }
+    return TAR_NOENT;
+}
+
+static int index_scan_next(tar_t *tar);
+
+// the entry at path; a lazy handle indexes the headers after its frontier until it is found
+static tar_entry_t *index_find(tar_t *tar, char *path) {
+    uint32_t id;
+    while ((id = index_find_id(tar, path)) == TAR_NOENT && index_scan_next(tar) == 0) {}
+    return id == TAR_NOENT ? NULL : &tar->entries[id];
+}
+
+// like index_find(), but only for the entries that have a header in the archive
+static tar_entry_t *index_member(tar_t *tar, char *path) {
+    tar_entry_t *entry = index_find(tar, path);
+    // a lazy handle may know a directory from the path of an entry before reaching its own header
+    while (entry != NULL && entry->header_offset == TAR_IMPLICIT && index_scan_next(tar) == 0) {
+        entry = index_find(tar, path);
+    }
+    return entry == NULL || entry->header_offset == TAR_IMPLICIT ? NULL : entry;
+}
+
+/*
+ * A new entry at path[0..len[ ('\0' terminated), an implicit directory until a header describes it, the last child
+ * of parent. Only the end of its path after the path of parent is stored: the path of a directory is stored once
+ * for all its entries. The name of a directory is interned, "src/" or "lib/" once for all the directories named so.
+ * An entry outside of the tree (parent TAR_NOENT) stores its whole path.
+ */
+static uint32_t index_new(tar_t *tar, const char *path, size_t len, uint32_t parent) {
+    if (tar->no_entries == TAR_NOENT) { return TAR_NOENT; }
+    if (tar->no_entries == tar->max_entries) {
+        uint32_t max = tar->max_entries ? tar->max_entries * 2 : 64;
+        tar_entry_t *entries = realloc(tar->entries, sizeof(tar_entry_t) * max);
+        if (entries == NULL) { return TAR_NOENT; }
+        tar->entries = entries;
+        tar->max_entries = max;
+    }
+    if (tar->no_entries >= tar->no_buckets && index_rehash(tar, tar->no_buckets ? tar->no_buckets * 2 : 64)) { return TAR_NOENT; }
+
+    size_t parent_len = parent == TAR_NOENT ? 0 : entry_path_len(tar, parent);
+    const char *component = &path[parent_len];
+    size_t component_len = len - parent_len;
+    int is_dir = component_len > 0 && component[component_len - 1] == '/';
+    uint32_t name = is_dir ? pool_intern(tar, component, component_len) : pool_add(tar, component, component_len);
+    if (name == 0 && component_len > 0) { return TAR_NOENT; }
+    uint32_t id = tar->no_entries++;
+    tar_entry_t *entry = &tar->entries[id];
+    memset(entry, 0, sizeof(tar_entry_t));
+    entry->name = name;
+    entry->header_offset = TAR_IMPLICIT;
+    entry->typeflag = DIRTYPE;
+    entry->hash = hash((char *) path);
+    entry->parent = parent;
+    entry->first_child = entry->last_child = entry->next_sibling = entry->target = TAR_NOENT;
+    entry->layer = tar->layer;
+
+    uint32_t b = entry->hash & (tar->no_buckets - 1);
+    entry->next = tar->buckets[b];
+    tar->buckets[b] = id;
+    track_bucket(tar, b);
+    track_entry(tar, id, 1);
+    if (parent != TAR_NOENT) {
+        tar_entry_t *dir = &tar->entries[parent];
+        if (dir->last_child == TAR_NOENT) { dir->first_child = id; }
+        else { tar->entries[dir->last_child].next_sibling = id; }
+        track_entry(tar, dir->last_child, 0);
+        track_entry(tar, parent, 0);
+        dir->last_child = id;
+    }
+    return id;
+}
+
+// the id of the directory at path (without its trailing '/'), created as an implicit directory if needed
+static uint32_t index_dir(tar_t *tar, const char *path, size_t len) {
+    char name[TAR_PATH_MAX + 2];
+    if (len == 0) { return TAR_ROOT; }
+    memcpy(name, path, len);
+    name[len] = '/';
+    name[len + 1] = '\0';
+    uint32_t id = index_find_id(tar, name);
+    if (id != TAR_NOENT) { return id; }
+    name[len] = '\0';
+    id = index_find_id(tar, name);
+    if (id != TAR_NOENT && tar->entries[id].typeflag == DIRTYPE) { return id; }
+
+    uint32_t parent = index_dir(tar, name, path_parent_len(name, len));
+    if (parent == TAR_NOENT) { return TAR_NOENT; }
+    name[len] = '/';
+    return index_new(tar, name, len + 1, parent);
+}
+
+// add the entry described by the header at header_offset, return -1 on error
+static int index_add(tar_t *tar, const char *buffer, uint64_t header_offset) {
+    if (buffer[156] == XHDTYPE || buffer[156] == XGLTYPE) { return 0; } // pax records, not members
+    char name[TAR_PATH_MAX];
+    size_t len = header_path(buffer, name);
+
+    // a directory already seen in the path of an entry, or a member added again (the last one wins)
+    uint32_t id = index_find_id(tar, name);
+    if (id == TAR_NOENT) {
+        uint32_t parent = index_dir(tar, name, path_parent_len(name, len));
+        if (parent == TAR_NOENT || (id = index_new(tar, name, len, parent)) == TAR_NOENT) { return -1; }
+    }
+
+    uint32_t linkname = 0;
+    len = strnlen(&buffer[157], 100);
+    if (len > 0 && (linkname = pool_add(tar, &buffer[157], len)) == 0) { return -1; }
+    tar_entry_t *entry = &tar->entries[id];
+    entry->linkname = linkname;
+    entry->header_offset = header_offset;
+    entry->size = header_size(buffer);
+    entry->typeflag = buffer[156];
+    entry->target = IS_LINK(entry->typeflag) ? TAR_UNRESOLVED : TAR_NOENT;
+    entry->layer = tar->layer;
+    track_entry(tar, id, 1);
+    return 0;
+}
+
+// the id of the entry at path[0..len[, or at the directory path/, TAR_NOENT if none
+static uint32_t index_lookup(tar_t *tar, const char *path, size_t len) {
+    char name[TAR_PATH_MAX + 2];
+    memcpy(name, path, len);
+    name[len] = '\0';
+    name[len + 1] = '\0';
+    uint32_t id;
+    do {
+        id = index_find_id(tar, name);
+        if (id == TAR_NOENT && len > 0) {
+            // a link to a directory is often stored without its trailing '/'
+            name[len] = '/';
+            id = index_find_id(tar, name);
+            name[len] = '\0';
+        }
+    } while (id == TAR_NOENT && index_scan_next(tar) == 0);
+    return id;
+}
+
+static uint32_t index_resolve(tar_t *tar, uint32_t id, int depth, int *capped);
+
+// the hops of a resolved link, zero for any other entry
+static uint8_t index_hops(tar_t *tar, uint32_t id) {
+    return IS_LINK(tar->entries[id].typeflag) ? tar->entries[id].hops : 0;
+}
+
+// the entry the link id points to, following the symlinks met in the directories of its target;
+// hops is set to the longest chain of links followed
+static uint32_t index_walk(tar_t *tar, uint32_t id, int depth, int *capped, uint8_t *hops) {
+    tar_entry_t *entry = &tar->entries[id];
+    char name[TAR_PATH_MAX];
+    char path[TAR_PATH_MAX];
+    entry_path(tar, id, name);
+    int len = link_target(name, entry->typeflag, &tar->strings[entry->linkname], path);
+    if (len < 0) { return TAR_NOENT; }
+
+    for (int start = 0; ; ) {
+        char *slash = memchr(&path[start], '/', len - start);
+        if (slash == NULL) { break; }
+        int end = slash - path;
+        track_lookup(tar, path, end);
+        uint32_t dir = index_lookup(tar, path, end);
+        start = end + 1;
+        if (dir == TAR_NOENT || !IS_LINK(tar->entries[dir].typeflag)) { continue; }
+
+        // a symlink to a directory, the rest of the path goes on from its target
+        uint32_t link = dir;
+        dir = index_resolve(tar, link, depth + 1, capped);
+        if (dir == TAR_NOENT) { return TAR_NOENT; }
+        if (index_hops(tar, link) > *hops) { *hops = index_hops(tar, link); }
+        char dir_name[TAR_PATH_MAX];
+        int dir_len = entry_path(tar, dir, dir_name);
+        if (dir_len > 0 && dir_name[dir_len - 1] == '/') { dir_len--; }
+        int rest = len - end;
+        if (dir_len + rest >= TAR_PATH_MAX) { return TAR_NOENT; }
+        memmove(&path[dir_len], &path[end], rest);
+        memcpy(path, dir_name, dir_len);
+        len = dir_len + rest;
+        start = dir_len + 1;
+        if (dir_len == 0) { memmove(path, &path[1], --len); start = 0; } // a link to the root
+    }
+    track_lookup(tar, path, len);
+    uint32_t link = index_lookup(tar, path, len);
+    if (link == TAR_NOENT) { return TAR_NOENT; }
+    uint32_t target = index_resolve(tar, link, depth + 1, capped);
+    if (target != TAR_NOENT && index_hops(tar, link) > *hops) { *hops = index_hops(tar, link); }
+    return target;
+}
+
+// the entry the link id finally points to, TAR_NOENT if the chain is broken, loops or is longer than TAR_MAX_HOPS
+static uint32_t index_resolve(tar_t *tar, uint32_t id, int depth, int *capped) {
+    tar_entry_t *entry = &tar->entries[id];
+    if (!IS_LINK(entry->typeflag)) { return id; }
+    if (entry->target == TAR_RESOLVING) { return TAR_NOENT; } // a cycle
+    if (entry->target != TAR_UNRESOLVED) {
+        // resolved before, from here the chain may be too long: the result does not depend on the order of resolution
+        if (entry->target != TAR_NOENT && depth + entry->hops - 1 > TAR_MAX_HOPS) { *capped = 1; return TAR_NOENT; }
+        return entry->target;
+    }
+    if (depth > TAR_MAX_HOPS) { *capped = 1; return TAR_NOENT; }
+
+    entry->target = TAR_RESOLVING;
+    STAT_ADD(symlink_hops, 1);
+    uint8_t hops = 0;
+    uint32_t resolving = tar->track != NULL ? tar->track->resolving : TAR_NOENT;
+    if (tar->track != NULL) { tar->track->resolving = id; }
+    uint32_t target = index_walk(tar, id, depth, capped, &hops);
+    if (tar->track != NULL) { tar->track->resolving = resolving; }
+    // a chain cut by the depth limit may be short enough from this link, it is tried again on its own
+    tar->entries[id].target = *capped && depth > 0 ? TAR_UNRESOLVED : target;
+    tar->entries[id].hops = hops + 1;
+    return target;
+}
+
+// resolve every link of the index once, so that following one later costs O(1)
+static void index_resolve_all(tar_t *tar) {
+    for (uint32_t id = 0; id < tar->no_entries; id++) {
+        int capped = 0;
+        if (tar->entries[id].target == TAR_UNRESOLVED) { index_resolve(tar, id, 0, &capped); }
+    }
+}
+
+// every header is indexed: the links are resolved, and the room kept for more entries is given back
+static void index_done(tar_t *tar) {
+    index_resolve_all(tar);
+    free(tar->components);
+    tar->components = NULL;
+    tar->no_components = tar->max_components = 0;
+    tar_entry_t *entries = realloc(tar->entries, sizeof(tar_entry_t) * tar->no_entries);
+    if (entries != NULL) {
+        tar->entries = entries;
+        tar->max_entries = tar->no_entries;
+    }
+    char *strings = realloc(tar->strings, tar->strings_len);
+    if (strings != NULL) {
+        tar->strings = strings;
+        tar->strings_max = tar->strings_len;
+    }
+}
+
+// the entry a link resolves to, the entry itself if it is not a link, NULL if the link is broken
+static tar_entry_t *index_follow(tar_t *tar, tar_entry_t *entry) {
+    if (entry == NULL || !IS_LINK(entry->typeflag)) { return entry; }
+    uint32_t target = entry->target;
+    if (target == TAR_UNRESOLVED) { // a lazy handle resolves a link when it is first followed
+        int capped = 0;
+        target = index_resolve(tar, entry - tar->entries, 0, &capped);
+    }
+    return target == TAR_NOENT ? NULL : &tar->entries[target];
+}
+
+// a lazy handle indexes the next header after its frontier, -1 once every header is indexed or the scan failed
+static int index_scan_next(tar_t *tar) {
+    if (tar->lazy == NULL) { return -1; }
+    uint64_t pos;
+    const char *header = scan_next(tar->lazy, &pos);
+    if (header != NULL && index_add(tar, header, pos) == 0) { return 0; }
+    if (header != NULL || tar->lazy->err) { tar->lazy_err = -4; } // the index stops short of the end of the archive
+    scan_free(tar->lazy);
+    free(tar->lazy);
+    tar->lazy = NULL;
+    if (!tar->lazy_err) { index_done(tar); }
+    return -1;
+}
+
+// a lazy handle indexes every header left, for the functions that need all of them; -4 if the scan failed
+static int index_scan_all(tar_t *tar) {
+    while (index_scan_next(tar) == 0) {}
+    return tar->lazy_err;
+}
+
+// an empty handle on the archive at fd
+static tar_t *handle_new(int fd) {
+    tar_t *tar = calloc(1, sizeof(tar_t));
+    if (tar == NULL) { return NULL; }
+    tar->fd = fd;
+    pthread_mutex_init(&tar->sort_lock, NULL);
+    return tar;
+}
+
+// an empty index, with the root directory only, -1 on error
+static int index_init(tar_t *tar) {
+    pool_add(tar, "", 0); // offset 0 is the empty string
+    if (tar->strings == NULL || index_rehash(tar, 64) || index_new(tar, "", 0, TAR_NOENT) != TAR_ROOT) { return -1; }
+    return 0;
+}
+
+// the archives of the handle: the layers of an overlay, the handle itself otherwise
+static uint32_t handle_no_layers(tar_t *tar) {
+    return tar->layers != NULL ? tar->no_layers : 1;
+}
+
+// the handle reading the archive of layer i, for an entry the archive it comes from
+static tar_t *handle_layer(tar_t *tar, uint32_t i) {
+    return tar->layers != NULL ? tar->layers[i] : tar;
+}
+
+static int index_embedded(tar_t *tar);
+
+// map the archive if asked by the flags of tar_open()
+static int archive_map(tar_t *tar, int flags) {
+    if (!(flags & TAR_MMAP) || tar->z != NULL) { return 0; } // a compressed archive is read through its checkpoints
+    struct stat st;
+    if (fstat(tar->fd, &st) == -1) { return -1; }
+    if (st.st_size == 0) { return 0; } // nothing to map, the scan ends at once
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, tar->fd, 0);
+    if (map == MAP_FAILED) { return -1; }
+    tar->map = map;
+    tar->map_size = st.st_size;
+    if (flags & TAR_SEQUENTIAL) { madvise(map, st.st_size, MADV_SEQUENTIAL); }
+    if (flags & TAR_RANDOM) { madvise(map, st.st_size, MADV_RANDOM); }
+    return 0;
+}
+
+/**
+ * Opens an archive handle, reading every header of the archive once.
+ * The handle only reads with pread() and never moves the offset of tar_fd,
+ * so it can be shared by several threads once opened.
+ * Every symlink and hard link is resolved to its final entry while opening,
+ * a broken, cyclic or longer than 16 hops chain of links reads as a missing entry.
+ * The path of a member is its name, after its ustar prefix and a '/' if it has one.
+ * A gzip archive (or zstd, built with ZSTD=1) is decompressed once while opening, recording checkpoints,
+ * then each read only decompresses from the checkpoint before it. TAR_MMAP has no effect on such an archive.
+ *
+ * With TAR_LAZY, nothing is read when opening: a lookup first tries the headers already indexed, then goes on
+ * scanning from where the previous one stopped, indexing every header it passes, until it finds its path.
+ * All the lookups together never read the headers more than once. tar_list(), tar_list_page(), the queries and
+ * tar_index_write() index every header left first. A lazy handle answers from the first member of a path until
+ * the scan reaches a later one of the same name, and must not be used by several threads at the same time.
+ * Once the scan fails to read a header or to index it, every lookup fails instead of reporting a missing entry:
+ * tar_exists(), tar_is_*(), the listings and the queries return -4, the reads -3, tar_index_write() -1, and
+ * tar_writer_open() NULL.
+ * TAR_LAZY has no effect on a compressed archive.
+ *
+ * An archive written by tar_relayout() ends with its index: it is mapped instead, and no header is read.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ *               It must stay open until tar_close() is called.
+ * @param flags Zero or more of TAR_MMAP, TAR_SEQUENTIAL, TAR_RANDOM and TAR_LAZY.
+ *
+ * @return a handle on the archive, NULL on error.
+ */
+tar_t *tar_open(int tar_fd, int flags) {
+    STAT_CALL(TAR_OP_OPEN);
+    tar_t *tar = handle_new(tar_fd);
+    if (tar == NULL) { return NULL; }
+    int err;
+    tar->z = zsrc_open(tar_fd, &err);
+    if (!err && tar->z == NULL && index_embedded(tar) == 0) { // written by tar_relayout(), nothing to scan
+        if (archive_map(tar, flags)) { tar_close(tar); return NULL; }
+        return tar;
+    }
+    if (err || tar->index_map != NULL || index_init(tar) || archive_map(tar, flags)) {
+        tar_close(tar);
+        return NULL;
+    }
+
+    if ((flags & TAR_LAZY) && tar->z == NULL) {
+        // nothing is read yet, each lookup goes on from where the previous one stopped
+        tar->lazy = malloc(sizeof(tar_scan_t));
+        if (tar->lazy == NULL || scan_init(tar->lazy, tar_fd, tar->map, tar->map_size, NULL, 0)) {
+            free(tar->lazy);
+            tar->lazy = NULL;
+            tar_close(tar);
+            return NULL;
+        }
+        return tar;
+    }
+
+    tar_scan_t scan;
+    const char *header;
+    uint64_t pos;
+    if (scan_init(&scan, tar_fd, tar->map, tar->map_size, tar->z, 0)) { tar_close(tar); return NULL; }
+    while ((header = scan_next(&scan, &pos)) != NULL) {
+        if (index_add(tar, header, pos)) { scan_free(&scan); tar_close(tar); return NULL; }
+    }
+    scan_free(&scan);
+    if (scan.err) { tar_close(tar); return NULL; }
+    if (tar->z != NULL) { tar->z->frozen = 1; } // every checkpoint is known, the threads can share them
+    index_done(tar);
+    return tar;
+}
+
+/**
+ * Releases an archive handle. The file descriptor is not closed.
+ *
+ * @param tar A handle returned by tar_open(), may be NULL.
+ */
+void tar_close(tar_t *tar) {
+    if (tar == NULL) { return; }
+    if (tar->index_map != NULL) {
+        munmap(tar->index_map, tar->index_map_size);
+    } else {
+        free(tar->entries);
+        free(tar->strings);
+        free(tar->buckets);
+    }
+    free(tar->components);
+    if (tar->map != NULL) { munmap((void *) tar->map, tar->map_size); }
+    zsrc_free(tar->z);
+    if (tar->lazy != NULL) {
+        scan_free(tar->lazy);
+        free(tar->lazy);
+    }
+    for (uint32_t i = 0; i < tar->no_layers; i++) { tar_close(tar->layers[i]); }
+    free(tar->layers);
+    free(tar->sorted);
+    pthread_mutex_destroy(&tar->sort_lock);
+    free(tar);
+}
+
+// pread() on the archive of the handle, decompressing it if needed
+static ssize_t archive_pread(tar_t *tar, void *buf, size_t len, uint64_t offset) {
+    if (tar->z != NULL) { return zsrc_pread(tar->z, buf, len, offset); }
+    return pread_full(tar->fd, buf, len, offset);
+}
+
+/**
+ * Same as check_archive(), on the headers of the handle.
+ * With TAR_MMAP, the headers are checked in place in the mapping.
+ */
+int tar_check(tar_t *tar) {
+    STAT_CALL(TAR_OP_CHECK);
+    if (tar->layers != NULL) { // an overlay checks each of its archives
+        int nb_headers = 0;
+        for (uint32_t i = 0; i < tar->no_layers; i++) {
+            int res = tar_check(tar->layers[i]);
+            if (res < 0) { return res; }
+            nb_headers += res;
+        }
+        return nb_headers;
+    }
+    tar_scan_t scan;
+    char buffers[TAR_CHECK_BATCH][512];
+    const char *headers[TAR_CHECK_BATCH];
+    size_t no_headers;
+    size_t bad;
+    int nb_headers = 0;
+    if (scan_init(&scan, tar->fd, tar->map, tar->map_size, tar->z, 0)) { return -4; }
+    do {
+        // gather a batch of headers, then check them all at once
+        no_headers = scan_batch(&scan, buffers, headers, NULL);
+        int res = tar_check_headers(headers, no_headers, &bad);
+        if (res) { scan_free(&scan); return res; }
+        nb_headers += no_headers;
+    } while (no_headers == TAR_CHECK_BATCH);
+    scan_free(&scan);
+    if (scan.err) { return -4; } // error on reading
+    return nb_headers;
+}
+
+/**
+ * Same as exists(), answered from the index of the handle.
+ */
+int tar_exists(tar_t *tar, char *path) {
+    STAT_CALL(TAR_OP_TAR_EXISTS);
+    tar_entry_t *entry = index_member(tar, path);
+    if (tar->lazy_err) { return tar->lazy_err; }
+    return entry != NULL;
+}
+
+/**
+ * Same as is_dir(), answered from the index of the handle.
+ */
+int tar_is_dir(tar_t *tar, char *path) {
+    STAT_CALL(TAR_OP_TAR_IS_DIR);
+    tar_entry_t *entry = index_member(tar, path);
+    if (tar->lazy_err) { return tar->lazy_err; }
+    return entry != NULL && entry->typeflag == DIRTYPE;
+}
+
+/**
+ * Same as is_file(), answered from the index of the handle.
+ */
+int tar_is_file(tar_t *tar, char *path) {
+    STAT_CALL(TAR_OP_TAR_IS_FILE);
+    tar_entry_t *entry = index_member(tar, path);
+    if (entry != NULL && entry->typeflag == LNKTYPE) { entry = index_follow(tar, entry); } // a hard link is its file
+    if (tar->lazy_err) { return tar->lazy_err; }
+    return entry != NULL && (entry->typeflag == REGTYPE || entry->typeflag == AREGTYPE);
+}
+
+/**
+ * Same as is_symlink(), answered from the index of the handle.
+ */
+int tar_is_symlink(tar_t *tar, char *path) {
+    STAT_CALL(TAR_OP_TAR_IS_SYMLINK);
+    tar_entry_t *entry = index_member(tar, path);
+    if (tar->lazy_err) { return tar->lazy_err; }
+    return entry != NULL && entry->typeflag == SYMTYPE;
+}
+
+// the id of the directory listed by tar_list(), symlinks resolved, TAR_NOENT if it is not a directory
+static uint32_t list_dir(tar_t *tar, char *path) {
+    char dir[TAR_PATH_MAX + 2];
+    size_t size = strnlen(path, TAR_PATH_MAX);
+    memcpy(dir, path, size);
+    dir[size] = '\0';
+    if (size > 0 && dir[size - 1] == '/') { dir[--size] = '\0'; }
+    if (size == 0) { return TAR_ROOT; }
+
+    tar_entry_t *entry = index_find(tar, dir);
+    if (entry == NULL) {
+        dir[size] = '/'; dir[size + 1] = '\0';
+        entry = index_find(tar, dir);
+    }
+    entry = index_follow(tar, entry);
+    if (entry == NULL || entry->typeflag != DIRTYPE) { return TAR_NOENT; }
+    return entry - tar->entries;
+}
+
+// the first entry listed from cursor in the directory at path, TAR_NOENT if none is left; zero if the directory does
+// not exist or the cursor is not one of its entries, -4 if a lazy handle could not index the archive
+static int list_start(tar_t *tar, char *path, tar_cursor_t *cursor, uint32_t *child) {
+    // the children of a directory may be anywhere in the archive
+    if (index_scan_all(tar)) { return tar->lazy_err; }
+    uint32_t dir = list_dir(tar, path);
+    if (dir == TAR_NOENT) { return 0; }
+    if (*cursor == TAR_CURSOR_END) { *child = TAR_NOENT; return 1; }
+
+    *child = *cursor == TAR_CURSOR_START ? tar->entries[dir].first_child : *cursor;
+    return *child == TAR_NOENT || (*child < tar->no_entries && tar->entries[*child].parent == dir);
+}
+
+/**
+ * Same as list(), answered from the directory tree of the handle.
+ */
+int tar_list(tar_t *tar, char *path, char **entries, size_t *no_entries) {
+    STAT_CALL(TAR_OP_TAR_LIST);
+    tar_cursor_t cursor = TAR_CURSOR_START;
+    return tar_list_page(tar, path, &cursor, entries, no_entries);
+}
+
+/**
+ * Lists the entries at a given path in the archive, one page at a time.
+ * Each call costs O(no_entries), whatever the size of the directory.
+ *
+ * @param tar A handle on the archive.
+ * @param path A path to a directory in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ *             Directories only known from the paths of their entries can be listed too.
+ * @param cursor An in-out argument.
+ *               The caller set it to TAR_CURSOR_START for the first page, then passes it back unchanged.
+ *               The callee set it to TAR_CURSOR_END once the last entry has been listed.
+ * @param entries An array of char arrays of TAR_PATH_MAX bytes each, they receive the whole paths of the entries.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive or the cursor is not one of this directory,
+ *         -4 if a lazy handle could not index the archive,
+ *         any other value otherwise.
+ */
+int tar_list_page(tar_t *tar, char *path, tar_cursor_t *cursor, char **entries, size_t *no_entries) {
+    STAT_CALL(TAR_OP_LIST_PAGE);
+    uint32_t child;
+    int res = list_start(tar, path, cursor, &child);
+    if (res <= 0) { *no_entries = 0; return res; }
+
+    size_t found = 0;
+    for (; child != TAR_NOENT && found < *no_entries; child = tar->entries[child].next_sibling) {
+        entry_path(tar, child, entries[found]);
+        found++;
+    }
+    *cursor = child == TAR_NOENT ? TAR_CURSOR_END : child;
+    *no_entries = found;
+    return 1;
+}
+
+/**
+ * Lists the entries at a given path in the archive, one page at a time, into an arena of the caller.
+ * The paths are written one after the other in the arena, whole and each followed by a '\0', and nothing is
+ * allocated: listing a directory again in the same arena costs no malloc() at all.
+ * The cursor is the one of tar_list_page(), both functions can page through the same directory.
+ *
+ * @param tar A handle on the archive.
+ * @param path A path to a directory in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param cursor An in-out argument, as for tar_list_page().
+ *               The callee leaves it on the first entry that did not fit in names or in the arena.
+ * @param names Receives the offset and the length of the path of each entry listed, in the arena.
+ * @param no_names An in-out argument.
+ *                 The caller set it to the number of entries in `names`.
+ *                 The callee set it to the number of entries listed.
+ * @param arena A buffer receiving the paths of the entries listed.
+ * @param arena_size An in-out argument.
+ *                   The caller set it to the size of `arena`.
+ *                   The callee set it to the number of bytes written to `arena`, or to the number of bytes the next
+ *                   path needs if not even one path fits.
+ *
+ * @return zero if no directory at the given path exists in the archive or the cursor is not one of this directory,
+ *         -1 if the arena is too small for the next path: nothing is listed and the cursor is left unchanged,
+ *         -4 if a lazy handle could not index the archive,
+ *         any other value otherwise.
+ */
+int tar_list_arena(tar_t *tar, char *path, tar_cursor_t *cursor, tar_name_t *names, size_t *no_names, char *arena,
+                   size_t *arena_size) {
+    STAT_CALL(TAR_OP_LIST_ARENA);
+    uint32_t child;
+    int res = list_start(tar, path, cursor, &child);
+    if (res <= 0) { *no_names = 0; *arena_size = 0; return res; }
+
+    // every path is the one of the directory, built once, then the component of the entry
+    char dir[TAR_PATH_MAX];
+    size_t dir_len = child == TAR_NOENT ? 0 : entry_path(tar, tar->entries[child].parent, dir);
+    size_t found = 0;
+    size_t used = 0;
+    for (; child != TAR_NOENT && found < *no_names; child = tar->entries[child].next_sibling) {
+        const char *component = &tar->strings[tar->entries[child].name];
+        size_t component_len = strlen(component);
+        size_t len = dir_len + component_len;
+        if (used + len + 1 > *arena_size) {
+            if (found == 0) { *no_names = 0; *arena_size = len + 1; return -1; }
+            break;
+        }
+        memcpy(&arena[used], dir, dir_len);
+        memcpy(&arena[used + dir_len], component, component_len + 1);
+        names[found].offset = used;
+        names[found].len = len;
+        used += len + 1;
+        found++;
+    }
+    *cursor = child == TAR_NOENT ? TAR_CURSOR_END : child;
+    *no_names = found;
+    *arena_size = used;
+    return 1;
+}
+
+/**
+ * Same as read_file(), answered from the index of the handle.
+ * Returns -3 if the archive could not be read.
+ */
+ssize_t tar_read_file(tar_t *tar, char *path, size_t offset, uint8_t *dest, size_t *len) {
+    STAT_CALL(TAR_OP_TAR_READ_FILE);
+    tar_entry_t *entry = index_follow(tar, index_find(tar, path));
+    if (tar->lazy_err) { *len = 0; return -3; }
+    if (entry == NULL || (entry->typeflag != REGTYPE && entry->typeflag != AREGTYPE)) { *len = 0; return -1; }
+    if (offset >= entry->size) { *len = 0; return -2; }
+
+    size_t to_read = entry->size - offset < *len ? entry->size - offset : *len;
+    tar_t *src = handle_layer(tar, entry->layer);
+    ssize_t err;
+    if (src->map != NULL) {
+        uint64_t start = DATA_OFFSET(entry) + offset;
+        size_t avail = start < src->map_size ? src->map_size - start : 0; // a truncated archive gives a partial read
+        err = avail < to_read ? avail : to_read;
+        memcpy(dest, &src->map[start], err);
+    } else {
+        err = archive_pread(src, dest, to_read, DATA_OFFSET(entry) + offset);
+    }
+    if (err == -1) { *len = 0; return -3; } // error on reading
+
+    *len = err;
+    return entry->size - offset - err;
+}
+
+/**
+ * Gives a view on the content of a file of an archive opened with TAR_MMAP, without copying it.
+ *
+ * @param tar A handle opened with TAR_MMAP.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param data Set to the first byte of the file in the mapping. It stays valid until tar_close().
+ * @param size Set to the size of the file.
+ *
+ * @return zero on success,
+ *         -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -3 if the archive is not mapped, the file goes past the end of the archive or a lazy handle could not
+ *            index it.
+ */
+int tar_file_view(tar_t *tar, char *path, const uint8_t **data, size_t *size) {
+    STAT_CALL(TAR_OP_FILE_VIEW);
+    tar_entry_t *entry = index_follow(tar, index_find(tar, path));
+    if (tar->lazy_err) { return -3; }
+    if (entry == NULL || (entry->typeflag != REGTYPE && entry->typeflag != AREGTYPE)) { return -1; }
+    tar_t *src = handle_layer(tar, entry->layer);
+    if (src->map == NULL || DATA_OFFSET(entry) + entry->size > src->map_size) { return -3; }
+    *data = &src->map[DATA_OFFSET(entry)];
+    *size = entry->size;
+    return 0;
+}
+
+#define TAR_SEND_CHUNK (256 * 1024)     // read and written at once when the content has to go through a buffer
+
+// wait until fd takes more bytes, for a non-blocking socket or pipe
+static int send_wait(int fd) {
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    return poll(&pfd, 1, -1) == -1 && errno != EINTR ? -1 : 0;
+}
+
+// bytes [offset, offset + len) of the archive to out_fd in the kernel, with sendfile() or else splice() through a pipe;
+// returns the bytes sent before the first failure, *err set to its errno
+static uint64_t send_kernel(int fd, int out_fd, uint64_t offset, uint64_t len, int *err) {
+    uint64_t done = 0;
+    *err = 0;
+    while (done < len) {
+        off_t in = offset + done;
+        ssize_t res = sendfile(out_fd, fd, &in, len - done);
+        if (res == -1 && errno == EAGAIN && send_wait(out_fd) == 0) { continue; }
+        if (res == -1 && errno == EINTR) { continue; }
+        if (res <= 0) { *err = res == 0 ? EIO : errno; break; }
+        STAT_ADD(read_calls, 1);
+        STAT_ADD(bytes_read, res);
+        done += res;
+    }
+    if (*err != EINVAL && *err != ENOSYS) { return done; }
+
+    // out_fd refuses sendfile(): splice() to a pipe, then from the pipe to out_fd
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) { *err = errno; return done; }
+    *err = 0;
+    while (done < len && *err == 0) {
+        loff_t in = offset + done;
+        ssize_t res = splice(fd, &in, pipe_fds[1], NULL, len - done, SPLICE_F_MOVE);
+        if (res == -1 && errno == EINTR) { continue; }
+        if (res <= 0) { *err = res == 0 ? EIO : errno; break; }
+        STAT_ADD(read_calls, 1);
+        STAT_ADD(bytes_read, res);
+        for (ssize_t moved = 0; moved < res; ) {
+            ssize_t out = splice(pipe_fds[0], NULL, out_fd, NULL, res - moved, SPLICE_F_MOVE);
+            if (out == -1 && errno == EAGAIN && send_wait(out_fd) == 0) { continue; }
+            if (out == -1 && errno == EINTR) { continue; }
+            if (out <= 0) { *err = out == 0 ? EIO : errno; break; }
+            moved += out;
+            done += out;
+        }
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return done;
+}
+
+// the same bytes through a buffer, for a compressed archive or an out_fd neither call supports
+static uint64_t send_buffered(tar_t *tar, int out_fd, uint64_t offset, uint64_t len, int *err) {
+    uint8_t *buffer = malloc(TAR_SEND_CHUNK);
+    uint64_t done = 0;
+    *err = buffer == NULL ? ENOMEM : 0;
+    while (*err == 0 && done < len) {
+        size_t chunk = len - done < TAR_SEND_CHUNK ? len - done : TAR_SEND_CHUNK;
+        ssize_t res = archive_pread(tar, buffer, chunk, offset + done);
+        if (res <= 0) { *err = EIO; break; } // error on reading or truncated archive
+        for (ssize_t written = 0; written < res; ) {
+            ssize_t out = write(out_fd, &buffer[written], res - written);
+            if (out == -1 && errno == EAGAIN && send_wait(out_fd) == 0) { continue; }
+            if (out == -1 && errno == EINTR) { continue; }
+            if (out <= 0) { *err = out == 0 ? EIO : errno; break; }
+            written += out;
+            done += out;
+        }
+    }
+    free(buffer);
+    return done;
+}
+
+// len bytes of the archive of the handle from offset to out_fd, in the kernel when the archive is not compressed;
+// err is set to zero or to the errno of the failed call
+static uint64_t send_range(tar_t *tar, int out_fd, uint64_t offset, uint64_t len, int *err) {
+    uint64_t done = 0;
+    *err = EINVAL;
+    if (tar->z == NULL) { done = send_kernel(tar->fd, out_fd, offset, len, err); }
+    if (*err == EINVAL || *err == ENOSYS) { done += send_buffered(tar, out_fd, offset + done, len - done, err); }
+    return done;
+}
+
+/**
+ * Sends a range of a file of the archive to a file descriptor, a socket or a pipe, without copying it in user space:
+ * with sendfile(), or splice() through a pipe when out_fd refuses sendfile(). The content of a compressed archive
+ * is decompressed through a buffer. A non-blocking out_fd is waited for with poll().
+ *
+ * @param tar A handle on the archive.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param out_fd The file descriptor the bytes are written to, at its current position.
+ * @param offset An offset in the file from which to start sending, zero to start from the beginning.
+ * @param len An input-output argument: the number of bytes to send, SIZE_MAX for every byte up to the end of the file,
+ *            set to the number of bytes actually sent.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         -3 if the archive could not be read or out_fd could not be written, *len bytes were sent before,
+ *         zero if the range was sent up to the end of the file,
+ *         the remaining bytes left to send in the file after the range otherwise.
+ */
+ssize_t tar_send_member(tar_t *tar, char *path, int out_fd, size_t offset, size_t *len) {
+    STAT_CALL(TAR_OP_SEND_MEMBER);
+    tar_entry_t *entry = index_follow(tar, index_find(tar, path));
+    if (tar->lazy_err) { *len = 0; return -3; }
+    if (entry == NULL || (entry->typeflag != REGTYPE && entry->typeflag != AREGTYPE)) { *len = 0; return -1; }
+    if (offset >= entry->size && !(offset == 0 && entry->size == 0)) { *len = 0; return -2; }
+
+    uint64_t to_send = entry->size - offset < *len ? entry->size - offset : *len;
+    int err;
+    uint64_t done = send_range(handle_layer(tar, entry->layer), out_fd, DATA_OFFSET(entry) + offset, to_send, &err);
+    *len = done;
+    if (err) { return -3; }
+    return entry->size - offset - done;
+}
+
+
+/* ========== SIDECAR INDEX ========== */
+
+// the layout of the file is in lib_tar_index.h
+
+typedef struct sort_item {
+    const char *name;
+    uint32_t id;
+} sort_item_t;
+
+static int sort_item_cmp(const void *a, const void *b) {
+    return strcmp(((const sort_item_t *) a)->name, ((const sort_item_t *) b)->name);
+}
+
+// the path of every entry, items[id] = {path, id}: the block holding the paths, to free, NULL if out of memory
+static char *index_path_items(tar_t *tar, sort_item_t *items) {
+    size_t paths_len = 0;
+    for (uint32_t id = 0; id < tar->no_entries; id++) { paths_len += entry_path_len(tar, id) + 1; }
+    char *paths = malloc(paths_len);
+    if (paths == NULL) { return NULL; }
+    char *path = paths;
+    for (uint32_t id = 0; id < tar->no_entries; id++) {
+        items[id].name = path;
+        items[id].id = id;
+        path += entry_path(tar, id, path) + 1;
+    }
+    return paths;
+}
+
+typedef struct child_item {
+    uint32_t parent;
+    uint32_t id;
+    const char *name;   // the last component of the path
+} child_item_t;
+
+static int child_item_cmp(const void *a, const void *b) {
+    const child_item_t *x = a;
+    const child_item_t *y = b;
+    if (x->parent != y->parent) { return x->parent < y->parent ? -1 : 1; }
+    return strcmp(x->name, y->name);
+}
+
+// whether the components of the entries are single names, the last one of a directory ending with '/'
+static int index_plain_components(tar_t *tar, child_item_t *items, uint32_t no_items) {
+    for (uint32_t i = 0; i < no_items; i++) {
+        const char *slash = strchr(items[i].name, '/');
+        if (slash != NULL && slash[1] != '\0') { return 0; } // "a//b", "/abs", or under a directory named "dir"
+        const char *parent = &tar->strings[tar->entries[items[i].parent].name];
+        if (items[i].parent != TAR_ROOT && parent[strlen(parent) - 1] != '/') { return 0; }
+    }
+    return 1;
+}
+
+/*
+ * The ids of the entries in the order of their paths, in sorted, -1 if out of memory.
+ * The entries of each directory are sorted by their last component, then the tree is walked depth first, each
+ * directory before its entries: with plain components, it is the order of the paths, without building any of them.
+ * Otherwise, a directory "dir" may have siblings between "dir" and its entries "dir/...", the paths are sorted.
+ */
+static int index_sort_ids(tar_t *tar, uint32_t *sorted) {
+    uint32_t no_items = 0;
+    child_item_t *items = malloc(sizeof(child_item_t) * (tar->no_entries + 1));
+    uint32_t *first = malloc(sizeof(uint32_t) * (tar->no_entries + 1)); // the first entry of each directory in items
+    uint32_t stack[TAR_PATH_MAX];
+    int depth = 0;
+    int res = -1;
+    if (items == NULL || first == NULL) { goto out; }
+    for (uint32_t id = 0; id < tar->no_entries; id++) {
+        first[id] = TAR_NOENT;
+        if (tar->entries[id].parent == TAR_NOENT) { continue; }
+        items[no_items].parent = tar->entries[id].parent;
+        items[no_items].id = id;
+        items[no_items++].name = &tar->strings[tar->entries[id].name];
+    }
+    if (tar->no_entries > 0 && no_items == tar->no_entries - 1 && index_plain_components(tar, items, no_items)) {
+        qsort(items, no_items, sizeof(child_item_t), child_item_cmp);
+        for (uint32_t i = no_items; i-- > 0; ) { first[items[i].parent] = i; }
+        uint32_t no_sorted = 0;
+        sorted[no_sorted++] = TAR_ROOT;
+        for (uint32_t next = first[TAR_ROOT]; next != TAR_NOENT || depth > 0; ) {
+            if (next == TAR_NOENT) { next = stack[--depth]; continue; }
+            uint32_t id = items[next].id;
+            sorted[no_sorted++] = id;
+            uint32_t sibling = next + 1 < no_items && items[next + 1].parent == items[next].parent ? next + 1 : TAR_NOENT;
+            if (first[id] == TAR_NOENT) { next = sibling; continue; }
+            if (depth == TAR_PATH_MAX) { goto out; } // deeper than any path
+            stack[depth++] = sibling;
+            next = first[id];
+        }
+        res = 0;
+        goto out;
+    }
+
+    // the paths themselves
+    sort_item_t *paths = malloc(sizeof(sort_item_t) * (tar->no_entries + 1));
+    char *block = paths != NULL ? index_path_items(tar, paths) : NULL;
+    if (block != NULL) {
+        qsort(paths, tar->no_entries, sizeof(sort_item_t), sort_item_cmp);
+        for (uint32_t i = 0; i < tar->no_entries; i++) { sorted[i] = paths[i].id; }
+        res = 0;
+    }
+    free(block);
+    free(paths);
+
+out:
+    free(items);
+    free(first);
+    return res;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t err = write(fd, (const uint8_t *) buf + done, len - done);
+        if (err == -1) { return -1; }
+        done += err;
+    }
+    return 0;
+}
+
+// the bytes of the checkpoints and windows of an archive of the index
+static size_t index_z_len(const tar_index_layer_t *layer) {
+    size_t windows_len = layer->z_format == TAR_Z_GZIP ? (size_t) layer->no_checkpoints * TAR_Z_WINDOW : 0;
+    return (size_t) layer->no_checkpoints * sizeof(tar_checkpoint_t) + windows_len;
+}
+
+// whether an id of the mapped index names one of its entries, or none
+static int index_check_id(tar_t *tar, uint32_t id) {
+    return id < tar->no_entries || id == TAR_NOENT;
+}
+
+/*
+ * Whether the index mapped in the handle is consistent, 0 if so: a corrupted index must not make a lookup read out
+ * of the mapping or loop. Every offset is in the string pool, every id names an entry, the paths fit TAR_PATH_MAX,
+ * and the chains are finite: a parent and the next entry of a bucket come before the entry, as indexing and sorting
+ * leave them, and the children of a directory are walked once to see that each is reached once, from its parent.
+ */
+static int index_check(tar_t *tar, uint32_t no_layers) {
+    uint16_t *path_lens = malloc(sizeof(uint16_t) * (tar->no_entries + 1));
+    uint8_t *seen = calloc(tar->no_entries + 1, 1);
+    int err = path_lens == NULL || seen == NULL || tar->no_entries == 0;
+    for (uint32_t b = 0; b < tar->no_buckets && !err; b++) { err = !index_check_id(tar, tar->buckets[b]); }
+    for (uint32_t id = 0; id < tar->no_entries && !err; id++) {
+        tar_entry_t *entry = &tar->entries[id];
+        err = entry->name >= tar->strings_len || entry->linkname >= tar->strings_len || entry->layer >= no_layers
+              || (entry->parent != TAR_NOENT && entry->parent >= id) || (entry->next != TAR_NOENT && entry->next >= id)
+              || !index_check_id(tar, entry->first_child) || !index_check_id(tar, entry->last_child)
+              || !index_check_id(tar, entry->next_sibling) || !index_check_id(tar, entry->target)
+              || entry->size > TAR_SIZE_MAX
+              || (entry->header_offset > TAR_SIZE_MAX && entry->header_offset != TAR_IMPLICIT);
+        if (err) { break; }
+        size_t len = strlen(&tar->strings[entry->name]) + (entry->parent != TAR_NOENT ? path_lens[entry->parent] : 0);
+        err = len >= TAR_PATH_MAX;
+        path_lens[id] = len;
+    }
+    for (uint32_t dir = 0; dir < tar->no_entries && !err; dir++) {
+        uint32_t last = TAR_NOENT;
+        uint32_t child = tar->entries[dir].first_child;
+        for (; child != TAR_NOENT && !err; child = tar->entries[child].next_sibling) {
+            err = seen[child] || tar->entries[child].parent != dir;
+            seen[child] = 1;
+            last = child;
+        }
+        err = err || tar->entries[dir].last_child != last;
+    }
+    free(path_lens);
+    free(seen);
+    return err ? -1 : 0;
+}
+
+// apply the delta at pos in the index mapped in the handle, updating the record of its archive; its length, 0 if invalid
+static size_t index_apply_delta(tar_t *tar, const uint8_t *index, size_t pos, size_t index_len, tar_index_layer_t *layer) {
+    tar_index_delta_t delta;
+    index_file_t *file = &tar->index_file;
+    if (index_len - pos < sizeof(delta)) { return 0; }
+    memcpy(&delta, &index[pos], sizeof(delta));
+    size_t tables_len = sizeof(uint32_t) * ((size_t) delta.no_changed + 2 * (size_t) delta.no_buckets)
+                        + sizeof(tar_entry_t) * (size_t) delta.no_changed;
+    if (memcmp(delta.magic, TAR_DELTA_MAGIC, 8) || delta.len > index_len - pos
+        || delta.no_entries < tar->no_entries || delta.no_entries > file->max_entries
+        || delta.strings_len < tar->strings_len || delta.strings_len > file->strings_max
+        || delta.no_changed > delta.no_entries || delta.no_buckets > tar->no_buckets
+        || delta.len != sizeof(delta) + tables_len + (delta.strings_len - tar->strings_len)) {
+        return 0;
+    }
+    const uint8_t *ids = &index[pos + sizeof(delta)];
+    const uint8_t *buckets = &ids[sizeof(uint32_t) * delta.no_changed];
+    const uint8_t *entries = &buckets[sizeof(uint32_t) * 2 * delta.no_buckets];
+    for (uint32_t i = 0; i < delta.no_changed; i++) {
+        uint32_t id;
+        memcpy(&id, &ids[sizeof(uint32_t) * i], sizeof(id));
+        if (id >= delta.no_entries) { return 0; }
+        memcpy(&tar->entries[id], &entries[sizeof(tar_entry_t) * i], sizeof(tar_entry_t));
+    }
+    for (uint32_t i = 0; i < delta.no_buckets; i++) {
+        uint32_t pair[2];
+        memcpy(pair, &buckets[sizeof(pair) * i], sizeof(pair));
+        if (pair[0] >= tar->no_buckets) { return 0; }
+        tar->buckets[pair[0]] = pair[1];
+    }
+    memcpy(&tar->strings[tar->strings_len], &entries[sizeof(tar_entry_t) * delta.no_changed],
+           delta.strings_len - tar->strings_len);
+    tar->no_entries = tar->max_entries = delta.no_entries;
+    tar->strings_len = delta.strings_len;
+    layer->archive_size = delta.archive_size;
+    layer->archive_mtime_sec = delta.archive_mtime_sec;
+    layer->archive_mtime_nsec = delta.archive_mtime_nsec;
+    return delta.len;
+}
+
+// the handle forgets the index mapped in it
+static void index_detach(tar_t *tar) {
+    munmap(tar->index_map, tar->index_map_size);
+    tar->index_map = NULL;
+    tar->entries = NULL;
+    tar->buckets = NULL;
+    tar->strings = NULL;
+    tar->no_entries = tar->max_entries = tar->no_buckets = tar->no_sorted = 0;
+    tar->strings_len = tar->strings_max = 0;
+    memset(&tar->index_file, 0, sizeof(index_file_t));
+}
+
+/*
+ * Map in the handle the index of len bytes at map_offset in fd, starting skip bytes in, -1 if it is invalid or stale.
+ * A sidecar index is checked against the size and mtime of each archive, as recorded by its last delta if it has any.
+ * An index embedded in its archive, at embedded (UINT64_MAX for a sidecar), only describes the archive up to itself.
+ * The mapping is private: the deltas are applied to it, then it is made read-only.
+ */
+static int index_attach(tar_t *tar, int fd, uint64_t map_offset, size_t skip, size_t len, uint64_t embedded) {
+    uint32_t no_layers = handle_no_layers(tar);
+    struct stat idx_st;
+    if (len < skip + sizeof(tar_index_header_t) || fstat(fd, &idx_st) == -1) { return -1; }
+    uint8_t *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t) map_offset);
+    if (map == MAP_FAILED) { return -1; }
+
+    uint8_t *index = &map[skip];
+    size_t index_len = len - skip;
+    tar_index_header_t *header = (tar_index_header_t *) index;
+    tar_index_layer_t *layers = (tar_index_layer_t *) &index[sizeof(tar_index_header_t)];
+    size_t layers_len = (size_t) no_layers * sizeof(tar_index_layer_t);
+    if (memcmp(header->magic, TAR_INDEX_MAGIC, 8) || header->version != TAR_INDEX_VERSION
+        || header->byte_order != TAR_INDEX_BYTE_ORDER
+        || header->entry_size != sizeof(tar_entry_t) || header->no_layers != no_layers
+        || header->max_entries < header->no_entries || header->strings_max < header->strings_len
+        || sizeof(tar_index_header_t) + layers_len > index_len) {
+        munmap(map, len);
+        return -1;
+    }
+    size_t entries_len = (size_t) header->max_entries * sizeof(tar_entry_t);
+    size_t buckets_len = (size_t) header->no_buckets * sizeof(uint32_t);
+    size_t z_len = 0;
+    for (uint32_t i = 0; i < no_layers; i++) { z_len += index_z_len(&layers[i]); }
+    size_t tables_len = layers_len + entries_len + buckets_len + z_len;
+    size_t base_len = sizeof(tar_index_header_t) + tables_len + header->strings_max;
+    if (header->no_buckets == 0 || (header->no_buckets & (header->no_buckets - 1)) || header->strings_len == 0
+        || base_len > index_len || (base_len != index_len && (embedded != UINT64_MAX || no_layers != 1))) {
+        munmap(map, len);
+        return -1;
+    }
+
+    tar->index_map = map;
+    tar->index_map_size = len;
+    tar->entries = (tar_entry_t *) &index[sizeof(tar_index_header_t) + layers_len];
+    tar->no_entries = tar->max_entries = tar->no_sorted = header->no_entries;
+    tar->buckets = (uint32_t *) &index[sizeof(tar_index_header_t) + layers_len + entries_len];
+    tar->no_buckets = header->no_buckets;
+    tar->strings = (char *) &index[sizeof(tar_index_header_t) + tables_len];
+    tar->strings_len = tar->strings_max = header->strings_len;
+    tar->index_file = (index_file_t) {idx_st.st_dev, idx_st.st_ino, index_len, base_len, header->max_entries,
+                                      header->no_buckets, header->strings_max, 0, 0};
+
+    // the deltas, then the archives as they are now
+    tar_index_layer_t last = layers[0];
+    int err = 0;
+    for (size_t pos = base_len, delta_len = 0; pos < index_len && !err; pos += delta_len) {
+        delta_len = index_apply_delta(tar, index, pos, index_len, &last);
+        err = delta_len == 0;
+    }
+    for (uint32_t i = 0; i < no_layers && !err; i++) {
+        struct stat st;
+        tar_t *layer = handle_layer(tar, i);
+        tar_index_layer_t *record = i == 0 ? &last : &layers[i];
+        int stale = embedded != UINT64_MAX ? record->archive_size != embedded
+                    : fstat(layer->fd, &st) == -1 || record->archive_size != (uint64_t) st.st_size
+                      || record->archive_mtime_sec != st.st_mtim.tv_sec || record->archive_mtime_nsec != st.st_mtim.tv_nsec;
+        err = stale || layers[i].z_format != (uint32_t) zsrc_format(layer->fd)
+              || (layers[i].z_format != TAR_Z_NONE) != (layers[i].no_checkpoints > 0);
+    }
+    tar->strings_max = tar->strings_len;
+    tar->index_file.no_entries = tar->no_entries;
+    tar->index_file.strings_len = tar->strings_len;
+    if (err || tar->strings[tar->strings_len - 1] != '\0' || index_check(tar, no_layers) || mprotect(map, len, PROT_READ)) {
+        index_detach(tar);
+        return -1;
+    }
+    if (embedded != UINT64_MAX) { memset(&tar->index_file, 0, sizeof(index_file_t)); }
+    uint8_t *z = &index[sizeof(tar_index_header_t) + layers_len + entries_len + buckets_len];
+    for (uint32_t i = 0; i < no_layers; i++) {
+        if (layers[i].z_format == TAR_Z_NONE) { continue; }
+        tar_t *layer = handle_layer(tar, i);
+        layer->z = zsrc_new(layer->fd, layers[i].z_format);
+        if (layer->z == NULL) { return -1; } // the handle is closed by the caller, with the mapping
+        layer->z->checkpoints = (tar_checkpoint_t *) z;
+        layer->z->no_checkpoints = layer->z->max_checkpoints = layers[i].no_checkpoints;
+        layer->z->windows = &z[(size_t) layers[i].no_checkpoints * sizeof(tar_checkpoint_t)];
+        layer->z->frozen = layer->z->mapped = 1;
+        z += index_z_len(&layers[i]);
+    }
+    return 0;
+}
+
+// map the index at idx_path in the handle, -1 if it does not exist, is invalid or is stale
+static int index_load(tar_t *tar, const char *idx_path) {
+    struct stat idx_st;
+    int fd = open(idx_path, O_RDONLY);
+    if (fd == -1) { return -1; }
+    int err = fstat(fd, &idx_st) == -1 || index_attach(tar, fd, 0, 0, idx_st.st_size, UINT64_MAX);
+    close(fd);
+    return err ? -1 : 0;
+}
+
+// map the index at the end of an archive written by tar_relayout(), -1 if it has none
+static int index_embedded(tar_t *tar) {
+    struct stat st;
+    uint8_t tail[3 * 512];  // the last block of the content of the index member, then the end of the archive
+    char header[512];
+    tar_index_footer_t footer;
+    if (fstat(tar->fd, &st) == -1 || st.st_size < (off_t) (sizeof(tail) + 512) || st.st_size % 512
+        || pread_full(tar->fd, tail, sizeof(tail), st.st_size - sizeof(tail)) != sizeof(tail)) {
+        return -1;
+    }
+    memcpy(&footer, &tail[511 - sizeof(footer)], sizeof(footer));
+    for (size_t i = 512; i < sizeof(tail); i++) {
+        if (tail[i] != 0) { return -1; }
+    }
+    uint64_t data_offset = footer.header_offset + 512;
+    if (tail[511] != '\n' || memcmp(footer.magic, TAR_EMBED_MAGIC, 8) || data_offset % sysconf(_SC_PAGESIZE)
+        || footer.header_offset > (uint64_t) st.st_size
+        || pread_full(tar->fd, header, 512, footer.header_offset) != 512 || check_header(header)
+        || header[156] != XGLTYPE || data_offset + header_size(header) != st.st_size - 1024
+        || footer.index_len > (uint64_t) st.st_size
+        || TAR_EMBED_SKIP + footer.index_len + sizeof(footer) + 1 > header_size(header)) {
+        return -1;
+    }
+    return index_attach(tar, tar->fd, data_offset, TAR_EMBED_SKIP, TAR_EMBED_SKIP + footer.index_len, footer.header_offset);
+}
+
+// the buckets of an index written for up to max_entries entries
+static uint32_t index_buckets_for(uint32_t max_entries) {
+    uint32_t no_buckets = 64;
+    while (no_buckets < max_entries) { no_buckets *= 2; }
+    return no_buckets;
+}
+
+// the buckets of the index written for the handle
+static uint32_t index_dump_buckets(tar_t *tar) {
+    return index_buckets_for(tar->no_entries);
+}
+
+// the bytes index_dump() writes
+static size_t index_dump_size(tar_t *tar, const tar_index_layer_t *layers) {
+    uint32_t no_layers = handle_no_layers(tar);
+    size_t size = sizeof(tar_index_header_t) + sizeof(tar_index_layer_t) * no_layers
+                  + sizeof(tar_entry_t) * tar->no_entries + sizeof(uint32_t) * index_dump_buckets(tar) + tar->strings_len;
+    for (uint32_t i = 0; i < no_layers; i++) { size += index_z_len(&layers[i]); }
+    return size;
+}
+
+// the records of the archives of the handle as they are now, for a sidecar index, -1 on error
+static int index_stat_layers(tar_t *tar, tar_index_layer_t *layers) {
+    for (uint32_t i = 0; i < handle_no_layers(tar); i++) {
+        struct stat st;
+        tar_t *layer = handle_layer(tar, i);
+        if (fstat(layer->fd, &st) == -1) { return -1; }
+        layers[i].archive_size = st.st_size;
+        layers[i].archive_mtime_sec = st.st_mtim.tv_sec;
+        layers[i].archive_mtime_nsec = st.st_mtim.tv_nsec;
+        if (layer->z != NULL) {
+            layers[i].z_format = layer->z->format;
+            layers[i].no_checkpoints = layer->z->no_checkpoints;
+        }
+    }
+    return 0;
+}
+
+// len zero bytes at the position of fd, -1 on error
+static int write_zeros(int fd, size_t len) {
+    static const uint8_t zeros[4096];
+    for (size_t done = 0; done < len; done += sizeof(zeros)) {
+        if (write_full(fd, zeros, len - done < sizeof(zeros) ? len - done : sizeof(zeros))) { return -1; }
+    }
+    return 0;
+}
+
+/*
+ * The entries of the handle in the order of sorted, renumbered, in *entries, and their buckets for no_buckets,
+ * in *buckets; new_ids receives the new id of each entry. -1 if out of memory.
+ */
+static int index_permute(tar_t *tar, const uint32_t *sorted, uint32_t *new_ids, uint32_t no_buckets,
+                         tar_entry_t **entries, uint32_t **buckets) {
+    *entries = malloc(sizeof(tar_entry_t) * (tar->no_entries + 1));
+    *buckets = malloc(sizeof(uint32_t) * no_buckets);
+    if (*entries == NULL || *buckets == NULL) {
+        free(*entries);
+        free(*buckets);
+        return -1;
+    }
+    // the root "" stays first, the buckets and the tree are renumbered
+    for (uint32_t i = 0; i < tar->no_entries; i++) { new_ids[sorted[i]] = i; }
+    for (uint32_t i = 0; i < no_buckets; i++) { (*buckets)[i] = TAR_NOENT; }
+    for (uint32_t i = 0; i < tar->no_entries; i++) {
+        tar_entry_t *entry = &(*entries)[i];
+        *entry = tar->entries[sorted[i]];
+        uint32_t *links[5] = {&entry->parent, &entry->first_child, &entry->last_child, &entry->next_sibling, &entry->target};
+        for (int l = 0; l < 5; l++) {
+            if (*links[l] != TAR_NOENT) { *links[l] = new_ids[*links[l]]; }
+        }
+        uint32_t b = entry->hash & (no_buckets - 1);
+        entry->next = (*buckets)[b];
+        (*buckets)[b] = i;
+    }
+    return 0;
+}
+
+// write at the position of fd an index of the entries and buckets given with the string pool of the handle,
+// its archives described by layers, keeping room for max_entries entries and strings_max bytes of strings; -1 on error
+static int index_dump_tables(tar_t *tar, int fd, const tar_index_layer_t *layers, const tar_entry_t *entries,
+                             const uint32_t *buckets, uint32_t no_buckets, uint32_t max_entries, size_t strings_max) {
+    uint32_t no_layers = handle_no_layers(tar);
+    tar_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TAR_INDEX_MAGIC, 8);
+    header.version = TAR_INDEX_VERSION;
+    header.entry_size = sizeof(tar_entry_t);
+    header.no_entries = tar->no_entries;
+    header.no_buckets = no_buckets;
+    header.strings_len = tar->strings_len;
+    header.no_layers = no_layers;
+    header.byte_order = TAR_INDEX_BYTE_ORDER;
+    header.max_entries = max_entries;
+    header.strings_max = strings_max;
+    int err = write_full(fd, &header, sizeof(header))
+              || write_full(fd, layers, sizeof(tar_index_layer_t) * no_layers)
+              || write_full(fd, entries, sizeof(tar_entry_t) * tar->no_entries)
+              || write_zeros(fd, sizeof(tar_entry_t) * (size_t) (max_entries - tar->no_entries))
+              || write_full(fd, buckets, sizeof(uint32_t) * no_buckets);
+    for (uint32_t i = 0; i < no_layers && !err; i++) {
+        tar_zsrc_t *z = handle_layer(tar, i)->z;
+        size_t windows_len = layers[i].z_format == TAR_Z_GZIP ? (size_t) layers[i].no_checkpoints * TAR_Z_WINDOW : 0;
+        err = z != NULL && (write_full(fd, z->checkpoints, sizeof(tar_checkpoint_t) * z->no_checkpoints)
+                            || (windows_len > 0 && write_full(fd, z->windows, windows_len)));
+    }
+    return err || write_full(fd, tar->strings, tar->strings_len) || write_zeros(fd, strings_max - tar->strings_len) ? -1 : 0;
+}
+
+// write the index of the handle at the position of fd, its archives described by layers, -1 on error
+static int index_dump(tar_t *tar, int fd, const tar_index_layer_t *layers) {
+    uint32_t no_buckets = index_dump_buckets(tar);
+    uint32_t *sorted = malloc(sizeof(uint32_t) * (tar->no_entries + 1));
+    uint32_t *new_ids = malloc(sizeof(uint32_t) * (tar->no_entries + 1));
+    tar_entry_t *entries = NULL;
+    uint32_t *buckets = NULL;
+    int err = -1;
+    // the entries are written sorted by path
+    if (sorted != NULL && new_ids != NULL && index_sort_ids(tar, sorted) == 0
+        && index_permute(tar, sorted, new_ids, no_buckets, &entries, &buckets) == 0) {
+        err = index_dump_tables(tar, fd, layers, entries, buckets, no_buckets, tar->no_entries, tar->strings_len);
+    }
+    free(sorted);
+    free(new_ids);
+    free(entries);
+    free(buckets);
+    return err;
+}
+
+// the handle renumbered in the order of the paths, as index_dump() writes it, with buckets for no_buckets; -1 on error
+static int index_renumber(tar_t *tar, uint32_t no_buckets) {
+    uint32_t *sorted = malloc(sizeof(uint32_t) * (tar->no_entries + 1));
+    uint32_t *new_ids = malloc(sizeof(uint32_t) * (tar->no_entries + 1));
+    tar_entry_t *entries;
+    uint32_t *buckets;
+    int err = sorted == NULL || new_ids == NULL || index_sort_ids(tar, sorted)
+              || index_permute(tar, sorted, new_ids, no_buckets, &entries, &buckets);
+    if (!err) {
+        free(tar->entries);
+        free(tar->buckets);
+        tar->entries = entries;
+        tar->max_entries = tar->no_entries + 1;
+        tar->buckets = buckets;
+        tar->no_buckets = no_buckets;
+        index_track_t *track = tar->track;
+        for (uint32_t d = 0; track != NULL && d < track->no_deps; d++) { track->deps[d].link = new_ids[track->deps[d].link]; }
+        free(tar->sorted);
+        tar->sorted = NULL;
+        tar->no_sorted = tar->no_entries;
+    }
+    free(sorted);
+    free(new_ids);
+    return err ? -1 : 0;
+}
+
+/*
+ * Write the index of the handle to idx_path, through a file renamed once complete; -1 on error.
+ * For a writer (compact), the handle is first renumbered in the order of the paths as the file is, and the file keeps
+ * room for the entries and the strings of the deltas the next flushes append to it.
+ */
+static int index_save(tar_t *tar, const char *idx_path, int compact) {
+    tar_index_layer_t *layers = calloc(handle_no_layers(tar), sizeof(tar_index_layer_t));
+    char *tmp_path = malloc(strlen(idx_path) + 5);
+    uint64_t max_entries = (uint64_t) tar->no_entries + tar->no_entries / 2 + 64;
+    uint64_t strings_max = (uint64_t) tar->strings_len + tar->strings_len / 2 + 4096;
+    max_entries = max_entries < TAR_NOENT ? max_entries : TAR_NOENT - 1;
+    strings_max = strings_max < UINT32_MAX ? strings_max : UINT32_MAX;
+    uint32_t no_buckets = index_buckets_for(max_entries);
+    struct stat st;
+    int fd = -1;
+    int ret = -1;
+    if (layers == NULL || tmp_path == NULL || index_stat_layers(tar, layers)) { goto out; }
+
+    sprintf(tmp_path, "%s.tmp", idx_path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { goto out; }
+    int err = compact ? index_renumber(tar, no_buckets)
+                        || index_dump_tables(tar, fd, layers, tar->entries, tar->buckets, no_buckets, max_entries, strings_max)
+                      : index_dump(tar, fd, layers);
+    if (err || fstat(fd, &st) == -1 || rename(tmp_path, idx_path) == -1) {
+        unlink(tmp_path);
+        goto out;
+    }
+    if (compact) {
+        tar->index_file = (index_file_t) {st.st_dev, st.st_ino, st.st_size, st.st_size, max_entries, no_buckets,
+                                          strings_max, tar->no_entries, tar->strings_len};
+    }
+    ret = 0;
+
+out:
+    if (fd != -1) { close(fd); }
+    free(layers);
+    free(tmp_path);
+    return ret;
+}
+
+/**
+ * Writes the index of the handle to a sidecar file, for tar_open_index().
+ * The file is written next to idx_path then renamed, so a reader never sees a partial index.
+ *
+ * @param tar A handle on the archive.
+ * @param idx_path Where to write the index, usually the path of the archive followed by ".idx".
+ *
+ * @return zero on success, -1 on error.
+ */
+int tar_index_write(tar_t *tar, const char *idx_path) {
+    STAT_CALL(TAR_OP_INDEX_WRITE);
+    if (index_scan_all(tar)) { return -1; }
+    return index_save(tar, idx_path, 0);
+}
+
+/**
+ * Opens an archive handle from its sidecar index, without reading any header of the archive.
+ * If the index does not exist, is invalid or is stale (the archive changed size or mtime),
+ * the archive is scanned as with tar_open() and the index is written again.
+ * The index keeps the checkpoints of a compressed archive, so it is not decompressed again.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param idx_path The path of the sidecar index of the archive.
+ * @param flags The same flags as tar_open().
+ *
+ * @return a handle on the archive, NULL on error.
+ */
+tar_t *tar_open_index(int tar_fd, const char *idx_path, int flags) {
+    STAT_CALL(TAR_OP_OPEN_INDEX);
+    tar_t *tar = handle_new(tar_fd);
+    if (tar == NULL) { return NULL; }
+    if (index_load(tar, idx_path) == 0 && archive_map(tar, flags) == 0) { return tar; }
+    tar_close(tar);
+
+    tar = tar_open(tar_fd, flags);
+    if (tar != NULL) { tar_index_write(tar, idx_path); } // a read-only directory only costs the next open a scan
+    return tar;
+}
+
+
+/* ========== LAYERED ARCHIVES ==========
+ * An overlay is a handle whose index merges a stack of archives, its layers. Each entry records the layer it comes
+ * from, and each layer has a handle of its own, without index, only used to read its archive.
+ * The layers are indexed from the top one down, so a member of a lower layer is only added if no upper layer hides
+ * it: once opened, a lookup on the whole stack is a single lookup in the merged index.
+ */
+
+#define TAR_WHITEOUT ".wh."             // "dir/.wh.name" hides dir/name in the lower layers
+#define TAR_OPAQUE ".wh..wh..opq"       // "dir/.wh..wh..opq" hides everything under dir/ in the lower layers
+
+// the id of the entry at path added by a layer above the one being indexed, TAR_NOENT if none
+static uint32_t overlay_upper(tar_t *tar, char *path) {
+    uint32_t id = index_find_id(tar, path);
+    return id != TAR_NOENT && tar->entries[id].layer > tar->layer ? id : TAR_NOENT;
+}
+
+// whether a layer above the one being indexed recorded the whiteout path
+static int overlay_whiteout(tar_t *tar, tar_t *whiteouts, char *path) {
+    uint32_t id = index_find_id(whiteouts, path);
+    return id != TAR_NOENT && whiteouts->entries[id].layer > tar->layer;
+}
+
+// whether an upper layer hides the member name[0..len[ (without its trailing '/'): a whiteout of the member or of
+// one of its parents, an opaque parent, a parent which is not a directory there, or an entry at the same path
+static int overlay_hidden(tar_t *tar, tar_t *whiteouts, const char *name, size_t len, char typeflag) {
+    char path[TAR_PATH_MAX + 2] = "";
+    if (overlay_whiteout(tar, whiteouts, path)) { return 1; } // the root is opaque
+    for (size_t end = 0; end < len; end++) {
+        if (name[end] != '/') { continue; }
+        memcpy(path, name, end);
+        path[end] = '\0';
+        uint32_t id = overlay_upper(tar, path);
+        if (overlay_whiteout(tar, whiteouts, path) || (id != TAR_NOENT && tar->entries[id].typeflag != DIRTYPE)) { return 1; }
+        path[end] = '/';
+        path[end + 1] = '\0';
+        if (overlay_whiteout(tar, whiteouts, path)) { return 1; }
+    }
+    memcpy(path, name, len);
+    path[len] = '\0';
+    if (overlay_whiteout(tar, whiteouts, path)) { return 1; }
+    uint32_t id = overlay_upper(tar, path);
+    if (id == TAR_NOENT) {
+        path[len] = '/';
+        path[len + 1] = '\0';
+        id = overlay_upper(tar, path);
+    }
+    // two directories are merged, the header of the lower one describes a directory only known from its entries above
+    return id != TAR_NOENT
+           && !(typeflag == DIRTYPE && tar->entries[id].typeflag == DIRTYPE && tar->entries[id].header_offset == TAR_IMPLICIT);
+}
+
+// add the member of the layer being indexed unless an upper layer hides it, or record it if it is a whiteout
+static int overlay_add(tar_t *tar, tar_t *whiteouts, const char *header, uint64_t header_offset) {
+    char name[TAR_PATH_MAX];
+    size_t len = header_path(header, name);
+    if (len > 0 && name[len - 1] == '/') { len--; }
+    name[len] = '\0';
+    size_t base = len;
+    while (base > 0 && name[base - 1] != '/') { base--; }
+
+    size_t prefix = strlen(TAR_WHITEOUT);
+    if (len - base > prefix && !strncmp(&name[base], TAR_WHITEOUT, prefix)) {
+        if (!strcmp(&name[base], TAR_OPAQUE)) {
+            len = base; // "dir/", "" for the root
+        } else {
+            memmove(&name[base], &name[base + prefix], len - base - prefix);
+            len -= prefix;
+        }
+        name[len] = '\0';
+        if (index_find_id(whiteouts, name) != TAR_NOENT) { return 0; } // already hidden from higher up
+        return index_new(whiteouts, name, len, TAR_NOENT) == TAR_NOENT ? -1 : 0;
+    }
+    if (overlay_hidden(tar, whiteouts, name, len, header[156])) { return 0; }
+    return index_add(tar, header, header_offset);
+}
+
+// an overlay on the archives, with its empty layers
+static tar_t *overlay_new(const int *fds, size_t no_layers) {
+    tar_t *tar = handle_new(-1);
+    if (tar == NULL) { return NULL; }
+    tar->layers = calloc(no_layers, sizeof(tar_t *));
+    if (tar->layers == NULL) { tar_close(tar); return NULL; }
+    for (; tar->no_layers < no_layers; tar->no_layers++) {
+        tar->layers[tar->no_layers] = handle_new(fds[tar->no_layers]);
+        if (tar->layers[tar->no_layers] == NULL) { tar_close(tar); return NULL; }
+    }
+    return tar;
+}
+
+// an overlay indexed from the headers of its layers, NULL on error
+static tar_t *overlay_scan(const int *fds, size_t no_layers, int flags) {
+    tar_t *tar = overlay_new(fds, no_layers);
+    tar_t *whiteouts = handle_new(-1); // the paths hidden by each layer, only needed while indexing
+    if (tar == NULL || whiteouts == NULL) { goto err; }
+    tar->layer = no_layers - 1; // the root belongs to the top layer, nothing hides it
+    pool_add(whiteouts, "", 0);
+    if (index_init(tar) || whiteouts->strings == NULL) { goto err; }
+
+    for (uint32_t i = no_layers; i-- > 0; ) {
+        tar_t *layer = tar->layers[i];
+        tar->layer = whiteouts->layer = i;
+        int err;
+        layer->z = zsrc_open(layer->fd, &err);
+        tar_scan_t scan;
+        const char *header;
+        uint64_t pos;
+        if (err || archive_map(layer, flags) || scan_init(&scan, layer->fd, layer->map, layer->map_size, layer->z, 0)) { goto err; }
+        while ((header = scan_next(&scan, &pos)) != NULL) {
+            if (overlay_add(tar, whiteouts, header, pos)) { scan_free(&scan); goto err; }
+        }
+        scan_free(&scan);
+        if (scan.err) { goto err; }
+        if (layer->z != NULL) { layer->z->frozen = 1; }
+    }
+    tar_close(whiteouts);
+    index_done(tar); // in the merged tree: a link of a layer may point to an entry of another one
+    return tar;
+
+err:
+    tar_close(whiteouts);
+    tar_close(tar);
+    return NULL;
+}
+
+/**
+ * Opens a handle on a stack of archives, seen as one: the members of an upper archive shadow the members of the
+ * same path in the lower ones, and the directories of every archive are merged. Whiteouts are honored as in OCI
+ * images: a member "dir/.wh.name" hides dir/name, and everything under it, in the lower archives, and a member
+ * "dir/.wh..wh..opq" hides everything under dir/ in the lower archives. Whiteouts are not entries of the overlay.
+ *
+ * The archives are scanned once, from the top one down, into a merged index: tar_exists(), tar_is_*(), tar_list(),
+ * tar_read_file() and every function taking a handle then answer for the whole stack with one lookup.
+ * Links are resolved in the merged tree, a link of a lower archive to a path hidden above is broken.
+ * With an index path, the merged index is mapped from that sidecar as by tar_open_index(), and written there if it
+ * does not exist or is stale, one of the archives having changed.
+ *
+ * @param fds File descriptors on the archives, the bottom one first. They must stay open until tar_close().
+ * @param no_layers The number of archives, from 1 to 65536.
+ * @param idx_path The path of the sidecar index of the overlay, NULL to scan the archives at each open.
+ * @param flags Zero or more of TAR_MMAP, TAR_SEQUENTIAL and TAR_RANDOM, applied to each archive.
+ *
+ * @return a handle on the overlay, NULL on error.
+ */
+tar_t *tar_open_layers(const int *fds, size_t no_layers, const char *idx_path, int flags) {
+    STAT_CALL(TAR_OP_OPEN_LAYERS);
+    if (no_layers == 0 || no_layers > (size_t) UINT16_MAX + 1) { return NULL; }
+    if (idx_path != NULL) {
+        tar_t *tar = overlay_new(fds, no_layers);
+        if (tar == NULL) { return NULL; }
+        int mapped = index_load(tar, idx_path) == 0;
+        for (uint32_t i = 0; i < tar->no_layers && mapped; i++) { mapped = archive_map(tar->layers[i], flags) == 0; }
+        if (mapped) { return tar; }
+        tar_close(tar);
+    }
+
+    tar_t *tar = overlay_scan(fds, no_layers, flags);
+    if (tar != NULL && idx_path != NULL) { tar_index_write(tar, idx_path); }
+    return tar;
+}
+
+
+/* ========== PATH QUERIES ==========
+ * The entries sorted by path, built once by the first query: every path under a prefix is in one run of the array,
+ * found by a binary search. The entries of a sidecar index are already in that order, but for those added by its deltas.
+ */
+
+// the sorted ids, NULL if out of memory; the first query builds them, the others wait for it
+static const uint32_t *index_sorted(tar_t *tar) {
+    uint32_t *sorted = __atomic_load_n(&tar->sorted, __ATOMIC_ACQUIRE);
+    if (sorted != NULL) { return sorted; }
+    pthread_mutex_lock(&tar->sort_lock);
+    sorted = tar->sorted;
+    if (sorted == NULL) {
+        sorted = malloc(sizeof(uint32_t) * (tar->no_entries + 1));
+        if (sorted != NULL && tar->index_map != NULL && tar->no_sorted == tar->no_entries) {
+            for (uint32_t i = 0; i < tar->no_entries; i++) { sorted[i] = i; } // written sorted, without deltas after
+        } else if (sorted != NULL && index_sort_ids(tar, sorted)) {
+            free(sorted);
+            sorted = NULL;
+        }
+        __atomic_store_n(&tar->sorted, sorted, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&tar->sort_lock);
+    return sorted;
+}
+
+// the first position of the sorted entries whose path is not before prefix
+static uint32_t index_lower_bound(tar_t *tar, const uint32_t *sorted, const char *prefix) {
+    uint32_t low = 0, high = tar->no_entries;
+    char path[TAR_PATH_MAX];
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        entry_path(tar, sorted[mid], path);
+        if (strcmp(path, prefix) < 0) { low = mid + 1; } else { high = mid; }
+    }
+    return low;
+}
+
+// calls callback on the entries under prefix that match pattern (every one if NULL), in the order of their paths
+static int index_query(tar_t *tar, const char *prefix, size_t prefix_len, const char *pattern,
+                       int (*callback)(const tar_match_t *match, void *arg), void *arg) {
+    if (index_scan_all(tar)) { return tar->lazy_err; }
+    const uint32_t *sorted = index_sorted(tar);
+    if (sorted == NULL) { return -1; }
+    char start[TAR_PATH_MAX];
+    if (prefix_len >= TAR_PATH_MAX) { return 0; } // longer than any path of the archive
+    memcpy(start, prefix, prefix_len);
+    start[prefix_len] = '\0';
+
+    for (uint32_t i = index_lower_bound(tar, sorted, start); i < tar->no_entries; i++) {
+        tar_entry_t *entry = &tar->entries[sorted[i]];
+        char name[TAR_PATH_MAX];
+        entry_path(tar, sorted[i], name);
+        if (strncmp(name, start, prefix_len) != 0) { break; } // past the run of the prefix
+        if (entry->header_offset == TAR_IMPLICIT || (pattern != NULL && fnmatch(pattern, name, 0) != 0)) { continue; }
+        tar_match_t match = {name, &tar->strings[entry->linkname], entry->typeflag, entry->size, DATA_OFFSET(entry),
+                             entry->layer};
+        int res = callback(&match, arg);
+        if (res != 0) { return res; }
+    }
+    return 0;
+}
+
+/**
+ * Calls callback on every entry of the archive whose path starts with prefix, at any depth, in the order of the paths.
+ * Costs O(log N + matches) once the entries are sorted, which the first query of the handle does in O(N log N).
+ *
+ * @param tar A handle on the archive.
+ * @param prefix The start of the paths, "logs/2026/" for everything in that directory, "" for the whole archive.
+ *               It is compared byte for byte: "logs/2026" would also report "logs/2026-old".
+ * @param callback Called with each entry and arg. The match and its path are only valid during the call.
+ *                 It returns zero to go on with the next entry, any positive value stops the query.
+ * @param arg Passed to callback.
+ *
+ * @return zero once every entry has been reported,
+ *         the value returned by callback if it stopped the query,
+ *         -1 if the index could not be sorted (out of memory),
+ *         -4 if a lazy handle could not index the archive.
+ */
+int tar_find_prefix(tar_t *tar, const char *prefix, int (*callback)(const tar_match_t *match, void *arg), void *arg) {
+    STAT_CALL(TAR_OP_FIND_PREFIX);
+    return index_query(tar, prefix, strlen(prefix), NULL, callback, arg);
+}
+
+/**
+ * Calls callback on every entry of the archive whose path matches a shell pattern, in the order of the paths.
+ * The pattern is matched by fnmatch() without flags: a '*' also matches '/', so "*.json" finds the JSON files of
+ * every directory. Only the paths that start with the part of the pattern before its first '*', '?', '[' or '\'
+ * are tried, "logs/2026-*.json" only costs the entries under "logs/2026-".
+ *
+ * @param tar A handle on the archive.
+ * @param pattern A pattern of fnmatch().
+ * @param callback Called with each entry and arg, as for tar_find_prefix().
+ * @param arg Passed to callback.
+ *
+ * @return the same values as tar_find_prefix().
+ */
+int tar_find_glob(tar_t *tar, const char *pattern, int (*callback)(const tar_match_t *match, void *arg), void *arg) {
+    STAT_CALL(TAR_OP_FIND_GLOB);
+    return index_query(tar, pattern, strcspn(pattern, "*?[\\"), pattern, callback, arg);
+}
+
+
+/* ========== PARALLEL VERIFICATION ========== */
+
+#define TAR_VERIFY_CHUNK (1 << 20)
+
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc = crc32c_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+    for (; len > 0; len--, data++) { crc = _mm_crc32_u8(crc, *data); }
+    return crc;
+}
+#endif
+
+static uint32_t (*crc32c_kernel)(uint32_t crc, const uint8_t *data, size_t len) = crc32c_scalar;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_dispatch(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; j++) { crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1; }
+        crc32c_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) { crc32c_kernel = crc32c_sse42; }
+#endif
+}
+
+/**
+ * Computes the CRC32C (Castagnoli) of a buffer, with the SSE4.2 instruction when the CPU supports it.
+ *
+ * @param crc The CRC32C of the previous bytes, zero for the first buffer.
+ * @param data The bytes to add to the CRC.
+ * @param len The number of bytes in `data`.
+ *
+ * @return the CRC32C of the previous bytes followed by `data`.
+ */
+uint32_t tar_crc32c(uint32_t crc, const void *data, size_t len) {
+    pthread_once(&crc32c_once, crc32c_dispatch);
+    return ~crc32c_kernel(~crc, data, len);
+}
+
+typedef struct verify_job {
+    int fd;
+    tar_zsrc_t *z;      // the checkpoints recorded by the scan of a compressed archive
+    tar_member_digest_t *digests;
+    size_t no_digests;
+    size_t next;        // next member to digest, shared by the workers
+    int err;
+} verify_job_t;
+
+static void *verify_worker(void *ptr) {
+    verify_job_t *job = ptr;
+    uint8_t *buffer = malloc(TAR_VERIFY_CHUNK);
+    if (buffer == NULL) { __atomic_store_n(&job->err, -4, __ATOMIC_RELAXED); return NULL; }
+
+    size_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->no_digests) {
+        tar_member_digest_t *digest = &job->digests[i];
+        uint64_t done = 0;
+        uint32_t crc = 0;
+        while (done < digest->size) {
+            size_t len = digest->size - done < TAR_VERIFY_CHUNK ? digest->size - done : TAR_VERIFY_CHUNK;
+            uint64_t offset = digest->header_offset + 512 + done;
+            ssize_t err = job->z != NULL ? zsrc_pread(job->z, buffer, len, offset) : pread_full(job->fd, buffer, len, offset);
+            if (err == -1 || (size_t) err < len) { break; } // error on reading or truncated member
+            crc = tar_crc32c(crc, buffer, len);
+            done += len;
+        }
+        digest->crc32c = crc;
+        digest->status = done == digest->size ? 0 : -4;
+        if (digest->status) { __atomic_store_n(&job->err, -4, __ATOMIC_RELAXED); }
+    }
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Checks the headers of the archive like check_archive(), then computes the CRC32C of the content of every member
+ * with a pool of threads reading with pread().
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive. Its offset is not moved.
+ * @param no_threads The number of threads hashing the members, at least 1.
+ * @param digests Set to an array of one digest per valid header, in the order of the archive. Freed by the caller with free().
+ * @param no_digests Set to the number of digests in `digests`.
+ *
+ * @return a zero or positive value if the archive is valid, representing the number of non-null headers in the archive,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive could not be read or a member is truncated (its status is -4).
+ *         On -1, -2 and -3, the members before the first invalid header are still digested,
+ *         and that header is right after the last digested member.
+ */
+int tar_verify(int tar_fd, int no_threads, tar_member_digest_t **digests, size_t *no_digests) {
+    STAT_CALL(TAR_OP_VERIFY);
+    tar_scan_t scan;
+    char buffers[TAR_CHECK_BATCH][512];
+    const char *headers[TAR_CHECK_BATCH];
+    uint64_t offsets[TAR_CHECK_BATCH];
+    size_t no_headers;
+    size_t bad = 0;
+    size_t max = 0;
+    int res = 0;
+
+    verify_job_t job = {.fd = tar_fd};
+    int err;
+    job.z = zsrc_open(tar_fd, &err);
+    if (err || scan_init(&scan, tar_fd, NULL, 0, job.z, 0)) { zsrc_free(job.z); return -4; }
+    // one fast pass over the headers to find the extent of every member
+    do {
+        no_headers = scan_batch(&scan, buffers, headers, offsets);
+        res = tar_check_headers(headers, no_headers, &bad);
+        if (res == 0) { bad = no_headers; }
+        if (job.no_digests + bad > max) {
+            max = max ? max * 2 : 1024;
+            tar_member_digest_t *grown = realloc(job.digests, sizeof(tar_member_digest_t) * max);
+            if (grown == NULL) { scan_free(&scan); zsrc_free(job.z); free(job.digests); return -4; }
+            job.digests = grown;
+        }
+        for (size_t i = 0; i < bad; i++) {
+            tar_member_digest_t *digest = &job.digests[job.no_digests++];
+            digest->header_offset = offsets[i];
+            digest->size = header_size(headers[i]);
+        }
+    } while (res == 0 && no_headers == TAR_CHECK_BATCH);
+    scan_free(&scan);
+    if (res == 0 && scan.err) { res = -4; } // error on reading
+    if (job.z != NULL) { job.z->frozen = 1; }
+
+    if (no_threads < 1) { no_threads = 1; }
+    pthread_t *threads = malloc(sizeof(pthread_t) * no_threads);
+    if (threads == NULL) { zsrc_free(job.z); free(job.digests); return -4; }
+    int started = 0;
+    for (; started < no_threads; started++) {
+        if (pthread_create(&threads[started], NULL, verify_worker, &job)) { break; }
+    }
+    if (started == 0) { verify_worker(&job); }
+    for (int i = 0; i < started; i++) { pthread_join(threads[i], NULL); }
+    free(threads);
+    zsrc_free(job.z);
+
+    *digests = job.digests;
+    *no_digests = job.no_digests;
+    if (res) { return res; }
+    if (job.err) { return job.err; }
+    return job.no_digests;
+}
+
+
+/* ========== EXTRACTION ==========
+ * One pass over the headers, then the directories are created in the order of the archive, the regular files are
+ * written by a pool of threads with copy_file_range() (sendfile() if the file systems refuse it), and the links are
+ * made last, hard links before symlinks: no file is ever written through a link of the archive.
+ */
+
+#define TAR_EXTRACT_CHUNK (1 << 20)     // read and written at once when the content has to go through a buffer
+
+typedef struct extract_member {
+    uint64_t data_offset;
+    uint64_t size;
+    char *name;         // relative to the destination, NULL if the member is replaced by a later one of the same name
+    char *linkname;
+    uint32_t mode;
+    int64_t mtime;
+    char typeflag;
+} extract_member_t;
+
+typedef struct extract_job {
+    int fd;
+    int dir_fd;
+    tar_zsrc_t *z;      // the checkpoints recorded by the scan of a compressed archive
+    extract_member_t *members;
+    size_t no_members;
+    size_t next;        // next member to write, shared by the workers
+    int err;
+} extract_job_t;
+
+// the path of a member under the destination, without its leading '/', NULL if it has a '..' component
+static char *extract_path(const char *name) {
+    while (*name == '/') { name++; }
+    for (const char *c = name; *c != '\0'; ) {
+        const char *end = strchrnul(c, '/');
+        if (end - c == 2 && c[0] == '.' && c[1] == '.') { return NULL; }
+        c = *end == '/' ? end + 1 : end;
+    }
+    return strdup(*name == '\0' ? "." : name);
+}
+
+// create the missing directories of path, except its last component; last is the parent created before
+static int extract_parents(int dir_fd, const char *path, char *last) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) { return 0; }
+    size_t len = slash - path;
+    if (len < TAR_PATH_MAX && strncmp(path, last, len) == 0 && last[len] == '\0') { return 0; } // same parent
+    char dir[TAR_PATH_MAX];
+    if (len >= TAR_PATH_MAX) { return -1; }
+    for (size_t i = 1; i <= len; i++) {
+        if (i < len && path[i] != '/') { continue; }
+        memcpy(dir, path, i);
+        dir[i] = '\0';
+        if (mkdirat(dir_fd, dir, 0700) == -1 && errno != EEXIST) { return -1; }
+    }
+    strcpy(last, dir);
+    return 0;
+}
+
+// the member with the same name later in the archive wins
+static int extract_cmp(const void *a, const void *b) {
+    const extract_member_t *x = *(extract_member_t *const *) a;
+    const extract_member_t *y = *(extract_member_t *const *) b;
+    int cmp = strcmp(x->name, y->name);
+    return cmp ? cmp : (x < y ? -1 : x > y);
+}
+
+static void extract_times(struct timespec times[2], int64_t mtime) {
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_NOW;
+    times[1].tv_sec = mtime;
+    times[1].tv_nsec = 0;
+}
+
+// the content of member to out, without a copy in user space when both file systems allow it
+static int extract_copy(extract_job_t *job, extract_member_t *member, int out, uint8_t **buffer) {
+    uint64_t done = 0;
+    int in_kernel = job->z == NULL;
+    while (in_kernel && done < member->size) {
+        loff_t in = member->data_offset + done;
+        ssize_t res = copy_file_range(job->fd, &in, out, NULL, member->size - done, 0);
+        STAT_ADD(read_calls, 1);
+        if (res == 0) { return -4; } // truncated member
+        if (res == -1) { break; }
+        STAT_ADD(bytes_read, res);
+        done += res;
+    }
+    while (in_kernel && done < member->size) {
+        off_t in = member->data_offset + done;
+        ssize_t res = sendfile(out, job->fd, &in, member->size - done);
+        STAT_ADD(read_calls, 1);
+        if (res == 0) { return -4; }
+        if (res == -1) { break; }
+        STAT_ADD(bytes_read, res);
+        done += res;
+    }
+
+    // a compressed archive, or neither call supported: through a buffer
+    if (done < member->size && *buffer == NULL && (*buffer = malloc(TAR_EXTRACT_CHUNK)) == NULL) { return -5; }
+    while (done < member->size) {
+        size_t len = member->size - done < TAR_EXTRACT_CHUNK ? member->size - done : TAR_EXTRACT_CHUNK;
+        uint64_t offset = member->data_offset + done;
+        ssize_t err = job->z != NULL ? zsrc_pread(job->z, *buffer, len, offset) : pread_full(job->fd, *buffer, len, offset);
+        if (err == -1 || (size_t) err < len) { return -4; } // error on reading or truncated member
+        for (size_t written = 0; written < len; ) {
+            ssize_t res = write(out, *buffer + written, len - written);
+            if (res == -1) { return -5; }
+            written += res;
+        }
+        done += len;
+    }
+    return 0;
+}
+
+static void *extract_worker(void *ptr) {
+    extract_job_t *job = ptr;
+    uint8_t *buffer = NULL;
+    size_t i;
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->no_members) {
+        extract_member_t *member = &job->members[i];
+        if (member->name == NULL || (member->typeflag != REGTYPE && member->typeflag != AREGTYPE)) { continue; }
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+        int out = openat(job->dir_fd, member->name, flags, 0600);
+        if (out == -1 && (errno == ELOOP || errno == EISDIR)) {
+            // a link or an empty directory of the same name is replaced, never written through
+            unlinkat(job->dir_fd, member->name, errno == EISDIR ? AT_REMOVEDIR : 0);
+            out = openat(job->dir_fd, member->name, flags, 0600);
+        }
+        int err = out == -1 ? -5 : extract_copy(job, member, out, &buffer);
+        if (err == 0) {
+            struct timespec times[2];
+            extract_times(times, member->mtime);
+            if (fchmod(out, member->mode) == -1 || futimens(out, times) == -1) { err = -5; }
+        }
+        if (out != -1 && close(out) == -1 && err == 0) { err = -5; }
+        if (err) { __atomic_store_n(&job->err, err, __ATOMIC_RELAXED); }
+    }
+    free(buffer);
+    return NULL;
+}
+
+// the links, then the modes and times of the directories, deepest first since creating an entry changes them
+static int extract_finish(extract_job_t *job) {
+    int err = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        char type = pass == 0 ? LNKTYPE : SYMTYPE;
+        for (size_t i = 0; i < job->no_members; i++) {
+            extract_member_t *member = &job->members[i];
+            if (member->name == NULL || member->typeflag != type) { continue; }
+            unlinkat(job->dir_fd, member->name, 0);
+            if (type == LNKTYPE) {
+                char target[TAR_PATH_MAX];
+                if (link_target(member->name, LNKTYPE, member->linkname, target) < 0
+                    || linkat(job->dir_fd, target, job->dir_fd, member->name, 0) == -1) { err = -5; }
+                continue;
+            }
+            struct timespec times[2];
+            extract_times(times, member->mtime);
+            if (symlinkat(member->linkname, job->dir_fd, member->name) == -1
+                || utimensat(job->dir_fd, member->name, times, AT_SYMLINK_NOFOLLOW) == -1) { err = -5; }
+        }
+    }
+    for (size_t i = job->no_members; i-- > 0; ) {
+        extract_member_t *member = &job->members[i];
+        if (member->name == NULL || member->typeflag != DIRTYPE) { continue; }
+        struct timespec times[2];
+        extract_times(times, member->mtime);
+        if (fchmodat(job->dir_fd, member->name, member->mode, 0) == -1
+            || utimensat(job->dir_fd, member->name, times, 0) == -1) { err = -5; }
+    }
+    return err;
+}
+
+static void extract_free(extract_job_t *job) {
+    for (size_t i = 0; i < job->no_members; i++) {
+        free(job->members[i].name);
+        free(job->members[i].linkname);
+    }
+    free(job->members);
+    zsrc_free(job->z);
+    if (job->dir_fd != -1) { close(job->dir_fd); }
+}
+
+/**
+ * Extracts the archive under a directory: one pass over the headers, the directories, then the regular files
+ * written by a pool of threads with copy_file_range() or sendfile() from tar_fd, then the hard links and the symlinks.
+ * The permissions (without setuid and setgid) and modification times of the headers are applied, not the owners.
+ * A member of the same name as a later one is skipped, a member with a '..' component is refused.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive. Its offset is not moved.
+ * @param dir The destination directory, it must exist.
+ * @param no_threads The number of threads writing the files, at least 1.
+ *
+ * @return a zero or positive value if the archive is valid and extracted, representing the number of non-null headers,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive could not be read or a member is truncated,
+ *         -5 if a member could not be written or was refused, the other members are still extracted.
+ *         On -1, -2 and -3, the members before the first invalid header are still extracted.
+ */
+int tar_extract(int tar_fd, const char *dir, int no_threads) {
+    STAT_CALL(TAR_OP_EXTRACT);
+    tar_scan_t scan;
+    char buffers[TAR_CHECK_BATCH][512];
+    const char *headers[TAR_CHECK_BATCH];
+    uint64_t offsets[TAR_CHECK_BATCH];
+    size_t no_headers;
+    size_t bad = 0;
+    size_t max = 0;
+    int res = 0;
+
+    extract_job_t job = {.fd = tar_fd, .dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if (job.dir_fd == -1) { return -5; }
     int err;
-    int size;
-    int blocks_skip;
-    int out;
-
-    while(1) {
-        err = read(tar_fd, buffer, 512);
-        if (err == -1) {reset(tar_fd); return -3; } // error on reading
-        if (buffer[0] == '\0') {reset(tar_fd); *len = 0; return -1;}
-        if (err < 512 && err > -1) {reset(tar_fd); *len = 0; return -1; } // end of the file
-
-        current_name = hash(&buffer[0]);
-        size = strtol(&buffer[124], NULL, 8);
-        if (current_name == path_name && (
-            buffer[156] == REGTYPE ||
-            buffer[156] == AREGTYPE ||
-            buffer[156] == SYMTYPE
-        )) {
-
-            if (buffer[156] == SYMTYPE) {
-                printf("Sym link detected !\n");
-                reset(tar_fd);
-                return read_file(tar_fd, &buffer[157], offset, dest, len);
+    job.z = zsrc_open(tar_fd, &err);
+    if (err || scan_init(&scan, tar_fd, NULL, 0, job.z, 0)) { extract_free(&job); return -4; }
+    do {
+        no_headers = scan_batch(&scan, buffers, headers, offsets);
+        res = tar_check_headers(headers, no_headers, &bad);
+        if (res == 0) { bad = no_headers; }
+        if (job.no_members + bad > max) {
+            max = max ? max * 2 : 1024;
+            extract_member_t *grown = realloc(job.members, sizeof(extract_member_t) * max);
+            if (grown == NULL) { res = -4; break; }
+            job.members = grown;
+        }
+        for (size_t i = 0; i < bad; i++) {
+            const char *header = headers[i];
+            char name[TAR_PATH_MAX];
+            header_path(header, name);
+            extract_member_t *member = &job.members[job.no_members++];
+            member->data_offset = offsets[i] + 512;
+            member->size = header_size(header);
+            member->typeflag = header[156];
+            member->mode = octal_field(&header[100], 8) & 01777;
+            member->mtime = numeric_field(&header[136], 12);
+            member->linkname = strndup(&header[157], 100);
+            member->name = NULL;
+            if (member->typeflag != REGTYPE && member->typeflag != AREGTYPE && member->typeflag != DIRTYPE
+                && !IS_LINK(member->typeflag)) { continue; } // pax headers, devices, fifos... are skipped
+            member->name = extract_path(name);
+            if (member->name == NULL) { job.err = -5; }
+            if (member->linkname == NULL) { res = -4; }
+        }
+    } while (res == 0 && no_headers == TAR_CHECK_BATCH);
+    scan_free(&scan);
+    if (res == 0 && scan.err) { res = -4; } // error on reading
+    if (job.z != NULL) { job.z->frozen = 1; }
+    if (res == -4) { extract_free(&job); return -4; }
+
+    // the members replaced by a later one of the same name
+    extract_member_t **sorted = malloc(sizeof(extract_member_t *) * (job.no_members + 1));
+    if (sorted == NULL) { extract_free(&job); return -4; }
+    size_t no_sorted = 0;
+    for (size_t i = 0; i < job.no_members; i++) {
+        if (job.members[i].name != NULL) { sorted[no_sorted++] = &job.members[i]; }
+    }
+    qsort(sorted, no_sorted, sizeof(extract_member_t *), extract_cmp);
+    for (size_t i = 0; i + 1 < no_sorted; i++) {
+        if (strcmp(sorted[i]->name, sorted[i + 1]->name) == 0) {
+            free(sorted[i]->name);
+            sorted[i]->name = NULL;
+        }
+    }
+    free(sorted);
+
+    // the skeleton, in the order of the archive so that a parent comes before its children
+    char last[TAR_PATH_MAX] = "";
+    for (size_t i = 0; i < job.no_members; i++) {
+        extract_member_t *member = &job.members[i];
+        if (member->name == NULL) { continue; }
+        if (extract_parents(job.dir_fd, member->name, last)) { job.err = -5; }
+        if (member->typeflag == DIRTYPE && mkdirat(job.dir_fd, member->name, 0700) == -1 && errno != EEXIST) {
+            job.err = -5;
+        }
+    }
+
+    if (no_threads < 1) { no_threads = 1; }
+    pthread_t *threads = malloc(sizeof(pthread_t) * no_threads);
+    if (threads == NULL) { extract_free(&job); return -4; }
+    int started = 0;
+    for (; started < no_threads; started++) {
+        if (pthread_create(&threads[started], NULL, extract_worker, &job)) { break; }
+    }
+    if (started == 0) { extract_worker(&job); }
+    for (int i = 0; i < started; i++) { pthread_join(threads[i], NULL); }
+    free(threads);
+    if (extract_finish(&job)) { job.err = job.err ? job.err : -5; }
+
+    size_t no_members = job.no_members;
+    err = job.err;
+    extract_free(&job);
+    if (res) { return res; }
+    if (err) { return err; }
+    return no_members;
+}
+
+
+/* ========== RE-LAYOUT ==========
+ * The archive rewritten for the handle: the members of each directory one after the other, the content of the large
+ * files on page boundaries, and the index of the archive at its end, mapped by tar_open() instead of reading the
+ * headers. Every padding is a pax header holding a comment record, which any reader skips.
+ */
+
+#define TAR_PAGE 4096
+#define TAR_PAX_NAME "././@PaxHeader"
+
+// the length of the directory part of a path, its trailing '/' included
+static size_t path_dir_len(const char *name) {
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '/') { len--; }
+    while (len > 0 && name[len - 1] != '/') { len--; }
+    return len;
+}
+
+// the members grouped by directory, the directories in the order of their paths: a directory comes before its entries
+static int relayout_cmp(const void *a, const void *b) {
+    const char *x = ((const sort_item_t *) a)->name;
+    const char *y = ((const sort_item_t *) b)->name;
+    size_t x_dir = path_dir_len(x);
+    size_t y_dir = path_dir_len(y);
+    int res = memcmp(x, y, x_dir < y_dir ? x_dir : y_dir);
+    if (res == 0 && x_dir != y_dir) { return x_dir < y_dir ? -1 : 1; }
+    return res != 0 ? res : strcmp(&x[x_dir], &y[y_dir]);
+}
+
+// whether the hard link at rank i of the new order points to a member written after it
+static int relayout_late(tar_t *tar, tar_entry_t *link, const uint32_t *rank, uint32_t i) {
+    char name[TAR_PATH_MAX];
+    char path[TAR_PATH_MAX];
+    entry_path(tar, link - tar->entries, name);
+    if (link_target(name, LNKTYPE, &tar->strings[link->linkname], path) < 0) { return 0; }
+    uint32_t id = index_find_id(tar, path);
+    return id != TAR_NOENT && tar->entries[id].header_offset != TAR_IMPLICIT && rank[id] > i;
+}
+
+// a ustar header for a pax header of size bytes, of type XHDTYPE or XGLTYPE
+static void relayout_pax_header(char *header, char typeflag, uint64_t size) {
+    memset(header, 0, 512);
+    strcpy(header, TAR_PAX_NAME);
+    strcpy(&header[100], "0000644");
+    strcpy(&header[108], "0000000");
+    strcpy(&header[116], "0000000");
+    snprintf(&header[124], 12, "%011llo", (unsigned long long) size);
+    strcpy(&header[136], "00000000000");
+    header[156] = typeflag;
+    memcpy(&header[257], TMAGIC, TMAGLEN);
+    memcpy(&header[263], TVERSION, TVERSLEN);
+    header_checksum(header);
+}
+
+// the start of a comment record of len bytes, padded with spaces to TAR_EMBED_SKIP bytes
+static void relayout_comment(char *record, uint64_t len) {
+    memset(record, ' ', TAR_EMBED_SKIP);
+    int n = sprintf(record, "%llu comment=", (unsigned long long) len);
+    record[n] = ' ';
+}
+
+// a pax header whose comment moves pos to target modulo TAR_PAGE, -1 on a write error
+static int relayout_pad(int fd, uint64_t *pos, uint64_t target, char typeflag) {
+    uint64_t gap = (target + TAR_PAGE - *pos % TAR_PAGE) % TAR_PAGE;
+    if (gap == 0) { return 0; }
+    char block[TAR_PAGE];
+    uint64_t size = gap - 512; // nothing if the header fills the gap on its own
+    relayout_pax_header(block, typeflag, size);
+    if (size > 0) {
+        memset(&block[512], ' ', size);
+        relayout_comment(&block[512], size);
+        block[gap - 1] = '\n';
+    }
+    if (write_full(fd, block, gap)) { return -1; }
+    *pos += gap;
+    return 0;
+}
+
+// whether the records of size bytes at offset are all comments, -1 on a read error
+static int relayout_comments_only(tar_t *tar, uint64_t offset, uint64_t size) {
+    uint64_t pos = 0;
+    while (pos < size) {
+        char record[32]; // its length, then its keyword
+        size_t n = size - pos < sizeof(record) ? size - pos : sizeof(record);
+        if (archive_pread(tar, record, n, offset + pos) != (ssize_t) n) { return -1; }
+        uint64_t len = 0;
+        size_t i = 0;
+        for (; i < n && i < 19 && record[i] >= '0' && record[i] <= '9'; i++) { len = len * 10 + record[i] - '0'; }
+        if (i == 0 || i + 9 > n || record[i] != ' ' || len <= i || len > size - pos || memcmp(&record[i + 1], "comment=", 8)) {
+            return 0;
+        }
+        pos += len;
+    }
+    return 1;
+}
+
+typedef struct relayout_pax {
+    uint64_t member;    // offset of the header of the member
+    uint64_t offset;    // offset of its pax extended headers
+    uint64_t len;       // bytes of the pax headers and their records, up to the member
+} relayout_pax_t;
+
+// the pax extended headers of the archive, by member in the order of the archive,
+// -4 on a read error, -6 if a global header holds other records than comments
+static int relayout_paxes(tar_t *tar, relayout_pax_t **paxes, uint32_t *no_paxes) {
+    tar_scan_t scan;
+    const char *header;
+    uint64_t pos;
+    uint32_t max = 0;
+    uint64_t pending = UINT64_MAX; // offset of the first pax extended header since the last member
+    int ret = 0;
+    *paxes = NULL;
+    *no_paxes = 0;
+    if (scan_init(&scan, tar->fd, tar->map, tar->map_size, tar->z, 0)) { return -4; }
+    while (ret == 0 && (header = scan_next(&scan, &pos)) != NULL) {
+        char typeflag = header[156];
+        if (typeflag == XHDTYPE || typeflag == XGLTYPE) {
+            int comments = relayout_comments_only(tar, pos + 512, header_size(header));
+            if (comments == -1) { ret = -4; }
+            else if (!comments && typeflag == XGLTYPE) { ret = -6; }
+            else if (!comments && pending == UINT64_MAX) { pending = pos; }
+            continue;
+        }
+        if (pending == UINT64_MAX) { continue; }
+        if (*no_paxes == max) {
+            max = max ? max * 2 : 64;
+            relayout_pax_t *grown = realloc(*paxes, sizeof(relayout_pax_t) * max);
+            if (grown == NULL) { ret = -4; break; }
+            *paxes = grown;
+        }
+        (*paxes)[(*no_paxes)++] = (relayout_pax_t) {pos, pending, pos - pending};
+        pending = UINT64_MAX;
+    }
+    scan_free(&scan);
+    if (ret == 0 && scan.err) { ret = -4; }
+    return ret;
+}
+
+// the pax extended headers of the member whose header is at offset, NULL if it has none
+static relayout_pax_t *relayout_pax_find(relayout_pax_t *paxes, uint32_t no_paxes, uint64_t offset) {
+    uint32_t lo = 0;
+    uint32_t hi = no_paxes;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (paxes[mid].member < offset) { lo = mid + 1; } else { hi = mid; }
+    }
+    return lo < no_paxes && paxes[lo].member == offset ? &paxes[lo] : NULL;
+}
+
+// the index of the members written, in the comment of a pax global header whose content starts on a page boundary
+static int relayout_index(tar_t *index, int fd, uint64_t *pos) {
+    index_done(index);
+    if (relayout_pad(fd, pos, TAR_PAGE - 512, XGLTYPE)) { return -1; }
+    tar_index_layer_t layer = {.archive_size = *pos};
+    tar_index_footer_t footer;
+    memcpy(footer.magic, TAR_EMBED_MAGIC, 8);
+    footer.header_offset = *pos;
+    footer.index_len = index_dump_size(index, &layer);
+    uint64_t size = TAR_BLOCKS(TAR_EMBED_SKIP + footer.index_len + sizeof(footer) + 1) * 512;
+    char header[512];
+    char record[TAR_EMBED_SKIP];
+    char spaces[512];
+    memset(spaces, ' ', sizeof(spaces));
+    relayout_pax_header(header, XGLTYPE, size);
+    relayout_comment(record, size);
+    if (write_full(fd, header, 512) || write_full(fd, record, TAR_EMBED_SKIP) || index_dump(index, fd, &layer)
+        || write_full(fd, spaces, size - TAR_EMBED_SKIP - footer.index_len - sizeof(footer) - 1)
+        || write_full(fd, &footer, sizeof(footer)) || write_full(fd, "\n", 1)) {
+        return -1;
+    }
+    *pos += 512 + size;
+    return 0;
+}
+
+/**
+ * Rewrites an archive for lookups: the members of each directory are written one after the other, the directories in
+ * the order of their paths, so a directory comes before its entries. A hard link whose target would come after it is
+ * moved to the end. The headers and contents are copied unchanged, with sendfile() (splice() when out_fd refuses it)
+ * when the archive is not compressed, through a buffer otherwise. A member of the same name as a later one is dropped.
+ * The pax extended header of a member is copied just before it; the ones holding only comments are dropped, as are
+ * the global ones holding only comments, such as the paddings and the index of an archive already rewritten.
+ * The output stays a valid ustar archive: its paddings are pax headers holding a comment, which readers skip.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive. Its offset is not moved.
+ * @param out_fd The file descriptor the archive is written to, from its current position, usually a new file.
+ * @param flags Zero or more of TAR_RELAYOUT_ALIGN and TAR_RELAYOUT_INDEX.
+ *
+ * @return a zero or positive value if the archive is valid and rewritten, representing the number of members written,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive could not be read or a member is truncated,
+ *         -5 if out_fd could not be written,
+ *         -6 if the archive contains a pax global header with records other than comments, which would apply
+ *            to other members once they are moved.
+ */
+int tar_relayout(int tar_fd, int out_fd, int flags) {
+    STAT_CALL(TAR_OP_RELAYOUT);
+    static const uint8_t zeros[1024];
+    tar_t *tar = tar_open(tar_fd, 0);
+    if (tar == NULL) { return -4; }
+    int ret = tar_check(tar);
+    sort_item_t *items = malloc(sizeof(sort_item_t) * tar->no_entries);
+    uint32_t *rank = malloc(sizeof(uint32_t) * tar->no_entries);
+    tar_t *index = flags & TAR_RELAYOUT_INDEX ? handle_new(out_fd) : NULL;
+    char *paths = NULL;
+    relayout_pax_t *paxes = NULL;
+    uint32_t no_paxes;
+    if (ret < 0 || (ret = relayout_paxes(tar, &paxes, &no_paxes)) < 0) { goto out; }
+    ret = -4;
+    if (items == NULL || rank == NULL || ((flags & TAR_RELAYOUT_INDEX) && (index == NULL || index_init(index)))
+        || (paths = index_path_items(tar, items)) == NULL) {
+        goto out;
+    }
+
+    uint32_t no_items = 0;
+    for (uint32_t id = 0; id < tar->no_entries; id++) {
+        if (tar->entries[id].header_offset != TAR_IMPLICIT) { items[no_items++] = items[id]; }
+    }
+    qsort(items, no_items, sizeof(sort_item_t), relayout_cmp);
+    for (uint32_t i = 0; i < no_items; i++) { rank[items[i].id] = i; }
+
+    off_t start = lseek(out_fd, 0, SEEK_CUR);
+    uint64_t pos = start == -1 ? 0 : start;
+    int written = 0;
+    for (int late = 0; late < 2; late++) { // the hard links to a later member go last
+        for (uint32_t i = 0; i < no_items; i++) {
+            tar_entry_t *entry = &tar->entries[items[i].id];
+            if ((entry->typeflag == LNKTYPE && relayout_late(tar, entry, rank, i)) != late) { continue; }
+            char header[512];
+            if (archive_pread(tar, header, 512, entry->header_offset) != 512) { ret = -4; goto out; }
+            int regular = entry->typeflag == REGTYPE || entry->typeflag == AREGTYPE;
+            relayout_pax_t *pax = relayout_pax_find(paxes, no_paxes, entry->header_offset);
+            uint64_t pax_len = pax != NULL ? pax->len : 0;
+            int err = 0;
+            ret = -5;
+            // a padding before a pax extended header is a global one, the extended one applies to the next header
+            if ((flags & TAR_RELAYOUT_ALIGN) && regular && entry->size >= TAR_PAGE
+                && relayout_pad(out_fd, &pos, (2 * TAR_PAGE - 512 - pax_len % TAR_PAGE) % TAR_PAGE,
+                                pax != NULL ? XGLTYPE : XHDTYPE)) {
+                goto out;
             }
+            if (pax != NULL && send_range(tar, out_fd, pax->offset, pax_len, &err) != pax_len) {
+                ret = err == EIO ? -4 : -5;
+                goto out;
+            }
+            pos += pax_len;
+            if (write_full(out_fd, header, 512) || (index != NULL && index_add(index, header, pos))) { goto out; }
+            pos += 512;
+
+            if (entry->size > 0 && send_range(tar, out_fd, DATA_OFFSET(entry), entry->size, &err) != entry->size) {
+                ret = err == EIO ? -4 : -5; // EIO is also a truncated archive
+                goto out;
+            }
+            size_t pad = (512 - entry->size % 512) % 512;
+            if (write_full(out_fd, zeros, pad)) { goto out; }
+            pos += entry->size + pad;
+            written++;
+        }
+    }
+    ret = -5;
+    if ((index != NULL && relayout_index(index, out_fd, &pos)) || write_full(out_fd, zeros, sizeof(zeros))) { goto out; }
+    ret = written;
+
+out:
+    free(paxes);
+    free(paths);
+    free(items);
+    free(rank);
+    tar_close(index);
+    tar_close(tar);
+    return ret;
+}
+
+
+/* ========== ARCHIVE WRITER ==========
+ * The members go through a large buffer, written with pwrite() at explicit offsets, and the content of a file given by
+ * its descriptor is copied in the kernel with copy_file_range(). The end-of-archive blocks are written by each flush
+ * after the last member, and overwritten by the next one.
+ * A handle given to the writer indexes each member once it is in the archive, as index_add() does while scanning:
+ * the archive is never scanned again. The handle records the paths each link looks up while it is resolved, so that
+ * a flush only resolves again the links that looked up a path added or replaced since, then the links that looked up
+ * those links, and only appends the entries it changed to the sidecar index.
+ */
+
+#define TAR_WRITER_BUFFER (1 << 20)
+
+struct tar_writer {
+    int fd;
+    tar_t *tar;             // the handle updated with the members written, NULL if none
+    char *idx_path;         // the sidecar index written again by each flush, NULL if none
+    uint8_t *buffer;        // TAR_WRITER_BUFFER bytes, to write at pos
+    size_t len;
+    uint64_t pos;
+    uint32_t pending[TAR_WRITER_BUFFER / 512]; // offsets in the buffer of the headers of the members it holds whole
+    uint32_t no_pending;
+    int added;              // members indexed since the last flush
+    int ended;              // nothing written since the last flush, the archive ends with its end-of-archive blocks
+    int err;                // -5 once the archive could not be written, every call fails then
+};
+
+// pwrite() until len bytes are written, never moves the offset of fd
+static int pwrite_full(int fd, const void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t err = pwrite(fd, (const uint8_t *) buf + done, len - done, (off_t) (offset + done));
+        if (err == -1 && errno == EINTR) { continue; }
+        if (err <= 0) { return -1; }
+        done += err;
+    }
+    return 0;
+}
+
+// the offset of the end of the last member of the archive at fd, the pax headers after it are dropped; -1 on error
+static int writer_end(int fd, uint64_t *end) {
+    tar_scan_t scan;
+    const char *header;
+    uint64_t pos;
+    *end = 0;
+    if (scan_init(&scan, fd, NULL, 0, NULL, 0)) { return -1; }
+    while ((header = scan_next(&scan, &pos)) != NULL) {
+        if (header[156] != XHDTYPE && header[156] != XGLTYPE) { *end = pos + 512 + TAR_BLOCKS(header_size(header)) * 512; }
+    }
+    scan_free(&scan);
+    return scan.err;
+}
+
+// the same end from the index of the handle: the member furthest in the archive is the last one
+static uint64_t writer_index_end(tar_t *tar) {
+    uint64_t end = 0;
+    for (uint32_t id = 0; id < tar->no_entries; id++) {
+        tar_entry_t *entry = &tar->entries[id];
+        if (entry->header_offset == TAR_IMPLICIT || DATA_OFFSET(entry) <= end) { continue; }
+        end = DATA_OFFSET(entry) + TAR_BLOCKS(entry->size) * 512;
+    }
+    return end;
+}
+
+// a mapped index copied to memory, so that members can be added to it; -1 if out of memory
+static int index_unmap(tar_t *tar) {
+    if (tar->index_map == NULL) { return 0; }
+    tar_entry_t *entries = malloc(sizeof(tar_entry_t) * tar->no_entries);
+    uint32_t *buckets = malloc(sizeof(uint32_t) * tar->no_buckets);
+    char *strings = malloc(tar->strings_len);
+    if (entries == NULL || buckets == NULL || strings == NULL) {
+        free(entries);
+        free(buckets);
+        free(strings);
+        return -1;
+    }
+    memcpy(entries, tar->entries, sizeof(tar_entry_t) * tar->no_entries);
+    memcpy(buckets, tar->buckets, sizeof(uint32_t) * tar->no_buckets);
+    memcpy(strings, tar->strings, tar->strings_len);
+    munmap(tar->index_map, tar->index_map_size);
+    tar->index_map = NULL;
+    tar->entries = entries;
+    tar->buckets = buckets;
+    tar->strings = strings;
+    return 0;
+}
+
+// every link resolved again: a member added may be the target of a link, or replace one
+static void index_relink(tar_t *tar) {
+    for (uint32_t id = 0; id < tar->no_entries; id++) {
+        if (IS_LINK(tar->entries[id].typeflag)) { tar->entries[id].target = TAR_UNRESOLVED; }
+    }
+    index_resolve_all(tar);
+}
+
+// the tracking of a writer started on the handle, every link resolved again to record the paths it looks up
+static void track_start(tar_t *tar) {
+    tar->track = calloc(1, sizeof(index_track_t));
+    if (tar->track == NULL) { return; } // every flush resolves every link then
+    tar->track->resolving = TAR_NOENT;
+    index_relink(tar);
+    tar->track->built_deps = tar->track->no_deps;
+}
+
+// the deps recorded from scratch, by resolving every link again
+static void track_rebuild(tar_t *tar) {
+    index_track_t *track = tar->track;
+    track->no_deps = 0;
+    for (uint32_t b = 0; b < track->max_deps; b++) { track->dep_buckets[b] = TAR_NOENT; }
+    track->failed = 0;
+    index_relink(tar);
+    track->built_deps = track->no_deps;
+}
+
+static void track_free(tar_t *tar) {
+    index_track_t *track = tar->track;
+    if (track == NULL) { return; }
+    free(track->deps);
+    free(track->dep_buckets);
+    free(track->paths.ids);
+    free(track->entries.ids);
+    free(track->buckets.ids);
+    free(track);
+    tar->track = NULL;
+}
+
+/*
+ * The links whose target may have changed with the paths added or replaced since the last flush, resolved again:
+ * the links that looked up one of these paths, then the links that looked up the path of one of those, and so on.
+ * They are all reset before any is resolved, so that none follows the old target of another.
+ */
+static void index_relink_changed(tar_t *tar) {
+    index_track_t *track = tar->track;
+    id_list_t *paths = &track->paths;
+    char path[TAR_PATH_MAX];
+    for (uint32_t i = 0; i < paths->len && track->max_deps > 0 && !track->failed; i++) {
+        size_t len = entry_path(tar, paths->ids[i], path);
+        if (len > 0 && path[len - 1] == '/') { len--; }
+        uint32_t h = component_hash(path, len);
+        for (uint32_t d = track->dep_buckets[h & (track->max_deps - 1)]; d != TAR_NOENT; d = track->deps[d].next) {
+            tar_entry_t *link = &tar->entries[track->deps[d].link];
+            if (track->deps[d].hash != h || !IS_LINK(link->typeflag) || link->target == TAR_UNRESOLVED) { continue; }
+            link->target = TAR_UNRESOLVED;
+            if (id_list_add(paths, track->deps[d].link)) { track->failed = 1; }
+        }
+    }
+    if (track->failed) { return; }
+    for (uint32_t i = 0; i < paths->len; i++) {
+        uint32_t id = paths->ids[i];
+        if (!IS_LINK(tar->entries[id].typeflag)) { continue; }
+        int capped = 0;
+        if (tar->entries[id].target == TAR_UNRESOLVED) { index_resolve(tar, id, 0, &capped); }
+        track_entry(tar, id, 0);
+    }
+}
+
+/*
+ * The links of the handle resolved again after members were added, only the ones that may have changed when the
+ * writer tracks them. Returns 1 if the changes tracked are incomplete: the sidecar index has to be written whole.
+ */
+static int writer_relink(tar_t *tar) {
+    index_track_t *track = tar->track;
+    if (track == NULL) {
+        index_relink(tar);
+        return 1;
+    }
+    if (!track->failed) { index_relink_changed(tar); }
+    if (track->failed) {
+        track_rebuild(tar);
+        return 1;
+    }
+    // the deps left behind by the links resolved again outnumber the others
+    if (track->no_deps > 2 * track->built_deps + 4096) { track_rebuild(tar); }
+    return 0;
+}
+
+static int id_cmp(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// the ids of the list sorted, each once
+static void id_list_unique(id_list_t *list) {
+    if (list->len == 0) { return; }
+    qsort(list->ids, list->len, sizeof(uint32_t), id_cmp);
+    uint32_t len = 1;
+    for (uint32_t i = 1; i < list->len; i++) {
+        if (list->ids[i] != list->ids[len - 1]) { list->ids[len++] = list->ids[i]; }
+    }
+    list->len = len;
+}
+
+/*
+ * The changes tracked since the last flush appended as a delta to the sidecar index at idx_path.
+ * Returns 1 if the file is not the one the handle was loaded from or last wrote, or has no room left for the delta,
+ * -1 on a write error, 0 on success.
+ */
+static int index_append_delta(tar_t *tar, const char *idx_path) {
+    index_track_t *track = tar->track;
+    index_file_t *file = &tar->index_file;
+    struct stat st;
+    id_list_unique(&track->entries);
+    id_list_unique(&track->buckets);
+    size_t strings_added = tar->strings_len - file->strings_len;
+    size_t len = sizeof(tar_index_delta_t) + (sizeof(uint32_t) + sizeof(tar_entry_t)) * track->entries.len
+                 + 2 * sizeof(uint32_t) * track->buckets.len + strings_added;
+    if (file->size == 0 || track->rehashed || tar->no_buckets != file->no_buckets
+        || tar->no_entries > file->max_entries || tar->strings_len > file->strings_max || tar->strings_len < file->strings_len
+        || file->size - file->base_len + len > file->base_len // the deltas would outgrow the index they apply to
+        || stat(idx_path, &st) == -1 || st.st_dev != file->dev || st.st_ino != file->ino || (uint64_t) st.st_size != file->size) {
+        return 1;
+    }
+
+    tar_index_layer_t layer;
+    uint8_t *delta = malloc(len);
+    int fd = -1;
+    int err = delta == NULL || index_stat_layers(tar, &layer) || (fd = open(idx_path, O_WRONLY)) == -1;
+    if (!err) {
+        tar_index_delta_t record = {.len = len, .archive_size = layer.archive_size,
+                                    .archive_mtime_sec = layer.archive_mtime_sec, .archive_mtime_nsec = layer.archive_mtime_nsec,
+                                    .strings_len = tar->strings_len, .no_entries = tar->no_entries,
+                                    .no_changed = track->entries.len, .no_buckets = track->buckets.len};
+        memcpy(record.magic, TAR_DELTA_MAGIC, 8);
+        uint8_t *pos = delta;
+        memcpy(pos, &record, sizeof(record));
+        pos += sizeof(record);
+        memcpy(pos, track->entries.ids, sizeof(uint32_t) * track->entries.len);
+        pos += sizeof(uint32_t) * track->entries.len;
+        for (uint32_t i = 0; i < track->buckets.len; i++) {
+            uint32_t pair[2] = {track->buckets.ids[i], tar->buckets[track->buckets.ids[i]]};
+            memcpy(pos, pair, sizeof(pair));
+            pos += sizeof(pair);
+        }
+        for (uint32_t i = 0; i < track->entries.len; i++) {
+            memcpy(pos, &tar->entries[track->entries.ids[i]], sizeof(tar_entry_t));
+            pos += sizeof(tar_entry_t);
+        }
+        memcpy(pos, &tar->strings[file->strings_len], strings_added);
+        err = pwrite_full(fd, delta, len, file->size);
+    }
+    if (fd != -1) { close(fd); }
+    free(delta);
+    if (err) {
+        file->size = 0; // a partial delta makes the index invalid, the next flush writes it whole
+        return -1;
+    }
+    file->size += len;
+    file->no_entries = tar->no_entries;
+    file->strings_len = tar->strings_len;
+    return 0;
+}
+
+// the tracked changes are in the index, the next flush starts from there
+static void track_clear(tar_t *tar) {
+    if (tar->track == NULL) { return; }
+    tar->track->paths.len = tar->track->entries.len = tar->track->buckets.len = 0;
+    tar->track->rehashed = 0;
+}
+
+// the member of the header at header_offset, in the archive, added to the handle
+static int writer_index(tar_writer_t *writer, const char *header, uint64_t header_offset) {
+    tar_t *tar = writer->tar;
+    if (tar == NULL) { return 0; }
+    if (tar->map != NULL && writer->pos > tar->map_size) { // the mapping grows with the archive
+        void *map = mremap((void *) tar->map, tar->map_size, writer->pos, MREMAP_MAYMOVE);
+        if (map == MAP_FAILED) { return -1; }
+        tar->map = map;
+        tar->map_size = writer->pos;
+    }
+    free(tar->sorted); // the next query sorts the entries again
+    tar->sorted = NULL;
+    writer->added = 1;
+    return index_add(tar, header, header_offset);
+}
+
+// the buffer written to the archive, then the members it held indexed; -5 on error
+static int writer_drain(tar_writer_t *writer) {
+    if (writer->err) { return writer->err; }
+    if (writer->len > 0 && pwrite_full(writer->fd, writer->buffer, writer->len, writer->pos)) { return writer->err = -5; }
+    uint64_t start = writer->pos;
+    writer->pos += writer->len;
+    writer->len = 0;
+    for (uint32_t i = 0; i < writer->no_pending; i++) {
+        uint32_t off = writer->pending[i];
+        if (writer_index(writer, (const char *) &writer->buffer[off], start + off)) { return writer->err = -5; }
+    }
+    writer->no_pending = 0;
+    return 0;
+}
+
+// len bytes added after the buffer, written at once if they do not fit in it; -5 on error
+static int writer_put(tar_writer_t *writer, const void *data, size_t len) {
+    if (writer->len + len > TAR_WRITER_BUFFER && writer_drain(writer)) { return -5; }
+    if (len >= TAR_WRITER_BUFFER) {
+        if (pwrite_full(writer->fd, data, len, writer->pos)) { return writer->err = -5; }
+        writer->pos += len;
+        return 0;
+    }
+    memcpy(&writer->buffer[writer->len], data, len);
+    writer->len += len;
+    return 0;
+}
+
+// size bytes of the file at fd, from its start, to the archive at pos; the buffer is empty
+static int writer_copy(tar_writer_t *writer, int fd, uint64_t size) {
+    uint64_t done = 0;
+    while (done < size) {
+        loff_t in = done;
+        loff_t out = writer->pos + done;
+        ssize_t res = copy_file_range(fd, &in, writer->fd, &out, size - done, 0);
+        if (res == -1 && errno == EINTR) { continue; }
+        if (res == 0) { return -4; } // the file is shorter than it was
+        if (res == -1) { break; }
+        done += res;
+    }
+
+    // not supported between the two files: through the buffer
+    while (done < size) {
+        size_t len = size - done < TAR_WRITER_BUFFER ? size - done : TAR_WRITER_BUFFER;
+        if (pread_full(fd, writer->buffer, len, done) != (ssize_t) len) { return -4; }
+        if (pwrite_full(writer->fd, writer->buffer, len, writer->pos + done)) { return writer->err = -5; }
+        done += len;
+    }
+    return 0;
+}
+
+// a ustar header for the member at path, the path split between the prefix and the name if it is longer than
+// 100 bytes; -1 if the path or the link target do not fit
+static int writer_header(char *header, const char *path, char typeflag, const char *linkname, const struct stat *st) {
+    size_t len = strlen(path);
+    size_t link_len = linkname != NULL ? strlen(linkname) : 0;
+    size_t split = 0; // the length of the prefix, the '/' after it is not stored
+    if (len == 0 || link_len > 100) { return -1; }
+    if (len > 100) {
+        for (split = len > 101 ? len - 101 : 1; split <= 155 && split + 1 < len && path[split] != '/'; split++) {}
+        if (split > 155 || split + 1 >= len) { return -1; }
+    }
+    uint64_t size = st->st_size;
+    memset(header, 0, 512);
+    memcpy(header, split ? &path[split + 1] : path, split ? len - split - 1 : len);
+    snprintf(&header[100], 8, "%07o", (unsigned int) st->st_mode & 07777);
+    snprintf(&header[108], 8, "%07o", st->st_uid <= 07777777 ? (unsigned int) st->st_uid : 0);
+    snprintf(&header[116], 8, "%07o", st->st_gid <= 07777777 ? (unsigned int) st->st_gid : 0);
+    if (size <= 077777777777ULL) {
+        snprintf(&header[124], 12, "%011llo", (unsigned long long) size);
+    } else { // GNU base-256, read back by numeric_field()
+        header[124] = (char) 0x80;
+        for (int i = 11; i > 0; i--, size >>= 8) { header[124 + i] = (char) (size & 0xff); }
+    }
+    int64_t mtime = st->st_mtim.tv_sec;
+    snprintf(&header[136], 12, "%011llo", mtime >= 0 && mtime <= 077777777777LL ? (unsigned long long) mtime : 0);
+    header[156] = typeflag;
+    memcpy(&header[157], linkname != NULL ? linkname : "", link_len);
+    memcpy(&header[257], TMAGIC, TMAGLEN);
+    memcpy(&header[263], TVERSION, TVERSLEN);
+    memcpy(&header[345], path, split);
+    header_checksum(header);
+    return 0;
+}
+
+/*
+ * The member of the header, its content from data or else from the file at fd. A member whose header and content fit
+ * in the buffer is indexed once the buffer is written; a larger one has its header written, then its content straight
+ * to the archive, and is indexed then. A member whose content could not be copied is dropped.
+ */
+static int writer_member(tar_writer_t *writer, const char *header, const void *data, int fd, uint64_t size) {
+    static const uint8_t zeros[512];
+    size_t pad = (512 - size % 512) % 512;
+    if (writer->err) { return writer->err; }
+    writer->ended = 0;
+    if (data != NULL || size == 0) {
+        if (writer->len + 512 + size + pad <= TAR_WRITER_BUFFER) {
+            writer->pending[writer->no_pending++] = writer->len;
+            writer_put(writer, header, 512);
+            if (size > 0) { writer_put(writer, data, size); }
+            return writer_put(writer, zeros, pad);
+        }
+    }
+    if (writer_put(writer, header, 512) || writer_drain(writer)) { return -5; }
+    uint64_t header_offset = writer->pos - 512;
+    int err = 0;
+    if (data != NULL) {
+        err = pwrite_full(writer->fd, data, size, writer->pos) ? writer->err = -5 : 0;
+    } else {
+        err = writer_copy(writer, fd, size);
+    }
+    if (err) {
+        if (!writer->err) { writer->pos = header_offset; } // the next member goes over this one
+        return err;
+    }
+    writer->pos += size;
+    if (writer_index(writer, header, header_offset)) { return writer->err = -5; }
+    return writer_put(writer, zeros, pad);
+}
+
+/**
+ * Opens a writer on an archive, to create it or to append members to it.
+ * Without TAR_WRITER_APPEND the file is emptied first. With it, the members are added after the last one of the
+ * archive, over its end-of-archive blocks and over the index written by tar_relayout(), which is stale from then on.
+ * The writer is the only one to use the handle and the archive until tar_writer_close().
+ *
+ * @param tar_fd A file descriptor on the archive, opened for writing. Its offset is not moved.
+ * @param tar A handle on the same archive, updated as the members are written, or NULL.
+ *            Without TAR_WRITER_APPEND its archive must be empty. It may not be compressed nor an overlay.
+ * @param idx_path The sidecar index of the archive, written again from the handle by each flush, or NULL.
+ *                 Only used with a handle.
+ * @param flags Zero or TAR_WRITER_APPEND.
+ *
+ * @return a writer, NULL on error.
+ */
+tar_writer_t *tar_writer_open(int tar_fd, tar_t *tar, const char *idx_path, int flags) {
+    STAT_CALL(TAR_OP_WRITER_OPEN);
+    struct stat st, tar_st;
+    uint64_t end = 0;
+    if (fstat(tar_fd, &st) == -1 || zsrc_format(tar_fd) != TAR_Z_NONE) { return NULL; }
+    if (tar != NULL) {
+        // a member past a read error would be written over
+        if (index_scan_all(tar) || fstat(tar->fd, &tar_st) == -1 || tar_st.st_dev != st.st_dev || tar_st.st_ino != st.st_ino
+            || tar->z != NULL || tar->layers != NULL || (!(flags & TAR_WRITER_APPEND) && tar->no_entries > 1)
+            || index_unmap(tar)) {
+            return NULL;
+        }
+        end = writer_index_end(tar);
+    } else if ((flags & TAR_WRITER_APPEND) && writer_end(tar_fd, &end)) {
+        return NULL;
+    }
+    if (!(flags & TAR_WRITER_APPEND) && ftruncate(tar_fd, 0) == -1) { return NULL; }
+
+    tar_writer_t *writer = calloc(1, sizeof(tar_writer_t));
+    if (writer == NULL) { return NULL; }
+    writer->fd = tar_fd;
+    writer->tar = tar;
+    writer->pos = end;
+    writer->buffer = malloc(TAR_WRITER_BUFFER);
+    writer->idx_path = idx_path != NULL && tar != NULL ? strdup(idx_path) : NULL;
+    if (writer->buffer == NULL || (idx_path != NULL && tar != NULL && writer->idx_path == NULL)) {
+        free(writer->buffer);
+        free(writer);
+        return NULL;
+    }
+    if (tar != NULL) { track_start(tar); }
+    return writer;
+}
+
+// the metadata of a member added without a file: now, by the user running the writer
+static void writer_stat(struct stat *st, mode_t mode, uint64_t size) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = mode;
+    st->st_size = size;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_mtim.tv_sec = time(NULL);
+}
+
+/**
+ * Adds a regular file to the archive, its content copied from a buffer.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ * @param path The path of the file in the archive, up to 256 bytes, split in a ustar prefix and name if needed.
+ * @param data The content of the file, len bytes.
+ * @param len The size of the file.
+ *
+ * @return zero on success,
+ *         -1 if the path does not fit in a ustar header,
+ *         -5 if the archive could not be written, the writer can only be closed then.
+ */
+int tar_writer_add(tar_writer_t *writer, const char *path, const void *data, size_t len) {
+    STAT_CALL(TAR_OP_WRITER_ADD);
+    char header[512];
+    struct stat st;
+    writer_stat(&st, 0644, len);
+    if (writer_header(header, path, REGTYPE, NULL, &st)) { return -1; }
+    return writer_member(writer, header, len > 0 ? data : NULL, -1, len);
+}
+
+/**
+ * Adds a regular file to the archive, its content copied from a file with copy_file_range(), or through a buffer
+ * if the file systems do not support it. Its mode, owner and mtime are those of the file.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ * @param path The path of the file in the archive, up to 256 bytes, split in a ustar prefix and name if needed.
+ * @param fd A file descriptor on a regular file, read from its start whatever its offset. Its offset is not moved.
+ *
+ * @return the same values as tar_writer_add(),
+ *         -4 if the file could not be read, the member is not added.
+ */
+int tar_writer_add_fd(tar_writer_t *writer, const char *path, int fd) {
+    STAT_CALL(TAR_OP_WRITER_ADD);
+    char header[512];
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) { return -4; }
+    if (writer_header(header, path, REGTYPE, NULL, &st)) { return -1; }
+    return writer_member(writer, header, NULL, fd, st.st_size);
+}
+
+/**
+ * Adds a member without content to the archive: a directory, a symlink or a hard link.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ * @param path The path of the member in the archive, up to 256 bytes, split in a ustar prefix and name if needed.
+ * @param typeflag DIRTYPE, SYMTYPE or LNKTYPE.
+ * @param linkname The target of a link, up to 100 bytes, NULL for a directory.
+ *
+ * @return the same values as tar_writer_add(), -1 also for another typeflag or a missing or too long link target.
+ */
+int tar_writer_add_entry(tar_writer_t *writer, const char *path, char typeflag, const char *linkname) {
+    STAT_CALL(TAR_OP_WRITER_ADD);
+    char header[512];
+    struct stat st;
+    if ((typeflag != DIRTYPE && typeflag != SYMTYPE && typeflag != LNKTYPE) || (IS_LINK(typeflag) != (linkname != NULL))) {
+        return -1;
+    }
+    writer_stat(&st, typeflag == DIRTYPE ? 0755 : typeflag == SYMTYPE ? 0777 : 0644, 0);
+    if (writer_header(header, path, typeflag, linkname, &st)) { return -1; }
+    return writer_member(writer, header, NULL, -1, 0);
+}
+
+/**
+ * Writes the members buffered and the end-of-archive blocks after them: the archive is then complete and valid.
+ * Nothing is written if nothing was added since the last flush, so that the sidecar index stays fresh.
+ * The links of the handle that may resolve differently with the members added are resolved again, and the sidecar
+ * index gets a delta appended with the entries changed, or is written whole when it has no room left for them.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ *
+ * @return zero on success, -5 if the archive or its index could not be written.
+ */
+int tar_writer_flush(tar_writer_t *writer) {
+    STAT_CALL(TAR_OP_WRITER_FLUSH);
+    static const uint8_t zeros[1024];
+    struct stat st;
+    if (!writer->ended
+        && (writer_drain(writer) || pwrite_full(writer->fd, zeros, sizeof(zeros), writer->pos)
+            || fstat(writer->fd, &st) == -1
+            || ((uint64_t) st.st_size > writer->pos + sizeof(zeros) && ftruncate(writer->fd, writer->pos + sizeof(zeros))))) {
+        return writer->err = -5;
+    }
+    writer->ended = 1;
+    if (writer->tar != NULL && writer->added) {
+        tar_t *tar = writer->tar;
+        int whole = writer_relink(tar);
+        if (writer->idx_path != NULL) {
+            int res = whole ? 1 : index_append_delta(tar, writer->idx_path);
+            if (res == 1) { res = index_save(tar, writer->idx_path, 1); }
+            if (res) { return -5; } // the changes stay tracked for the next flush
+        }
+        track_clear(tar);
+    }
+    writer->added = 0;
+    return 0;
+}
+
+/**
+ * Flushes the writer then releases it. The file descriptor and the handle are not closed.
+ *
+ * @param writer A writer returned by tar_writer_open(), may be NULL.
+ *
+ * @return the same values as tar_writer_flush().
+ */
+int tar_writer_close(tar_writer_t *writer) {
+    if (writer == NULL) { return 0; }
+    int ret = tar_writer_flush(writer);
+    if (writer->tar != NULL) {
+        track_free(writer->tar);
+        index_done(writer->tar);
+    }
+    free(writer->idx_path);
+    free(writer->buffer);
+    free(writer);
+    return ret;
+}
+
+
+/* ========== ASYNC READ ENGINE ========== */
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#define TAR_AIO_WORKERS 8
 
-            if (offset >= size) {reset(tar_fd); *len = 0; return -2;}
-            out = *len < size ? size - (*len + offset) : 0;
-            out = out < 1 ? 0 : out;
+typedef struct aio_slot {
+    tar_aio_req_t *req;
+    uint64_t start;     // offset of the read in the archive
+    uint64_t remaining; // bytes of the file after the read, if it is entire
+    struct iovec iov;
+    uint32_t next_free;
+} aio_slot_t;
 
-            *len  = offset + *len > size ? size - offset : *len;
-            lseek(tar_fd, (off_t) offset, SEEK_CUR); // start at the offset
-            *len = read(tar_fd, dest, *len); // put bytes in dest
+struct tar_aio {
+    tar_t *tar;
+    int backend;
+    unsigned depth;
+    unsigned inflight;          // submitted and not returned by tar_aio_complete() yet
+    aio_slot_t *slots;
+    uint32_t free_slot;
+    tar_aio_req_t **done;       // completed requests, a ring of depth entries
+    unsigned done_head;
+    unsigned no_done;
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;
 
-            reset(tar_fd);
-            return out;
+    // TAR_AIO_URING
+    int ring_fd;
+    uint8_t *sq_ring;
+    size_t sq_ring_size;
+    uint8_t *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;         // queued in the submission ring, not given to the kernel yet
+    unsigned in_kernel;
+
+    // TAR_AIO_THREADS
+    pthread_t workers[TAR_AIO_WORKERS];
+    int no_workers;
+    uint32_t *queue;            // slots waiting for a worker, a ring of depth entries
+    unsigned queue_head;
+    unsigned no_queued;
+    int stop;
+    pthread_cond_t work_cond;
+};
+
+// the request is completed, it will be returned by tar_aio_complete(), with the lock held
+static void aio_done(tar_aio_t *aio, tar_aio_req_t *req) {
+    aio->done[(aio->done_head + aio->no_done) % aio->depth] = req;
+    aio->no_done++;
+    pthread_cond_signal(&aio->done_cond);
+}
+
+// the read of the slot returned res (bytes read or -1), fill its request and free the slot, with the lock held
+static void aio_finish(tar_aio_t *aio, uint32_t id, ssize_t res) {
+    aio_slot_t *slot = &aio->slots[id];
+    tar_aio_req_t *req = slot->req;
+    if (res < 0) {
+        req->len = 0;
+        req->status = -3; // error on reading
+    } else {
+        req->status = slot->remaining + (req->len - res);
+        req->len = res;
+    }
+    slot->next_free = aio->free_slot;
+    aio->free_slot = id;
+    aio_done(aio, req);
+}
+
+static void *aio_worker(void *ptr) {
+    tar_aio_t *aio = ptr;
+    pthread_mutex_lock(&aio->lock);
+    while (1) {
+        while (aio->no_queued == 0 && !aio->stop) { pthread_cond_wait(&aio->work_cond, &aio->lock); }
+        if (aio->stop) { break; }
+        uint32_t id = aio->queue[aio->queue_head];
+        aio->queue_head = (aio->queue_head + 1) % aio->depth;
+        aio->no_queued--;
+        pthread_mutex_unlock(&aio->lock);
+
+        aio_slot_t *slot = &aio->slots[id];
+        ssize_t res = archive_pread(aio->tar, slot->iov.iov_base, slot->iov.iov_len, slot->start);
+
+        pthread_mutex_lock(&aio->lock);
+        aio_finish(aio, id, res);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+static int uring_setup(tar_aio_t *aio) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    aio->ring_fd = syscall(__NR_io_uring_setup, aio->depth, &params);
+    if (aio->ring_fd < 0) { return -1; }
+
+    aio->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aio->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_ring_size > aio->sq_ring_size) { aio->sq_ring_size = aio->cq_ring_size; }
+        aio->cq_ring_size = 0;
+    }
+    aio->sq_ring = mmap(NULL, aio->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQ_RING);
+    if (aio->sq_ring == MAP_FAILED) { aio->sq_ring = NULL; return -1; }
+    aio->cq_ring = aio->sq_ring;
+    if (aio->cq_ring_size > 0) {
+        aio->cq_ring = mmap(NULL, aio->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_CQ_RING);
+        if (aio->cq_ring == MAP_FAILED) { aio->cq_ring = NULL; return -1; }
+    }
+    aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->ring_fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) { aio->sqes = NULL; return -1; }
+
+    aio->sq_tail = (unsigned *) &aio->sq_ring[params.sq_off.tail];
+    aio->sq_mask = *(unsigned *) &aio->sq_ring[params.sq_off.ring_mask];
+    aio->sq_array = (unsigned *) &aio->sq_ring[params.sq_off.array];
+    aio->cq_head = (unsigned *) &aio->cq_ring[params.cq_off.head];
+    aio->cq_tail = (unsigned *) &aio->cq_ring[params.cq_off.tail];
+    aio->cq_mask = *(unsigned *) &aio->cq_ring[params.cq_off.ring_mask];
+    aio->cqes = (struct io_uring_cqe *) &aio->cq_ring[params.cq_off.cqes];
+    return 0;
+}
+
+static void uring_free(tar_aio_t *aio) {
+    if (aio->sqes != NULL) { munmap(aio->sqes, aio->sqes_size); }
+    if (aio->cq_ring != NULL && aio->cq_ring != aio->sq_ring) { munmap(aio->cq_ring, aio->cq_ring_size); }
+    if (aio->sq_ring != NULL) { munmap(aio->sq_ring, aio->sq_ring_size); }
+    if (aio->ring_fd >= 0) { close(aio->ring_fd); }
+}
+
+static void uring_queue(tar_aio_t *aio, uint32_t id) {
+    unsigned tail = *aio->sq_tail;
+    unsigned index = tail & aio->sq_mask;
+    struct io_uring_sqe *sqe = &aio->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV; // READV rather than READ, supported since the first io_uring kernels
+    sqe->fd = aio->tar->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &aio->slots[id].iov;
+    sqe->len = 1;
+    sqe->off = aio->slots[id].start;
+    sqe->user_data = id;
+    aio->sq_array[index] = index;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    aio->to_submit++;
+}
+
+// give the queued reads to the kernel, wait for min_complete of them, and reap the completions
+static int uring_enter(tar_aio_t *aio, unsigned min_complete) {
+    while (aio->to_submit > 0 || min_complete > 0) {
+        int res = syscall(__NR_io_uring_enter, aio->ring_fd, aio->to_submit, min_complete,
+                          min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (res < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) { return -1; }
+        if (res > 0) {
+            aio->to_submit -= res;
+            aio->in_kernel += res;
+        }
+
+        unsigned head = *aio->cq_head;
+        unsigned tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &aio->cqes[head & aio->cq_mask];
+            STAT_ADD(read_calls, 1);
+            if (cqe->res > 0) { STAT_ADD(bytes_read, cqe->res); }
+            aio_finish(aio, cqe->user_data, cqe->res < 0 ? -1 : cqe->res);
+            aio->in_kernel--;
+            min_complete = min_complete > 0 ? min_complete - 1 : 0;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+        if (res >= 0 && aio->to_submit == 0 && min_complete == 0) { break; }
+    }
+    return 0;
+}
+#else
+static int uring_setup(tar_aio_t *aio) { return -1; }
+static void uring_free(tar_aio_t *aio) {}
+static void uring_queue(tar_aio_t *aio, uint32_t id) {}
+static int uring_enter(tar_aio_t *aio, unsigned min_complete) { return -1; }
+#endif
+
+/**
+ * Creates an asynchronous read engine on a handle, backed by io_uring, or by a pool of threads
+ * when io_uring is not available.
+ *
+ * @param tar A handle on the archive, it must stay open until tar_aio_destroy().
+ * @param depth The maximum number of requests submitted and not yet returned by tar_aio_complete().
+ * @param flags Zero, or TAR_AIO_THREADS to use the pool of threads even if io_uring is available.
+ *
+ * @return an engine, NULL on error.
+ */
+tar_aio_t *tar_aio_create(tar_t *tar, unsigned depth, int flags) {
+    if (depth == 0) { return NULL; }
+    tar_aio_t *aio = calloc(1, sizeof(tar_aio_t));
+    if (aio == NULL) { return NULL; }
+    aio->tar = tar;
+    aio->depth = depth;
+    aio->ring_fd = -1;
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->done_cond, NULL);
+    pthread_cond_init(&aio->work_cond, NULL);
+    aio->slots = malloc(sizeof(aio_slot_t) * depth);
+    aio->done = malloc(sizeof(tar_aio_req_t *) * depth);
+    aio->queue = malloc(sizeof(uint32_t) * depth);
+    if (aio->slots == NULL || aio->done == NULL || aio->queue == NULL) { tar_aio_destroy(aio); return NULL; }
+    for (uint32_t i = 0; i < depth; i++) { aio->slots[i].next_free = i + 1 < depth ? i + 1 : TAR_NOENT; }
+
+    aio->backend = TAR_AIO_URING;
+    // the kernel cannot decompress: the workers of the pool do it for a compressed archive
+    if ((flags & TAR_AIO_THREADS) || tar->z != NULL || tar->layers != NULL || uring_setup(aio)) {
+        uring_free(aio);
+        aio->ring_fd = -1;
+        aio->sq_ring = aio->cq_ring = NULL;
+        aio->sqes = NULL;
+        aio->backend = TAR_AIO_THREADS;
+        int no_workers = depth < TAR_AIO_WORKERS ? depth : TAR_AIO_WORKERS;
+        for (; aio->no_workers < no_workers; aio->no_workers++) {
+            if (pthread_create(&aio->workers[aio->no_workers], NULL, aio_worker, aio)) { break; }
         }
-        blocks_skip = ceilC(size / 512.);
-        lseek(tar_fd, (off_t) blocks_skip * 512, SEEK_CUR);
+        if (aio->no_workers == 0) { tar_aio_destroy(aio); return NULL; }
+    }
+    return aio;
+}
+
+/**
+ * Destroys the engine, after waiting for the reads in progress. The handle is not closed.
+ *
+ * @param aio An engine returned by tar_aio_create(), may be NULL.
+ */
+void tar_aio_destroy(tar_aio_t *aio) {
+    if (aio == NULL) { return; }
+    if (aio->backend == TAR_AIO_URING) {
+        if (aio->in_kernel > 0) { uring_enter(aio, aio->in_kernel); }
+        uring_free(aio);
+    }
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = 1;
+    pthread_cond_broadcast(&aio->work_cond);
+    pthread_mutex_unlock(&aio->lock);
+    for (int i = 0; i < aio->no_workers; i++) { pthread_join(aio->workers[i], NULL); }
+    pthread_cond_destroy(&aio->work_cond);
+    pthread_cond_destroy(&aio->done_cond);
+    pthread_mutex_destroy(&aio->lock);
+    free(aio->slots);
+    free(aio->done);
+    free(aio->queue);
+    free(aio);
+}
+
+/**
+ * Returns the backend of the engine, TAR_AIO_URING or TAR_AIO_THREADS.
+ */
+int tar_aio_backend(tar_aio_t *aio) {
+    return aio->backend;
+}
+
+/**
+ * Submits a read, without blocking: the path is resolved in the index of the handle and the read is queued.
+ * A request that fails to resolve, or that is served from a mapping or an overlay, is completed at once.
+ *
+ * @param aio An engine.
+ * @param req A request, path, offset, dest and len are the arguments of read_file().
+ *            It must stay valid until it is returned by tar_aio_complete(), with len and status set as by read_file().
+ *
+ * @return zero if the request was submitted, -1 if `depth` requests are already in progress.
+ */
+int tar_aio_submit(tar_aio_t *aio, tar_aio_req_t *req) {
+    STAT_CALL(TAR_OP_AIO_SUBMIT);
+    tar_t *tar = aio->tar;
+    pthread_mutex_lock(&aio->lock);
+    if (aio->inflight == aio->depth) { pthread_mutex_unlock(&aio->lock); return -1; }
+    aio->inflight++;
+
+    tar_entry_t *entry = index_follow(tar, index_find(tar, req->path));
+    if (tar->lazy_err || entry == NULL || (entry->typeflag != REGTYPE && entry->typeflag != AREGTYPE)) {
+        req->len = 0;
+        req->status = tar->lazy_err ? -3 : -1;
+        aio_done(aio, req);
+        pthread_mutex_unlock(&aio->lock);
+        return 0;
+    }
+    if (req->offset >= entry->size) {
+        req->len = 0;
+        req->status = -2;
+        aio_done(aio, req);
+        pthread_mutex_unlock(&aio->lock);
+        return 0;
+    }
+    req->len = entry->size - req->offset < req->len ? entry->size - req->offset : req->len;
+    if (tar->map != NULL || tar->layers != NULL || req->len == 0) { // an overlay reads from several archives
+        pthread_mutex_unlock(&aio->lock);
+        req->status = tar_read_file(tar, req->path, req->offset, req->dest, &req->len);
+        pthread_mutex_lock(&aio->lock);
+        aio_done(aio, req);
+        pthread_mutex_unlock(&aio->lock);
+        return 0;
+    }
+
+    uint32_t id = aio->free_slot;
+    aio_slot_t *slot = &aio->slots[id];
+    aio->free_slot = slot->next_free;
+    slot->req = req;
+    slot->start = DATA_OFFSET(entry) + req->offset;
+    slot->remaining = entry->size - req->offset - req->len;
+    slot->iov.iov_base = req->dest;
+    slot->iov.iov_len = req->len;
+    if (aio->backend == TAR_AIO_URING) {
+        uring_queue(aio, id);
+    } else {
+        aio->queue[(aio->queue_head + aio->no_queued) % aio->depth] = id;
+        aio->no_queued++;
+        pthread_cond_signal(&aio->work_cond);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return 0;
+}
+
+/**
+ * Returns completed requests, waiting for some if needed. The queued reads are given to the kernel here.
+ *
+ * @param aio An engine.
+ * @param reqs An array receiving the completed requests.
+ * @param max The size of `reqs`.
+ * @param min_wait Wait until at least that many requests are completed (bounded by the requests in progress),
+ *                 zero to only poll.
+ *
+ * @return the number of requests put in `reqs`, -1 on error.
+ */
+int tar_aio_complete(tar_aio_t *aio, tar_aio_req_t **reqs, unsigned max, unsigned min_wait) {
+    STAT_CALL(TAR_OP_AIO_COMPLETE);
+    if (min_wait > max) { min_wait = max; }
+    pthread_mutex_lock(&aio->lock);
+    if (min_wait > aio->inflight) { min_wait = aio->inflight; }
+    if (aio->backend == TAR_AIO_URING) {
+        unsigned missing = min_wait > aio->no_done ? min_wait - aio->no_done : 0;
+        if (missing > aio->in_kernel + aio->to_submit) { missing = aio->in_kernel + aio->to_submit; }
+        if (uring_enter(aio, missing)) { pthread_mutex_unlock(&aio->lock); return -1; }
+    } else {
+        while (aio->no_done < min_wait) { pthread_cond_wait(&aio->done_cond, &aio->lock); }
+    }
+
+    unsigned n = 0;
+    for (; n < max && aio->no_done > 0; n++) {
+        reqs[n] = aio->done[aio->done_head];
+        aio->done_head = (aio->done_head + 1) % aio->depth;
+        aio->no_done--;
     }
+    aio->inflight -= n;
+    pthread_mutex_unlock(&aio->lock);
+    return n;
 }
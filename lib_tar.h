@@ -37,6 +37,11 @@ typedef struct posix_header
 #define LNKTYPE  '1'            /* link */
 #define SYMTYPE  '2'            /* reserved */
 #define DIRTYPE  '5'            /* directory */
+#define XHDTYPE  'x'            /* pax extended header of the next member */
+#define XGLTYPE  'g'            /* pax global header */
+
+/* Size of a buffer holding any entry path: a ustar prefix, its '/', a name and the '\0' */
+#define TAR_PATH_MAX 257
 
 /* Converts an ASCII-encoded octal-based number into a regular integer */
 #define TAR_INT(char_ptr) strtol(char_ptr, NULL, 8)
@@ -58,6 +63,83 @@ typedef struct posix_header
  */
 int check_archive(int tar_fd);
 
+/**
+ * Checks the magic, version and checksum of many headers in one call.
+ * The checksum is computed with SSE2 or AVX2 when the CPU supports it.
+ *
+ * @param headers An array of pointers to 512 bytes headers.
+ * @param no_headers The number of headers in `headers`.
+ * @param bad Set to the index of the first invalid header, if any. May be NULL.
+ *
+ * @return zero if every header is valid, otherwise the error of the first invalid header:
+ *         -1 for an invalid magic value, -2 for an invalid version value, -3 for an invalid checksum value.
+ */
+int tar_check_headers(const char *const *headers, size_t no_headers, size_t *bad);
+
+/**
+ * Calls callback on every header of the archive, in order.
+ * The archive is read in chunks of 1 MiB with pread(): the offset of tar_fd is not moved.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a tar archive file.
+ * @param callback Called with each header, its offset in the archive and arg. The header is only valid during the call.
+ *                 It returns zero to go on with the next header, any positive value stops the scan.
+ * @param arg Passed to callback.
+ *
+ * @return zero once every header has been visited,
+ *         the value returned by callback if it stopped the scan,
+ *         -4 if the archive could not be read.
+ */
+int tar_foreach_header(int tar_fd, int (*callback)(const tar_header_t *header, uint64_t offset, void *arg), void *arg);
+
+typedef struct tar_lookup {
+    int found;                  // zero if no entry at the path exists in the archive
+    char typeflag;              // one of REGTYPE, AREGTYPE, LNKTYPE, SYMTYPE, DIRTYPE...
+    uint64_t size;              // size of the content of the entry
+    uint64_t data_offset;       // offset of the content of the entry in the archive
+    char linkname[101];         // target of a link
+} tar_lookup_t;
+
+#define TAR_LOOKUP_FIRST 0x1    /* answer each path from its first member, and return once they are all found */
+
+/**
+ * Looks many paths up in a single pass over the headers of the archive.
+ * By default every header is read: a path added again later replaces the member before, as tar extracts them.
+ * With TAR_LOOKUP_FIRST, each path is answered from its first member instead, and the pass stops as soon as every
+ * path is found: enough to check that a manifest is in the archive, unless it holds members added again later.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file. Its offset is not moved.
+ * @param paths An array of paths to entries in the archive, a path may be given more than once.
+ * @param no_paths The number of paths in `paths`.
+ * @param results An array of no_paths results, results[i] is filled for paths[i] from the last header named paths[i],
+ *                or from the first one with TAR_LOOKUP_FIRST.
+ * @param flags Zero or TAR_LOOKUP_FIRST.
+ *
+ * @return the number of paths found in the archive, -4 if the archive could not be read.
+ */
+int tar_lookup_batch(int tar_fd, char **paths, size_t no_paths, tar_lookup_t *results, int flags);
+
+typedef struct tar_read_req {
+    char *path;                 // the arguments of read_file()
+    size_t offset;
+    uint8_t *dest;
+    size_t len;                 // in-out, as for read_file()
+    ssize_t status;             // set to the value read_file() would return
+} tar_read_req_t;
+
+/**
+ * Reads many files of the archive in one call: the paths are resolved in one pass over the headers,
+ * then the reads are sorted by offset in the archive and close ranges are merged into a few preadv().
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file. Its offset is not moved.
+ * @param reqs An array of requests, each one is filled like a call to read_file():
+ *             path, offset and dest are the arguments of read_file(), len is the in-out argument,
+ *             status is set to the value read_file() would return.
+ * @param no_reqs The number of requests in `reqs`.
+ *
+ * @return zero on success, -4 if the headers of the archive could not be read.
+ */
+int tar_read_batch(int tar_fd, tar_read_req_t *reqs, size_t no_reqs);
+
 unsigned long hash(char *str);
 int ceilC(double val);
 void reset(int tar_fd);
@@ -111,6 +193,8 @@ int is_symlink(int tar_fd, char *path);
 /**
  * Lists the entries at a given path in the archive.
  * list() does not recurse into the directories listed at the given path.
+ * The headers are read once, without building an index; if the directory is a link, or its entries are filed in
+ * ways a single scan cannot follow, a handle is built then dropped, which costs a tar_open() of the whole archive.
  *
  * Example:
  *  dir/          list(..., "dir/", ...) lists "dir/a", "dir/b", "dir/c/" and "dir/e/"
@@ -122,18 +206,21 @@ int is_symlink(int tar_fd, char *path);
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
  * @param path A path to an entry in the archive. If the entry is a symlink, it must be resolved to its linked-to entry.
- * @param entries An array of char arrays, each one is long enough to contain a tar entry path.
+ * @param entries An array of char arrays of TAR_PATH_MAX bytes each, they receive the whole paths of the entries.
  * @param no_entries An in-out argument.
  *                   The caller set it to the number of entries in `entries`.
  *                   The callee set it to the number of entries listed.
  *
  * @return zero if no directory at the given path exists in the archive,
- *         any other value otherwise.
+ *         any other value otherwise, for an existing but empty directory too.
  */
 int list(int tar_fd, char *path, char **entries, size_t *no_entries);
 
 /**
  * Reads a file at a given path in the archive.
+ * The headers are read once, then once more for each link followed. Reading from a compressed archive builds a
+ * handle then drops it, which costs a tar_open() of the whole archive: use tar_open() and tar_read_file() to read
+ * many files.
  *
  * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
  * @param path A path to an entry in the archive to read from.  If the entry is a symlink, it must be resolved to its linked-to entry.
@@ -145,6 +232,7 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  *
  * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
  *         -2 if the offset is outside the file total length,
+ *         -3 if the archive could not be read, `len` is then set to 0,
  *         zero if the file was read in its entirety into the destination buffer,
  *         a positive value if the file was partially read, representing the remaining bytes left to be read to reach
  *         the end of the file.
@@ -152,4 +240,574 @@ int list(int tar_fd, char *path, char **entries, size_t *no_entries);
  */
 ssize_t read_file(int tar_fd, char *path, size_t offset, uint8_t *dest, size_t *len);
 
+/* ========== ARCHIVE HANDLE ==========
+ * A handle reads every header of the archive once and keeps an index of the entries in memory.
+ * The tar_* functions below behave like their fd-based counterpart but never read a header again.
+ * All the reads of a handle are pread() at explicit offsets: the offset of the file descriptor
+ * is never used nor moved, and the tar_* functions can be called by many threads at the same time.
+ */
+typedef struct tar_archive tar_t;
+
+/* Flags of tar_open() */
+#define TAR_MMAP       0x1      /* map the archive in memory, headers and files are read in place */
+#define TAR_SEQUENTIAL 0x2      /* with TAR_MMAP, the archive will be read sequentially */
+#define TAR_RANDOM     0x4      /* with TAR_MMAP, the archive will be read at random offsets */
+#define TAR_LAZY       0x8      /* index the headers as the lookups reach them, see tar_open() */
+
+/**
+ * Opens an archive handle, reading every header of the archive once.
+ * The handle only reads with pread() and never moves the offset of tar_fd,
+ * so it can be shared by several threads once opened.
+ * Every symlink and hard link is resolved to its final entry while opening,
+ * a broken, cyclic or longer than 16 hops chain of links reads as a missing entry.
+ * The path of a member is its name, after its ustar prefix and a '/' if it has one.
+ * A gzip archive (or zstd, built with ZSTD=1) is decompressed once while opening, recording checkpoints,
+ * then each read only decompresses from the checkpoint before it, or goes on from the previous read of the thread
+ * when no checkpoint lies in between. TAR_MMAP has no effect on such an archive.
+ *
+ * With TAR_LAZY, nothing is read when opening: a lookup first tries the headers already indexed, then goes on
+ * scanning from where the previous one stopped, indexing every header it passes, until it finds its path.
+ * All the lookups together never read the headers more than once. tar_list(), tar_list_page(), the queries and
+ * tar_index_write() index every header left first. A lazy handle answers from the first member of a path until
+ * the scan reaches a later one of the same name, and must not be used by several threads at the same time.
+ * Once the scan fails to read a header or to index it, every lookup fails instead of reporting a missing entry:
+ * tar_exists(), tar_is_*(), the listings and the queries return -4, the reads -3, tar_index_write() -1, and
+ * tar_writer_open() NULL.
+ * TAR_LAZY has no effect on a compressed archive.
+ *
+ * An archive written by tar_relayout() ends with its index: it is mapped instead, and no header is read.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ *               It must stay open until tar_close() is called.
+ * @param flags Zero or more of TAR_MMAP, TAR_SEQUENTIAL, TAR_RANDOM and TAR_LAZY.
+ *
+ * @return a handle on the archive, NULL on error.
+ */
+tar_t *tar_open(int tar_fd, int flags);
+
+/**
+ * Releases an archive handle. The file descriptor is not closed.
+ *
+ * @param tar A handle returned by tar_open(), may be NULL.
+ */
+void tar_close(tar_t *tar);
+
+/**
+ * Same as check_archive(), on the headers of the handle.
+ * With TAR_MMAP, the headers are checked in place in the mapping.
+ */
+int tar_check(tar_t *tar);
+
+int tar_exists(tar_t *tar, char *path);
+int tar_is_dir(tar_t *tar, char *path);
+int tar_is_file(tar_t *tar, char *path);
+int tar_is_symlink(tar_t *tar, char *path);
+
+/**
+ * Same as list(), answered from the directory tree of the handle.
+ */
+int tar_list(tar_t *tar, char *path, char **entries, size_t *no_entries);
+
+/* Cursor of tar_list_page() */
+typedef uint32_t tar_cursor_t;
+#define TAR_CURSOR_START 0
+#define TAR_CURSOR_END   UINT32_MAX
+
+/**
+ * Lists the entries at a given path in the archive, one page at a time.
+ * Each call costs O(no_entries), whatever the size of the directory.
+ *
+ * @param tar A handle on the archive.
+ * @param path A path to a directory in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ *             Directories only known from the paths of their entries can be listed too.
+ * @param cursor An in-out argument.
+ *               The caller set it to TAR_CURSOR_START for the first page, then passes it back unchanged.
+ *               The callee set it to TAR_CURSOR_END once the last entry has been listed.
+ * @param entries An array of char arrays of TAR_PATH_MAX bytes each, they receive the whole paths of the entries.
+ * @param no_entries An in-out argument.
+ *                   The caller set it to the number of entries in `entries`.
+ *                   The callee set it to the number of entries listed.
+ *
+ * @return zero if no directory at the given path exists in the archive or the cursor is not one of this directory,
+ *         -4 if a lazy handle could not index the archive,
+ *         any other value otherwise.
+ */
+int tar_list_page(tar_t *tar, char *path, tar_cursor_t *cursor, char **entries, size_t *no_entries);
+
+/* An entry listed by tar_list_arena(), its path is arena[offset..offset + len[ followed by a '\0' */
+typedef struct tar_name {
+    uint32_t offset;
+    uint32_t len;
+} tar_name_t;
+
+/**
+ * Lists the entries at a given path in the archive, one page at a time, into an arena of the caller.
+ * The paths are written one after the other in the arena, whole and each followed by a '\0', and nothing is
+ * allocated: listing a directory again in the same arena costs no malloc() at all.
+ * The cursor is the one of tar_list_page(), both functions can page through the same directory.
+ *
+ * @param tar A handle on the archive.
+ * @param path A path to a directory in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param cursor An in-out argument, as for tar_list_page().
+ *               The callee leaves it on the first entry that did not fit in names or in the arena.
+ * @param names Receives the offset and the length of the path of each entry listed, in the arena.
+ * @param no_names An in-out argument.
+ *                 The caller set it to the number of entries in `names`.
+ *                 The callee set it to the number of entries listed.
+ * @param arena A buffer receiving the paths of the entries listed.
+ * @param arena_size An in-out argument.
+ *                   The caller set it to the size of `arena`.
+ *                   The callee set it to the number of bytes written to `arena`, or to the number of bytes the next
+ *                   path needs if not even one path fits.
+ *
+ * @return zero if no directory at the given path exists in the archive or the cursor is not one of this directory,
+ *         -1 if the arena is too small for the next path: nothing is listed and the cursor is left unchanged,
+ *         -4 if a lazy handle could not index the archive,
+ *         any other value otherwise.
+ */
+int tar_list_arena(tar_t *tar, char *path, tar_cursor_t *cursor, tar_name_t *names, size_t *no_names, char *arena,
+                   size_t *arena_size);
+
+/**
+ * Same as read_file(), answered from the index of the handle.
+ *
+ * @return the same values as read_file(), or -3 if the archive could not be read.
+ */
+ssize_t tar_read_file(tar_t *tar, char *path, size_t offset, uint8_t *dest, size_t *len);
+
+/**
+ * Gives a view on the content of a file of an archive opened with TAR_MMAP, without copying it.
+ *
+ * @param tar A handle opened with TAR_MMAP.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param data Set to the first byte of the file in the mapping. It stays valid until tar_close().
+ * @param size Set to the size of the file.
+ *
+ * @return zero on success,
+ *         -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -3 if the archive is not mapped, the file goes past the end of the archive or a lazy handle could not
+ *            index it.
+ */
+int tar_file_view(tar_t *tar, char *path, const uint8_t **data, size_t *size);
+
+/**
+ * Sends a range of a file of the archive to a file descriptor, a socket or a pipe, without copying it in user space:
+ * with sendfile(), or splice() through a pipe when out_fd refuses sendfile(). The content of a compressed archive
+ * is decompressed through a buffer. A non-blocking out_fd is waited for with poll().
+ *
+ * @param tar A handle on the archive.
+ * @param path A path to an entry in the archive. If the entry is a symlink, it is resolved to its linked-to entry.
+ * @param out_fd The file descriptor the bytes are written to, at its current position.
+ * @param offset An offset in the file from which to start sending, zero to start from the beginning.
+ * @param len An input-output argument: the number of bytes to send, SIZE_MAX for every byte up to the end of the file,
+ *            set to the number of bytes actually sent.
+ *
+ * @return -1 if no entry at the given path exists in the archive or the entry is not a file,
+ *         -2 if the offset is outside the file total length,
+ *         -3 if the archive could not be read or out_fd could not be written, *len bytes were sent before,
+ *         zero if the range was sent up to the end of the file,
+ *         the remaining bytes left to send in the file after the range otherwise.
+ */
+ssize_t tar_send_member(tar_t *tar, char *path, int out_fd, size_t offset, size_t *len);
+
+
+/* ========== SIDECAR INDEX ==========
+ * The index of a handle can be saved next to the archive (e.g. "archive.tar.idx") and mapped back
+ * at the next open, which then costs no header read at all. The index records the size and mtime
+ * of the archive and is rejected once they change. An archive writer appends deltas to the index it wrote, the
+ * entries changed by each flush, which are applied when the index is mapped; a partial delta rejects the index.
+ * The index is specific to the machine that wrote it: it is rejected if the layout of its entries or its byte order
+ * differ, and its offsets and ids are checked before it is used, an index that fails any check is rebuilt.
+ */
+
+/**
+ * Writes the index of the handle to a sidecar file, for tar_open_index().
+ * The file is written next to idx_path then renamed, so a reader never sees a partial index.
+ *
+ * @param tar A handle on the archive.
+ * @param idx_path Where to write the index, usually the path of the archive followed by ".idx".
+ *
+ * @return zero on success, -1 on error.
+ */
+int tar_index_write(tar_t *tar, const char *idx_path);
+
+/**
+ * Opens an archive handle from its sidecar index, without reading any header of the archive.
+ * If the index does not exist, is invalid or is stale (the archive changed size or mtime),
+ * the archive is scanned as with tar_open() and the index is written again.
+ * The index keeps the checkpoints of a compressed archive, so it is not decompressed again.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a valid tar archive file.
+ * @param idx_path The path of the sidecar index of the archive.
+ * @param flags The same flags as tar_open().
+ *
+ * @return a handle on the archive, NULL on error.
+ */
+tar_t *tar_open_index(int tar_fd, const char *idx_path, int flags);
+
+
+/* ========== LAYERED ARCHIVES ==========
+ * A stack of archives, a base image and its patches for instance, opened as one handle with a merged index.
+ */
+
+/**
+ * Opens a handle on a stack of archives, seen as one: the members of an upper archive shadow the members of the
+ * same path in the lower ones, and the directories of every archive are merged. Whiteouts are honored as in OCI
+ * images: a member "dir/.wh.name" hides dir/name, and everything under it, in the lower archives, and a member
+ * "dir/.wh..wh..opq" hides everything under dir/ in the lower archives. Whiteouts are not entries of the overlay.
+ *
+ * The archives are scanned once, from the top one down, into a merged index: tar_exists(), tar_is_*(), tar_list(),
+ * tar_read_file() and every function taking a handle then answer for the whole stack with one lookup.
+ * Links are resolved in the merged tree, a link of a lower archive to a path hidden above is broken.
+ * With an index path, the merged index is mapped from that sidecar as by tar_open_index(), and written there if it
+ * does not exist or is stale, one of the archives having changed.
+ *
+ * @param fds File descriptors on the archives, the bottom one first. They must stay open until tar_close().
+ * @param no_layers The number of archives, from 1 to 65536.
+ * @param idx_path The path of the sidecar index of the overlay, NULL to scan the archives at each open.
+ * @param flags Zero or more of TAR_MMAP, TAR_SEQUENTIAL and TAR_RANDOM, applied to each archive.
+ *
+ * @return a handle on the overlay, NULL on error.
+ */
+tar_t *tar_open_layers(const int *fds, size_t no_layers, const char *idx_path, int flags);
+
+
+/* ========== PATH QUERIES ========== */
+
+typedef struct tar_match {
+    const char *path;           // the path of the entry in the archive, built for the call
+    const char *linkname;       // target of a link, "" otherwise
+    char typeflag;              // one of REGTYPE, AREGTYPE, LNKTYPE, SYMTYPE, DIRTYPE...
+    uint64_t size;              // size of the content of the entry
+    uint64_t data_offset;       // offset of the content of the entry in the archive
+    uint32_t layer;             // for an overlay, the archive the entry comes from, 0 otherwise
+} tar_match_t;
+
+/**
+ * Calls callback on every entry of the archive whose path starts with prefix, at any depth, in the order of the paths.
+ * Costs O(log N + matches) once the entries are sorted, which the first query of the handle does in O(N log N).
+ *
+ * @param tar A handle on the archive.
+ * @param prefix The start of the paths, "logs/2026/" for everything in that directory, "" for the whole archive.
+ *               It is compared byte for byte: "logs/2026" would also report "logs/2026-old".
+ * @param callback Called with each entry and arg. The match and its path are only valid during the call.
+ *                 It returns zero to go on with the next entry, any positive value stops the query.
+ * @param arg Passed to callback.
+ *
+ * @return zero once every entry has been reported,
+ *         the value returned by callback if it stopped the query,
+ *         -1 if the index could not be sorted (out of memory),
+ *         -4 if a lazy handle could not index the archive.
+ */
+int tar_find_prefix(tar_t *tar, const char *prefix, int (*callback)(const tar_match_t *match, void *arg), void *arg);
+
+/**
+ * Calls callback on every entry of the archive whose path matches a shell pattern, in the order of the paths.
+ * The pattern is matched by fnmatch() without flags: a '*' also matches '/', so "*.json" finds the JSON files of
+ * every directory. Only the paths that start with the part of the pattern before its first '*', '?', '[' or '\'
+ * are tried, "logs/2026-*.json" only costs the entries under "logs/2026-".
+ *
+ * @param tar A handle on the archive.
+ * @param pattern A pattern of fnmatch().
+ * @param callback Called with each entry and arg, as for tar_find_prefix().
+ * @param arg Passed to callback.
+ *
+ * @return the same values as tar_find_prefix().
+ */
+int tar_find_glob(tar_t *tar, const char *pattern, int (*callback)(const tar_match_t *match, void *arg), void *arg);
+
+/* ========== PARALLEL VERIFICATION ========== */
+
+typedef struct tar_member_digest {
+    uint64_t header_offset;     // offset of the header of the member in the archive
+    uint64_t size;              // size of the content of the member
+    uint32_t crc32c;            // CRC32C of the content of the member
+    int status;                 // zero, or -4 if the content could not be read entirely
+} tar_member_digest_t;
+
+/**
+ * Computes the CRC32C (Castagnoli) of a buffer, with the SSE4.2 instruction when the CPU supports it.
+ *
+ * @param crc The CRC32C of the previous bytes, zero for the first buffer.
+ * @param data The bytes to add to the CRC.
+ * @param len The number of bytes in `data`.
+ *
+ * @return the CRC32C of the previous bytes followed by `data`.
+ */
+uint32_t tar_crc32c(uint32_t crc, const void *data, size_t len);
+
+/**
+ * Checks the headers of the archive like check_archive(), then computes the CRC32C of the content of every member
+ * with a pool of threads reading with pread().
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive. Its offset is not moved.
+ * @param no_threads The number of threads hashing the members, at least 1.
+ * @param digests Set to an array of one digest per valid header, in the order of the archive. Freed by the caller with free().
+ * @param no_digests Set to the number of digests in `digests`.
+ *
+ * @return a zero or positive value if the archive is valid, representing the number of non-null headers in the archive,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive could not be read or a member is truncated (its status is -4).
+ *         On -1, -2 and -3, the members before the first invalid header are still digested,
+ *         and that header is right after the last digested member.
+ */
+int tar_verify(int tar_fd, int no_threads, tar_member_digest_t **digests, size_t *no_digests);
+
+
+/* ========== EXTRACTION ========== */
+
+/**
+ * Extracts the archive under a directory: one pass over the headers, the directories, then the regular files
+ * written by a pool of threads with copy_file_range() or sendfile() from tar_fd, then the hard links and the symlinks.
+ * The permissions (without setuid and setgid) and modification times of the headers are applied, not the owners.
+ * A member of the same name as a later one is skipped, a member with a '..' component is refused.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive. Its offset is not moved.
+ * @param dir The destination directory, it must exist.
+ * @param no_threads The number of threads writing the files, at least 1.
+ *
+ * @return a zero or positive value if the archive is valid and extracted, representing the number of non-null headers,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive could not be read or a member is truncated,
+ *         -5 if a member could not be written or was refused, the other members are still extracted.
+ *         On -1, -2 and -3, the members before the first invalid header are still extracted.
+ */
+int tar_extract(int tar_fd, const char *dir, int no_threads);
+
+
+/* ========== RE-LAYOUT ========== */
+
+#define TAR_RELAYOUT_ALIGN 0x1  /* the content of every regular file of 4 KiB or more starts on a 4 KiB boundary */
+#define TAR_RELAYOUT_INDEX 0x2  /* end the archive with its index, mapped by tar_open() instead of reading the headers */
+
+/**
+ * Rewrites an archive for lookups: the members of each directory are written one after the other, the directories in
+ * the order of their paths, so a directory comes before its entries. A hard link whose target would come after it is
+ * moved to the end. The headers and contents are copied unchanged, with sendfile() (splice() when out_fd refuses it)
+ * when the archive is not compressed, through a buffer otherwise. A member of the same name as a later one is dropped.
+ * The pax extended header of a member is copied just before it; the ones holding only comments are dropped, as are
+ * the global ones holding only comments, such as the paddings and the index of an archive already rewritten.
+ * The output stays a valid ustar archive: its paddings are pax headers holding a comment, which readers skip.
+ *
+ * @param tar_fd A file descriptor pointing to the start of a file supposed to contain a tar archive. Its offset is not moved.
+ * @param out_fd The file descriptor the archive is written to, from its current position, usually a new file.
+ * @param flags Zero or more of TAR_RELAYOUT_ALIGN and TAR_RELAYOUT_INDEX.
+ *
+ * @return a zero or positive value if the archive is valid and rewritten, representing the number of members written,
+ *         -1 if the archive contains a header with an invalid magic value,
+ *         -2 if the archive contains a header with an invalid version value,
+ *         -3 if the archive contains a header with an invalid checksum value,
+ *         -4 if the archive could not be read or a member is truncated,
+ *         -5 if out_fd could not be written,
+ *         -6 if the archive contains a pax global header with records other than comments, which would apply
+ *            to other members once they are moved.
+ */
+int tar_relayout(int tar_fd, int out_fd, int flags);
+
+/* ========== ARCHIVE WRITER ==========
+ * Writes an archive member by member through a large buffer, at explicit offsets: the offset of the file descriptor is
+ * never used nor moved. The archive is valid after each tar_writer_flush(), its end-of-archive blocks are written after
+ * the last member and overwritten by the next one. A handle given to the writer indexes each member as it is written,
+ * and its sidecar index is updated from it: the archive is never scanned again. The sidecar index is written whole
+ * with room to spare, then each flush appends to it the entries it changed, until it is written whole again.
+ */
+typedef struct tar_writer tar_writer_t;
+
+#define TAR_WRITER_APPEND 0x1   /* add the members after those of the archive instead of emptying it */
+
+/**
+ * Opens a writer on an archive, to create it or to append members to it.
+ * Without TAR_WRITER_APPEND the file is emptied first. With it, the members are added after the last one of the
+ * archive, over its end-of-archive blocks and over the index written by tar_relayout(), which is stale from then on.
+ * The writer is the only one to use the handle and the archive until tar_writer_close().
+ *
+ * @param tar_fd A file descriptor on the archive, opened for writing. Its offset is not moved.
+ * @param tar A handle on the same archive, updated as the members are written, or NULL.
+ *            Without TAR_WRITER_APPEND its archive must be empty. It may not be compressed nor an overlay.
+ * @param idx_path The sidecar index of the archive, updated from the handle by each flush, or NULL.
+ *                 Only used with a handle.
+ * @param flags Zero or TAR_WRITER_APPEND.
+ *
+ * @return a writer, NULL on error.
+ */
+tar_writer_t *tar_writer_open(int tar_fd, tar_t *tar, const char *idx_path, int flags);
+
+/**
+ * Adds a regular file to the archive, its content copied from a buffer.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ * @param path The path of the file in the archive, up to 256 bytes, split in a ustar prefix and name if needed.
+ * @param data The content of the file, len bytes.
+ * @param len The size of the file.
+ *
+ * @return zero on success,
+ *         -1 if the path does not fit in a ustar header,
+ *         -5 if the archive could not be written, the writer can only be closed then.
+ */
+int tar_writer_add(tar_writer_t *writer, const char *path, const void *data, size_t len);
+
+/**
+ * Adds a regular file to the archive, its content copied from a file with copy_file_range(), or through a buffer
+ * if the file systems do not support it. Its mode, owner and mtime are those of the file.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ * @param path The path of the file in the archive, up to 256 bytes, split in a ustar prefix and name if needed.
+ * @param fd A file descriptor on a regular file, read from its start whatever its offset. Its offset is not moved.
+ *
+ * @return the same values as tar_writer_add(),
+ *         -4 if the file could not be read, the member is not added.
+ */
+int tar_writer_add_fd(tar_writer_t *writer, const char *path, int fd);
+
+/**
+ * Adds a member without content to the archive: a directory, a symlink or a hard link.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ * @param path The path of the member in the archive, up to 256 bytes, split in a ustar prefix and name if needed.
+ * @param typeflag DIRTYPE, SYMTYPE or LNKTYPE.
+ * @param linkname The target of a link, up to 100 bytes, NULL for a directory.
+ *
+ * @return the same values as tar_writer_add(), -1 also for another typeflag or a missing or too long link target.
+ */
+int tar_writer_add_entry(tar_writer_t *writer, const char *path, char typeflag, const char *linkname);
+
+/**
+ * Writes the members buffered and the end-of-archive blocks after them: the archive is then complete and valid.
+ * Nothing is written if nothing was added since the last flush, so that the sidecar index stays fresh.
+ * The links of the handle that may resolve differently with the members added are resolved again, and the sidecar
+ * index gets a delta appended with the entries changed, or is written whole when it has no room left for them.
+ *
+ * @param writer A writer returned by tar_writer_open().
+ *
+ * @return zero on success, -5 if the archive or its index could not be written.
+ */
+int tar_writer_flush(tar_writer_t *writer);
+
+/**
+ * Flushes the writer then releases it. The file descriptor and the handle are not closed.
+ *
+ * @param writer A writer returned by tar_writer_open(), may be NULL.
+ *
+ * @return the same values as tar_writer_flush().
+ */
+int tar_writer_close(tar_writer_t *writer);
+
+/* ========== ASYNC READ ENGINE ==========
+ * Many reads in flight from a single thread: tar_aio_submit() never blocks, tar_aio_complete() returns the finished ones.
+ * An engine is driven by one thread at a time.
+ */
+typedef struct tar_aio tar_aio_t;
+
+/* Flags of tar_aio_create() and values of tar_aio_backend() */
+#define TAR_AIO_URING   0x1     /* reads go through io_uring */
+#define TAR_AIO_THREADS 0x2     /* reads go through a pool of threads calling pread() */
+
+typedef struct tar_aio_req {
+    char *path;                 // the arguments of read_file()
+    size_t offset;
+    uint8_t *dest;
+    size_t len;                 // in-out, as for read_file()
+    ssize_t status;             // set to the value read_file() would return
+    void *user_data;            // free for the caller
+} tar_aio_req_t;
+
+/**
+ * Creates an asynchronous read engine on a handle, backed by io_uring, or by a pool of threads
+ * when io_uring is not available.
+ *
+ * @param tar A handle on the archive, it must stay open until tar_aio_destroy().
+ * @param depth The maximum number of requests submitted and not yet returned by tar_aio_complete().
+ * @param flags Zero, or TAR_AIO_THREADS to use the pool of threads even if io_uring is available.
+ *
+ * @return an engine, NULL on error.
+ */
+tar_aio_t *tar_aio_create(tar_t *tar, unsigned depth, int flags);
+
+/**
+ * Destroys the engine, after waiting for the reads in progress. The handle is not closed.
+ *
+ * @param aio An engine returned by tar_aio_create(), may be NULL.
+ */
+void tar_aio_destroy(tar_aio_t *aio);
+
+/**
+ * Returns the backend of the engine, TAR_AIO_URING or TAR_AIO_THREADS.
+ */
+int tar_aio_backend(tar_aio_t *aio);
+
+/**
+ * Submits a read, without blocking: the path is resolved in the index of the handle and the read is queued.
+ * A request that fails to resolve, or that is served from a mapping or an overlay, is completed at once.
+ *
+ * @param aio An engine.
+ * @param req A request, path, offset, dest and len are the arguments of read_file().
+ *            It must stay valid until it is returned by tar_aio_complete(), with len and status set as by read_file().
+ *
+ * @return zero if the request was submitted, -1 if `depth` requests are already in progress.
+ */
+int tar_aio_submit(tar_aio_t *aio, tar_aio_req_t *req);
+
+/**
+ * Returns completed requests, waiting for some if needed. The queued reads are given to the kernel here.
+ *
+ * @param aio An engine.
+ * @param reqs An array receiving the completed requests.
+ * @param max The size of `reqs`.
+ * @param min_wait Wait until at least that many requests are completed (bounded by the requests in progress),
+ *                 zero to only poll.
+ *
+ * @return the number of requests put in `reqs`, -1 on error.
+ */
+int tar_aio_complete(tar_aio_t *aio, tar_aio_req_t **reqs, unsigned max, unsigned min_wait);
+
+/* ========== STATISTICS ==========
+ * Counters of the library, compiled in with -DTAR_STATS (make STATS=1). Each thread counts on its own,
+ * tar_stats_get() adds them up. Without TAR_STATS nothing is counted and nothing is paid.
+ */
+typedef enum tar_op {
+    TAR_OP_CHECK_ARCHIVE, TAR_OP_EXISTS, TAR_OP_IS_DIR, TAR_OP_IS_FILE, TAR_OP_IS_SYMLINK, TAR_OP_LIST,
+    TAR_OP_READ_FILE, TAR_OP_CHECK_HEADERS, TAR_OP_FOREACH_HEADER, TAR_OP_LOOKUP_BATCH, TAR_OP_READ_BATCH,
+    TAR_OP_OPEN, TAR_OP_CHECK, TAR_OP_TAR_EXISTS, TAR_OP_TAR_IS_DIR, TAR_OP_TAR_IS_FILE, TAR_OP_TAR_IS_SYMLINK,
+    TAR_OP_TAR_LIST, TAR_OP_LIST_PAGE, TAR_OP_TAR_READ_FILE, TAR_OP_FILE_VIEW, TAR_OP_INDEX_WRITE,
+    TAR_OP_OPEN_INDEX, TAR_OP_VERIFY, TAR_OP_AIO_SUBMIT, TAR_OP_AIO_COMPLETE, TAR_OP_EXTRACT, TAR_OP_SEND_MEMBER,
+    TAR_OP_FIND_PREFIX, TAR_OP_FIND_GLOB, TAR_OP_OPEN_LAYERS, TAR_OP_RELAYOUT, TAR_OP_LIST_ARENA,
+    TAR_OP_WRITER_OPEN, TAR_OP_WRITER_ADD, TAR_OP_WRITER_FLUSH,
+    TAR_NO_OPS
+} tar_op_t;
+
+#define TAR_STATS_BUCKETS 32    /* latency buckets, powers of two of nanoseconds */
+
+typedef struct tar_stats {
+    uint64_t headers_scanned;   // headers met by the scans of the archives
+    uint64_t bytes_read;        // bytes returned by the read system calls on the archives, compressed or not
+    uint64_t read_calls;        // pread(), preadv() and io_uring reads
+    uint64_t seek_calls;        // lseek()
+    uint64_t symlink_hops;      // links followed to resolve a path
+    uint64_t calls[TAR_NO_OPS]; // calls of each function, by tar_op_t, including those made by the library itself
+    uint64_t latency[TAR_NO_OPS][TAR_STATS_BUCKETS]; // calls that took [2^i, 2^(i+1)) ns, the last bucket takes the rest
+} tar_stats_t;
+
+/**
+ * Returns the counters of every thread since the last tar_stats_reset(), threads that exited included.
+ *
+ * @param stats Receives the counters, zeroed if the library was built without TAR_STATS.
+ *
+ * @return zero, -1 if the library was built without TAR_STATS.
+ */
+int tar_stats_get(tar_stats_t *stats);
+
+/**
+ * Starts the counters of tar_stats_get() again from zero, for every thread.
+ */
+void tar_stats_reset(void);
+
+/**
+ * Returns the name of the function counted as op, "tar_open" for TAR_OP_OPEN for instance, NULL for an unknown op.
+ */
+const char *tar_op_name(int op);
+
 #endif
@@ -0,0 +1,86 @@
+#ifndef LIB_TAR_INDEX_H
+#define LIB_TAR_INDEX_H
+
+/* The on-disk layout of the sidecar index of lib_tar.c, in the byte order and struct layout of the machine that
+ * wrote it. Not part of the API: tests.c includes it to corrupt an index at known fields.
+ */
+
+#include <stdint.h>
+
+typedef struct tar_entry {
+    uint64_t header_offset;
+    uint64_t size;
+    uint32_t name;          // offset in the string pool of the end of the path, after the path of the parent
+    uint32_t linkname;      // offset of the link target in the string pool, 0 if none
+    uint32_t hash;
+    uint32_t next;          // next entry of the same bucket
+    uint32_t parent;        // the directory containing the entry
+    uint32_t first_child;   // for a directory, its entries in the order of the archive
+    uint32_t last_child;
+    uint32_t next_sibling;
+    uint32_t target;        // for a link, the entry it resolves to once every hop is followed, TAR_NOENT if broken
+    char typeflag;
+    uint8_t hops;           // for a resolved link, the longest chain of links followed to its target, itself included
+    uint16_t layer;         // for an overlay, the layer the entry comes from, 0 otherwise
+} tar_entry_t;
+
+#define TAR_INDEX_MAGIC "TARIDX\n"
+#define TAR_INDEX_VERSION 9
+#define TAR_INDEX_BYTE_ORDER 0x01020304 // written in the byte order of the machine, read back reversed on another one
+
+// the file starts with this header, followed by a record for each archive, the entries sorted by path,
+// the buckets, the checkpoints and windows of each compressed archive, and the string pool;
+// the entries and the pool may have room after them, filled by the deltas appended after the pool
+typedef struct tar_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;    // sizeof(tar_entry_t), an index is only valid on the machine that wrote it
+    uint32_t no_entries;
+    uint32_t no_buckets;
+    uint64_t strings_len;
+    uint32_t no_layers;     // archives indexed, more than one for an overlay
+    uint32_t byte_order;    // TAR_INDEX_BYTE_ORDER
+    uint32_t max_entries;   // the room for the entries, at least no_entries
+    uint32_t unused;
+    uint64_t strings_max;   // the room for the string pool, at least strings_len
+} tar_index_header_t;
+
+// each flush of a writer appends one to the sidecar index of a single archive instead of writing it again:
+// this record, the ids of the entries changed, the buckets changed (pairs of a bucket and its first entry),
+// the entries changed, then the strings added to the pool
+#define TAR_DELTA_MAGIC "TARIDXD\n"
+
+typedef struct tar_index_delta {
+    char magic[8];
+    uint64_t len;           // bytes of the delta, this record included
+    uint64_t archive_size;  // the archive once the members of the delta are added, as in tar_index_layer_t
+    int64_t archive_mtime_sec;
+    int64_t archive_mtime_nsec;
+    uint64_t strings_len;   // the string pool with the strings added
+    uint32_t no_entries;    // the entries with the ones added
+    uint32_t no_changed;
+    uint32_t no_buckets;
+    uint32_t unused;
+} tar_index_delta_t;
+
+// an archive of the index, bottom layer first
+typedef struct tar_index_layer {
+    uint64_t archive_size;  // the index is stale if the archive does not have this size and mtime anymore
+    int64_t archive_mtime_sec;
+    int64_t archive_mtime_nsec;
+    uint32_t z_format;      // TAR_Z_NONE, or the compression of the archive
+    uint32_t no_checkpoints;
+} tar_index_layer_t;
+
+// tar_relayout() puts the index in the comment record of a pax global header, the last member of the archive:
+// its content is "<len> comment=", spaces up to TAR_EMBED_SKIP, the index, spaces, this footer and '\n'
+#define TAR_EMBED_MAGIC "TARIDXE\n"
+#define TAR_EMBED_SKIP 64
+
+typedef struct tar_index_footer {
+    char magic[8];
+    uint64_t header_offset; // of the pax header, the index describes the archive before it
+    uint64_t index_len;
+} tar_index_footer_t;
+
+#endif
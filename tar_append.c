@@ -0,0 +1,101 @@
+#define _GNU_SOURCE     // nftw() flags
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+
+#include "lib_tar.h"
+
+/**
+ * Adds files to an archive after its last member, with tar_writer_add_fd() and friends:
+ *   tar_append [-c] [-x] tar_file path...
+ *
+ * -c  create the archive, emptying it if it exists
+ * -x  keep the sidecar index tar_file.idx up to date, written again from memory instead of scanning the archive
+ *
+ * A directory is added with everything under it. The paths are stored as given, without their leading '/'.
+ */
+
+tar_writer_t *writer;
+int added;
+
+int add(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    char name[260];
+    const char *member = path;
+    while (*member == '/') { member++; }
+    if (*member == '\0') { return 0; }
+    int res;
+    if (type == FTW_D) {
+        snprintf(name, sizeof(name), "%s/", member);
+        res = tar_writer_add_entry(writer, name, DIRTYPE, NULL);
+    } else if (type == FTW_SL) {
+        ssize_t len = readlink(path, name, sizeof(name) - 1);
+        if (len == -1) { perror(path); return -1; }
+        name[len] = '\0';
+        res = tar_writer_add_entry(writer, member, SYMTYPE, name);
+    } else if (type == FTW_F && S_ISREG(st->st_mode)) {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) { perror(path); return -1; }
+        res = tar_writer_add_fd(writer, member, fd);
+        close(fd);
+    } else {
+        fprintf(stderr, "%s: skipped, not a file, a directory or a symlink\n", path);
+        return 0;
+    }
+    if (res == -1) { fprintf(stderr, "%s: skipped, its path or target does not fit in a ustar header\n", path); }
+    if (res == 0) { added++; }
+    return res < -1 ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int create = 0, keep_index = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "cx")) != -1) {
+        switch (opt) {
+            case 'c': create = 1; break;
+            case 'x': keep_index = 1; break;
+            default:
+                printf("Usage: %s [-c] [-x] tar_file path...\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind + 2 > argc) {
+        printf("Usage: %s [-c] [-x] tar_file path...\n", argv[0]);
+        return -1;
+    }
+    char *tar_path = argv[optind];
+    int fd = open(tar_path, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd == -1) {
+        perror("open(tar_file)");
+        return -1;
+    }
+    char *idx_path = NULL;
+    tar_t *tar = NULL;
+    if (keep_index) {
+        idx_path = malloc(strlen(tar_path) + 5);
+        sprintf(idx_path, "%s.idx", tar_path);
+        if (create) { ftruncate(fd, 0); }
+        tar = tar_open_index(fd, idx_path, 0); // scans the archive only if its index is missing or stale
+        if (tar == NULL) {
+            printf("Could not read %s\n", tar_path);
+            return -1;
+        }
+    }
+    writer = tar_writer_open(fd, tar, idx_path, create ? 0 : TAR_WRITER_APPEND);
+    if (writer == NULL) {
+        printf("Could not write %s\n", tar_path);
+        return -1;
+    }
+    int err = 0;
+    for (int i = optind + 1; i < argc && !err; i++) { err = nftw(argv[i], add, 64, FTW_PHYS); }
+    if (tar_writer_close(writer) || err) {
+        printf("Could not write %s\n", tar_path);
+        return -1;
+    }
+    printf("%d members added to %s\n", added, tar_path);
+    tar_close(tar);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+
+#include "lib_tar.h"
+
+/**
+ * Writes a synthetic ustar archive, the same one for the same options:
+ *   tar_gen [-n members] [-d depth] [-f fanout] [-s sizes] [-l symlinks] [-S seed] out.tar
+ *
+ * -n  members (regular files and symlinks) spread evenly over the leaf directories, default 1000
+ * -d  depth of the directory tree, 0 puts every member at the root, default 2
+ * -f  fan-out, sub-directories of each directory, default 10
+ * -s  distribution of the file sizes: fixed:N, uniform:MIN:MAX or exp:MEAN (exponential), default exp:4096
+ * -l  fraction of the members that are symlinks to an earlier file, relative to their directory, default 0.05
+ * -S  seed of the generator, default 42
+ */
+
+#define GEN_BUFFER (1 << 20)
+#define GEN_RECENT 1024     // a symlink points to one of the last GEN_RECENT files
+
+typedef struct gen {
+    int fd;
+    uint8_t *buffer;
+    size_t buffered;
+    unsigned int seed;
+    uint64_t no_members;    // members still to write
+    uint64_t no_leaves;
+    uint64_t leaf;          // leaves already written
+    int depth;
+    int fanout;
+    char dist;              // 'f', 'u' or 'e'
+    double dist_a;
+    double dist_b;
+    double symlinks;
+    char recent[GEN_RECENT][100];
+    uint64_t no_recent;
+    uint64_t no_files, no_links, no_dirs, no_bytes;
+} gen_t;
+
+static uint8_t pattern[65536];
+
+void gen_flush(gen_t *gen) {
+    size_t done = 0;
+    while (done < gen->buffered) {
+        ssize_t res = write(gen->fd, &gen->buffer[done], gen->buffered - done);
+        if (res == -1) { perror("write"); exit(1); }
+        done += res;
+    }
+    gen->buffered = 0;
+}
+
+void gen_write(gen_t *gen, const void *data, size_t len) {
+    if (gen->buffered + len > GEN_BUFFER) { gen_flush(gen); }
+    memcpy(&gen->buffer[gen->buffered], data, len);
+    gen->buffered += len;
+}
+
+void gen_header(gen_t *gen, const char *name, char typeflag, const char *linkname, uint64_t size) {
+    char header[512] = {0};
+    strncpy(header, name, 100);
+    sprintf(&header[100], "%07o", typeflag == DIRTYPE ? 0755 : 0644);
+    sprintf(&header[108], "%07o", 0);
+    sprintf(&header[116], "%07o", 0);
+    sprintf(&header[124], "%011llo", (unsigned long long) size);
+    sprintf(&header[136], "%011o", 0);
+    header[156] = typeflag;
+    if (linkname != NULL) { strncpy(&header[157], linkname, 100); }
+    memcpy(&header[257], TMAGIC, TMAGLEN);
+    memcpy(&header[263], TVERSION, TVERSLEN);
+    memset(&header[148], ' ', 8);
+    long sum = 0;
+    for (int i = 0; i < 512; i++) { sum += header[i]; }
+    sprintf(&header[148], "%06lo", sum);
+    header[155] = ' ';
+    gen_write(gen, header, 512);
+}
+
+uint64_t gen_size(gen_t *gen) {
+    double u = (rand_r(&gen->seed) + 1.0) / ((double) RAND_MAX + 2.0);
+    switch (gen->dist) {
+        case 'f': return gen->dist_a;
+        case 'u': return gen->dist_a + u * (gen->dist_b - gen->dist_a + 1);
+        default: return -log(u) * gen->dist_a;
+    }
+}
+
+void gen_member(gen_t *gen, const char *dir, int level) {
+    char name[256];
+    snprintf(name, sizeof(name), "%sm%llu", dir, (unsigned long long) (gen->no_files + gen->no_links));
+    if (gen->no_recent > 0 && rand_r(&gen->seed) < gen->symlinks * RAND_MAX) {
+        // a symlink to a recent file, its path relative to the directory of the link
+        char target[256] = "";
+        for (int i = 0; i < level; i++) { strcat(target, "../"); }
+        strcat(target, gen->recent[rand_r(&gen->seed) % (gen->no_recent < GEN_RECENT ? gen->no_recent : GEN_RECENT)]);
+        if (strlen(target) < 100) {
+            gen_header(gen, name, SYMTYPE, target, 0);
+            gen->no_links++;
+            return;
+        }
+    }
+
+    uint64_t size = gen_size(gen);
+    gen_header(gen, name, REGTYPE, NULL, size);
+    for (uint64_t done = 0; done < size; ) {
+        size_t len = size - done < sizeof(pattern) ? size - done : sizeof(pattern);
+        gen_write(gen, pattern, len);
+        done += len;
+    }
+    uint8_t zeros[512] = {0};
+    gen_write(gen, zeros, (512 - size % 512) % 512);
+    char *recent = gen->recent[gen->no_recent++ % GEN_RECENT];
+    memcpy(recent, name, sizeof(gen->recent[0]) - 1);
+    recent[sizeof(gen->recent[0]) - 1] = '\0';
+    gen->no_files++;
+    gen->no_bytes += size;
+}
+
+void gen_dir(gen_t *gen, char *path, int level) {
+    if (level > 0) {
+        gen_header(gen, path, DIRTYPE, NULL, 0);
+        gen->no_dirs++;
+    }
+    if (level == gen->depth) {
+        // the members left are shared by the leaves left
+        uint64_t no_members = gen->no_members / (gen->no_leaves - gen->leaf);
+        for (uint64_t i = 0; i < no_members; i++) { gen_member(gen, path, level); }
+        gen->no_members -= no_members;
+        gen->leaf++;
+        return;
+    }
+    size_t len = strlen(path);
+    for (int i = 0; i < gen->fanout; i++) {
+        snprintf(&path[len], 16, "d%d/", i);
+        if (strlen(path) > 70) { fprintf(stderr, "The tree is too deep for the 100 bytes of a ustar name\n"); exit(1); }
+        gen_dir(gen, path, level + 1);
+    }
+    path[len] = '\0';
+}
+
+int main(int argc, char **argv) {
+    gen_t gen = {.no_members = 1000, .depth = 2, .fanout = 10, .dist = 'e', .dist_a = 4096, .symlinks = 0.05, .seed = 42};
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:f:s:l:S:")) != -1) {
+        switch (opt) {
+            case 'n': gen.no_members = strtoull(optarg, NULL, 10); break;
+            case 'd': gen.depth = atoi(optarg); break;
+            case 'f': gen.fanout = atoi(optarg); break;
+            case 'l': gen.symlinks = atof(optarg); break;
+            case 'S': gen.seed = strtoul(optarg, NULL, 10); break;
+            case 's':
+                gen.dist = optarg[0];
+                if (sscanf(optarg, "fixed:%lf", &gen.dist_a) == 1 || sscanf(optarg, "exp:%lf", &gen.dist_a) == 1
+                    || sscanf(optarg, "uniform:%lf:%lf", &gen.dist_a, &gen.dist_b) == 2) {
+                    break;
+                }
+                // fall through
+            default:
+                printf("Usage: %s [-n members] [-d depth] [-f fanout] [-s fixed:N|uniform:MIN:MAX|exp:MEAN] "
+                       "[-l symlinks] [-S seed] out.tar\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc || gen.fanout < 1 || gen.depth < 0) {
+        printf("Usage: %s [options] out.tar, with a fan-out of 1 or more\n", argv[0]);
+        return -1;
+    }
+    gen.fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (gen.fd == -1) {
+        perror("open(out.tar)");
+        return -1;
+    }
+    gen.buffer = malloc(GEN_BUFFER);
+    unsigned int seed = gen.seed;
+    for (size_t i = 0; i < sizeof(pattern); i++) { pattern[i] = 'a' + rand_r(&seed) % 26; }
+    gen.no_leaves = 1;
+    for (int i = 0; i < gen.depth; i++) { gen.no_leaves *= gen.fanout; }
+
+    char path[256] = "";
+    gen_dir(&gen, path, 0);
+    uint8_t end[1024] = {0};
+    gen_write(&gen, end, sizeof(end));
+    gen_flush(&gen);
+    close(gen.fd);
+    fprintf(stderr, "%s: %llu files, %llu symlinks, %llu directories, %llu bytes of content\n", argv[optind],
+            (unsigned long long) gen.no_files, (unsigned long long) gen.no_links, (unsigned long long) gen.no_dirs,
+            (unsigned long long) gen.no_bytes);
+    free(gen.buffer);
+    return 0;
+}
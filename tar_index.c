@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lib_tar.h"
+
+/**
+ * Builds the sidecar index of an archive, next to it: tar_index archive.tar writes archive.tar.idx
+ * With -l, builds the merged index of a stack of archives, the bottom one first, for tar_open_layers():
+ *   tar_index -l stack.idx base.tar patch1.tar patch2.tar
+ */
+
+// the merged index of the archives, for tar_open_layers()
+int index_layers(char *idx_path, char **paths, int no_layers) {
+    int *fds = malloc(sizeof(int) * no_layers);
+    for (int i = 0; i < no_layers; i++) {
+        fds[i] = open(paths[i], O_RDONLY);
+        if (fds[i] == -1) {
+            perror(paths[i]);
+            return -1;
+        }
+    }
+    unlink(idx_path); // the layers are scanned again, even if the index is up to date
+    tar_t *tar = tar_open_layers(fds, no_layers, idx_path, 0);
+    if (tar == NULL || access(idx_path, F_OK)) {
+        printf("Could not index the %d layers\n", no_layers);
+        return -1;
+    }
+    printf("Index of %d layers written to %s\n", no_layers, idx_path);
+    tar_close(tar);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 3 && !strcmp(argv[1], "-l")) { return index_layers(argv[2], &argv[3], argc - 3); }
+    if (argc < 2) {
+        printf("Usage: %s tar_file [index_file]\n       %s -l index_file tar_file...\n", argv[0], argv[0]);
+        return -1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd == -1) {
+        perror("open(tar_file)");
+        return -1;
+    }
+
+    char *idx_path = argc > 2 ? argv[2] : NULL;
+    if (idx_path == NULL) {
+        idx_path = malloc(strlen(argv[1]) + 5);
+        sprintf(idx_path, "%s.idx", argv[1]);
+    }
+
+    tar_t *tar = tar_open(fd, TAR_MMAP | TAR_SEQUENTIAL);
+    if (tar == NULL) {
+        printf("Could not read %s\n", argv[1]);
+        return -1;
+    }
+    if (tar_index_write(tar, idx_path)) {
+        perror("tar_index_write");
+        return -1;
+    }
+    printf("Index written to %s\n", idx_path);
+    tar_close(tar);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "lib_tar.h"
+
+/**
+ * Rewrites an archive for lookups with tar_relayout(), the result stays readable by any tar:
+ *   tar_relayout [-a] [-n] in.tar out.tar
+ *
+ * -a  the content of every regular file of 4 KiB or more starts on a 4 KiB boundary
+ * -n  no index at the end of the archive, tar_open() then reads every header
+ */
+
+int main(int argc, char **argv) {
+    int flags = TAR_RELAYOUT_INDEX;
+    int opt;
+    while ((opt = getopt(argc, argv, "an")) != -1) {
+        switch (opt) {
+            case 'a': flags |= TAR_RELAYOUT_ALIGN; break;
+            case 'n': flags &= ~TAR_RELAYOUT_INDEX; break;
+            default:
+                printf("Usage: %s [-a] [-n] in.tar out.tar\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind + 2 != argc) {
+        printf("Usage: %s [-a] [-n] in.tar out.tar\n", argv[0]);
+        return -1;
+    }
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd == -1) {
+        perror("open(in.tar)");
+        return -1;
+    }
+    int out = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
+        perror("open(out.tar)");
+        return -1;
+    }
+    int res = tar_relayout(fd, out, flags);
+    if (res < 0 || close(out)) {
+        printf("Could not rewrite %s: %d\n", argv[optind], res);
+        unlink(argv[optind + 1]);
+        return -1;
+    }
+    printf("%d members written to %s\n", res, argv[optind + 1]);
+    close(fd);
+    return 0;
+}
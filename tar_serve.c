@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "lib_tar.h"
+
+/**
+ * Serves the members of an archive over a Unix socket or a loopback TCP port, one thread per connection:
+ *   tar_serve [-u socket_path | -p port] tar_file
+ *
+ * A client sends one request per line, "path [offset [len]]", and gets back a line "status len" followed by len bytes
+ * of the member, sent by tar_send_member(). The status is zero, or the negative value of tar_send_member() and no bytes
+ * follow. An offset resumes a download, len bounds it. For instance:
+ *   printf 'folder/file.txt 1024\n' | nc -q1 127.0.0.1 8080
+ */
+
+tar_t *tar;
+
+void *serve(void *arg) {
+    int client = (int) (intptr_t) arg;
+    FILE *in = fdopen(dup(client), "r");
+    char *line = NULL;
+    size_t line_size = 0;
+    while (in != NULL && getline(&line, &line_size, in) > 0) {
+        char path[256];
+        unsigned long long offset = 0, len = SIZE_MAX;
+        if (sscanf(line, "%255s %llu %llu", path, &offset, &len) < 1) { break; }
+
+        // the bytes left after offset, without reading any
+        uint8_t none;
+        size_t zero = 0;
+        ssize_t left = tar_read_file(tar, path, offset, &none, &zero);
+        if (left < 0) {
+            dprintf(client, "%zd 0\n", left);
+            continue;
+        }
+        size_t to_send = (size_t) left < len ? (size_t) left : len;
+        dprintf(client, "0 %zu\n", to_send);
+        if (to_send > 0 && tar_send_member(tar, path, client, offset, &to_send) == -3) { break; } // client gone
+    }
+    free(line);
+    if (in != NULL) { fclose(in); }
+    close(client);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    const char *socket_path = NULL;
+    int port = 8080;
+    int opt;
+    while ((opt = getopt(argc, argv, "u:p:")) != -1) {
+        switch (opt) {
+            case 'u': socket_path = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            default:
+                printf("Usage: %s [-u socket_path | -p port] tar_file\n", argv[0]);
+                return -1;
+        }
+    }
+    if (optind >= argc) {
+        printf("Usage: %s [-u socket_path | -p port] tar_file\n", argv[0]);
+        return -1;
+    }
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd == -1) {
+        perror("open(tar_file)");
+        return -1;
+    }
+    tar = tar_open(fd, 0);
+    if (tar == NULL) {
+        printf("Could not open %s\n", argv[optind]);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // a client leaving in the middle of a member is an error of tar_send_member()
+
+    int server;
+    if (socket_path != NULL) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+        unlink(socket_path);
+        server = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (server == -1 || bind(server, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            perror("bind");
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        server = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (server == -1 || bind(server, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+            perror("bind");
+            return -1;
+        }
+    }
+    if (listen(server, 64) == -1) {
+        perror("listen");
+        return -1;
+    }
+    if (socket_path != NULL) {
+        fprintf(stderr, "Serving %s on %s\n", argv[optind], socket_path);
+    } else {
+        fprintf(stderr, "Serving %s on 127.0.0.1:%d\n", argv[optind], port);
+    }
+
+    while (1) {
+        int client = accept(server, NULL, NULL);
+        if (client == -1) { continue; }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve, (void *) (intptr_t) client)) {
+            close(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
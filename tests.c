@@ -1,10 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
 
 #include "lib_tar.h"
+#include "lib_tar_index.h"
 
 /**
  * You are free to use this file to write tests for your implementation
@@ -25,6 +30,1140 @@ void debug_dump(const uint8_t *bytes, size_t len) {
     }
 }
 
+// ========== STRESS TESTING ==========
+#define STRESS_THREADS 8
+#define STRESS_ROUNDS 2000
+
+typedef struct stress_arg {
+    tar_t *tar;
+    char *path;
+    uint8_t *content; // the whole file, read before the threads start
+    size_t size;
+    unsigned int seed;
+    int errors;
+} stress_arg_t;
+
+void *stress_worker(void *ptr) {
+    stress_arg_t *arg = ptr;
+    uint8_t dest[64];
+    for (int i = 0; i < STRESS_ROUNDS; i++) {
+        size_t offset = rand_r(&arg->seed) % arg->size;
+        size_t len = 1 + rand_r(&arg->seed) % sizeof(dest);
+        size_t expected = arg->size - offset < len ? arg->size - offset : len;
+        ssize_t res = tar_read_file(arg->tar, arg->path, offset, dest, &len);
+        if (res != (ssize_t) (arg->size - offset - expected) || len != expected || memcmp(dest, &arg->content[offset], len)) {
+            arg->errors++;
+        }
+        if (!tar_exists(arg->tar, arg->path)) { arg->errors++; }
+    }
+    return NULL;
+}
+
+// many threads read the same file through one handle, the results must not depend on the others
+int stress_test(tar_t *tar, int fd, char *path) {
+    uint8_t content[4096];
+    size_t size = sizeof(content);
+    if (tar_read_file(tar, path, 0, content, &size) != 0) { return -1; }
+    off_t before = lseek(fd, 0, SEEK_CUR);
+
+    pthread_t threads[STRESS_THREADS];
+    stress_arg_t args[STRESS_THREADS];
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        args[i] = (stress_arg_t) {tar, path, content, size, i + 1, 0};
+        pthread_create(&threads[i], NULL, stress_worker, &args[i]);
+    }
+    int errors = 0;
+    for (int i = 0; i < STRESS_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        errors += args[i].errors;
+    }
+    if (lseek(fd, 0, SEEK_CUR) != before) { errors++; }
+    return errors;
+}
+
+// ========== LINK TESTING ==========
+// append a ustar header to the archive being written at fd, the size is in base-256 if too large for octal
+void write_header(int fd, char *name, char typeflag, char *linkname, uint64_t size) {
+    char header[512] = {0};
+    size_t len = strlen(name);
+    char *slash = len > 100 ? strchr(&name[len - 101], '/') : NULL;
+    if (slash != NULL && slash - name <= 155 && slash[1] != '\0') { // a long path is cut at a '/', its start goes to the ustar prefix
+        memcpy(&header[345], name, slash - name);
+        name = slash + 1;
+    }
+    strncpy(header, name, 100);
+    strcpy(&header[100], "0000644");
+    strcpy(&header[108], "0000000");
+    strcpy(&header[116], "0000000");
+    if (size <= 077777777777) {
+        snprintf(&header[124], 12, "%011llo", (unsigned long long) size);
+    } else {
+        header[124] = (char) 0x80;
+        for (int i = 0; i < 8; i++) { header[135 - i] = (char) (size >> (8 * i)); }
+    }
+    strcpy(&header[136], "00000000000");
+    header[156] = typeflag;
+    if (linkname != NULL) { strncpy(&header[157], linkname, 100); }
+    memcpy(&header[257], TMAGIC, TMAGLEN);
+    memcpy(&header[263], TVERSION, TVERSLEN);
+    memset(&header[148], ' ', 8);
+    unsigned int chksum = 0;
+    for (int i = 0; i < 512; i++) { chksum += header[i]; }
+    snprintf(&header[148], 8, "%06o", chksum);
+    write(fd, header, 512);
+}
+
+// append a ustar member to the archive being written at fd
+void write_member(int fd, char *name, char typeflag, char *linkname, char *content) {
+    size_t size = content != NULL ? strlen(content) : 0;
+    write_header(fd, name, typeflag, linkname, size);
+    if (size > 0) {
+        char block[512] = {0};
+        for (size_t done = 0; done < size; done += 512) {
+            size_t n = size - done < 512 ? size - done : 512;
+            memcpy(block, &content[done], n);
+            memset(&block[n], 0, 512 - n);
+            write(fd, block, 512);
+        }
+    }
+}
+
+// relative, '..', multi-hop, hard, cyclic and too long links, and a symlinked directory in the middle of a target
+int link_test(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    write_member(fd, "dir/", DIRTYPE, NULL, NULL);
+    write_member(fd, "dir/file", REGTYPE, NULL, "hello");
+    write_member(fd, "dir/rel", SYMTYPE, "file", NULL);
+    write_member(fd, "dir/up", SYMTYPE, "../top", NULL);
+    write_member(fd, "top", REGTYPE, NULL, "top!");
+    write_member(fd, "chain1", SYMTYPE, "./chain2", NULL);
+    write_member(fd, "chain2", SYMTYPE, "dir/rel", NULL);
+    write_member(fd, "hard", LNKTYPE, "dir/file", NULL);
+    write_member(fd, "loop_a", SYMTYPE, "loop_b", NULL);
+    write_member(fd, "loop_b", SYMTYPE, "loop_a", NULL);
+    write_member(fd, "dirlink", SYMTYPE, "dir", NULL);
+    write_member(fd, "via", SYMTYPE, "dirlink/../dirlink/up", NULL);
+    write_member(fd, "hard_via", LNKTYPE, "dirlink/file", NULL);
+    char name[16], target[16];
+    for (int i = 0; i < 20; i++) { // deep0 is 20 hops away from top, deep19 only one
+        snprintf(name, sizeof(name), "deep%d", i);
+        snprintf(target, sizeof(target), i == 19 ? "top" : "deep%d", i + 1);
+        write_member(fd, name, SYMTYPE, target, NULL);
+    }
+    char end[1024] = {0};
+    write(fd, end, sizeof(end));
+
+    int errors = 0;
+    char *reads[][2] = {
+        {"dir/rel", "hello"}, {"dir/up", "top!"}, {"chain1", "hello"}, {"hard", "hello"}, {"via", "top!"}, {"deep4", "top!"},
+        {"hard_via", "hello"}
+    };
+    uint8_t dest[16];
+    // a lazy handle resolves the links as it meets them, their targets are often further in the archive
+    tar_t *tar = tar_open(fd, TAR_LAZY);
+    if (tar == NULL) { close(fd); return -1; }
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        size_t len = sizeof(dest);
+        if (tar_read_file(tar, reads[i][0], 0, dest, &len) != 0 || len != strlen(reads[i][1]) || memcmp(dest, reads[i][1], len)) {
+            errors++;
+        }
+    }
+    size_t lazy_len = sizeof(dest);
+    if (tar_read_file(tar, "loop_a", 0, dest, &lazy_len) != -1 || tar_read_file(tar, "deep0", 0, dest, &lazy_len) != -1) { errors++; }
+    tar_close(tar);
+
+    tar = tar_open(fd, 0);
+    if (tar == NULL) { close(fd); return -1; }
+    for (size_t i = 0; i < sizeof(reads) / sizeof(reads[0]); i++) {
+        size_t len = sizeof(dest);
+        if (tar_read_file(tar, reads[i][0], 0, dest, &len) != 0 || len != strlen(reads[i][1]) || memcmp(dest, reads[i][1], len)) {
+            errors++;
+        }
+        len = sizeof(dest);
+        if (read_file(fd, reads[i][0], 0, dest, &len) != 0 || len != strlen(reads[i][1])) { errors++; }
+    }
+    size_t len = sizeof(dest);
+    if (tar_read_file(tar, "loop_a", 0, dest, &len) != -1 || read_file(fd, "loop_b", 0, dest, &len) != -1) { errors++; }
+    if (tar_read_file(tar, "deep0", 0, dest, &len) != -1 || read_file(fd, "deep0", 0, dest, &len) != -1) { errors++; } // more than 16 hops
+    // without a handle, each link followed is one more scan of the headers
+    tar_stats_t stats;
+    tar_stats_reset();
+    len = sizeof(dest);
+    errors += read_file(fd, "via", 0, dest, &len) != 0 || !is_file(fd, "hard_via");
+    if (tar_stats_get(&stats) == 0) { errors += stats.calls[TAR_OP_OPEN] != 0; }
+    if (!tar_is_file(tar, "hard") || !is_file(fd, "hard") || tar_is_symlink(tar, "hard") || !tar_is_symlink(tar, "dirlink")) {
+        errors++;
+    }
+    char entries_data[4][TAR_PATH_MAX];
+    char *entries[4] = {entries_data[0], entries_data[1], entries_data[2], entries_data[3]};
+    size_t no_entries = 4;
+    if (!tar_list(tar, "dirlink", entries, &no_entries) || no_entries != 3) { errors++; }
+    tar_close(tar);
+
+    tar_read_req_t reqs[2] = {{"chain1", 0, dest, 5}, {"hard", 1, &dest[8], 4}};
+    if (tar_read_batch(fd, reqs, 2) || reqs[0].status != 0 || reqs[1].status != 0 || memcmp(&dest[8], "ello", 4)) { errors++; }
+    close(fd);
+    unlink(path);
+    return errors;
+}
+
+// ========== LARGE ARCHIVE TESTING ==========
+#define HUGE_SIZE ((9ULL << 30) + 123) // more than 8 GiB, its size is in base-256
+#define OCTAL_MAX 077777777777ULL      // the largest size written in octal
+
+// a sparse member of the given size, only its first and last 4 bytes are written
+void write_sparse_member(int fd, char *name, uint64_t size) {
+    write_header(fd, name, REGTYPE, NULL, size);
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    pwrite(fd, "HEAD", 4, start);
+    pwrite(fd, "TAIL", 4, start + size - 4);
+    lseek(fd, start + (size + 511) / 512 * 512, SEEK_SET);
+}
+
+// members larger than 8 GiB, in a sparse archive: the offsets and partial reads must hold past 32 bits
+int large_test(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    write_sparse_member(fd, "huge", HUGE_SIZE);
+    write_sparse_member(fd, "octal", OCTAL_MAX);
+    write_member(fd, "after", REGTYPE, NULL, "after");
+    char end[1024] = {0};
+    write(fd, end, sizeof(end));
+
+    int errors = 0;
+    uint8_t dest[16];
+    size_t len = sizeof(dest);
+    if (read_file(fd, "after", 0, dest, &len) != 0 || len != 5 || memcmp(dest, "after", 5)) { errors++; }
+    len = 4;
+    if (read_file(fd, "huge", HUGE_SIZE - 4, dest, &len) != 0 || len != 4 || memcmp(dest, "TAIL", 4)) { errors++; }
+
+    tar_lookup_t found;
+    char *paths[] = {"octal"};
+    if (tar_lookup_batch(fd, paths, 1, &found, 0) != 1 || found.size != OCTAL_MAX) { errors++; }
+
+    for (int flags = 0; flags <= TAR_MMAP; flags += TAR_MMAP) {
+        tar_t *tar = tar_open(fd, flags);
+        if (tar == NULL) { close(fd); unlink(path); return -1; }
+        len = 4;
+        if (tar_read_file(tar, "huge", 0, dest, &len) != (ssize_t) (HUGE_SIZE - 4) || memcmp(dest, "HEAD", 4)) { errors++; }
+        len = sizeof(dest);
+        if (tar_read_file(tar, "huge", HUGE_SIZE - 4, dest, &len) != 0 || len != 4 || memcmp(dest, "TAIL", 4)) { errors++; }
+        len = sizeof(dest);
+        if (tar_read_file(tar, "huge", HUGE_SIZE, dest, &len) != -2 || len != 0) { errors++; }
+        len = sizeof(dest);
+        if (tar_read_file(tar, "octal", OCTAL_MAX - 4, dest, &len) != 0 || len != 4 || memcmp(dest, "TAIL", 4)) { errors++; }
+        len = sizeof(dest);
+        if (tar_read_file(tar, "after", 0, dest, &len) != 0 || len != 5 || memcmp(dest, "after", 5)) { errors++; }
+        tar_close(tar);
+    }
+
+    tar_read_req_t reqs[2] = {{"huge", HUGE_SIZE - 8, dest, 8}, {"after", 1, &dest[8], 8}};
+    if (tar_read_batch(fd, reqs, 2) || reqs[0].status != 0 || memcmp(&dest[4], "TAIL", 4) || reqs[1].len != 4) { errors++; }
+    close(fd);
+    unlink(path);
+    return errors;
+}
+
+// ========== COMPRESSED TESTING ==========
+#define COMPRESSED_SIZE (3 << 20) // each member spans several checkpoints
+
+// the same archive plain and gzipped: every read must give the same bytes, also once the checkpoints are persisted
+int compressed_test(char *path, char *gz_path, char *idx_path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    char *content = malloc(COMPRESSED_SIZE + 1);
+    unsigned int seed = 42;
+    for (int m = 0; m < 3; m++) {
+        for (int i = 0; i < COMPRESSED_SIZE; i++) { content[i] = 'a' + rand_r(&seed) % 16; }
+        content[COMPRESSED_SIZE - m * 1000] = '\0';
+        char name[16];
+        snprintf(name, sizeof(name), "member%d", m);
+        write_member(fd, name, REGTYPE, NULL, content);
+    }
+    write_member(fd, "last", REGTYPE, NULL, "last");
+    char end[1024] = {0};
+    write(fd, end, sizeof(end));
+
+    gzFile gz = gzopen(gz_path, "wb");
+    off_t size = lseek(fd, 0, SEEK_END);
+    for (off_t done = 0; done < size; done += COMPRESSED_SIZE) {
+        size_t len = size - done < COMPRESSED_SIZE ? size - done : COMPRESSED_SIZE;
+        pread(fd, content, len, done);
+        gzwrite(gz, content, len);
+    }
+    gzclose(gz);
+    int gz_fd = open(gz_path, O_RDONLY);
+
+    int errors = 0;
+    uint8_t dest[2][5000];
+    tar_t *plain = tar_open(fd, 0);
+    unlink(idx_path);
+    for (int round = 0; round < 3; round++) {
+        // a scan, a scan writing the sidecar index, then the checkpoints of the index
+        tar_t *tar = round == 0 ? tar_open(gz_fd, 0) : tar_open_index(gz_fd, idx_path, 0);
+        if (plain == NULL || tar == NULL) { errors++; break; }
+        size_t offsets[] = {0, 1, 1 << 20, (3 << 20) - 4000, (3 << 20) - 10};
+        char *names[] = {"member0", "member1", "member2", "last"};
+        for (int n = 0; n < 4; n++) {
+            // forward, then backward: the stream of the last read goes on or restarts from a checkpoint
+            for (int o = 0; o < 10; o++) {
+                size_t len[2] = {sizeof(dest[0]), sizeof(dest[1])};
+                size_t offset = offsets[o < 5 ? o : 9 - o];
+                ssize_t res0 = tar_read_file(plain, names[n], offset, dest[0], &len[0]);
+                ssize_t res1 = tar_read_file(tar, names[n], offset, dest[1], &len[1]);
+                if (res0 != res1 || len[0] != len[1] || memcmp(dest[0], dest[1], len[0])) { errors++; }
+            }
+        }
+        // sending decompresses through a buffer
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) { errors++; break; }
+        size_t len[2] = {sizeof(dest[0]), sizeof(dest[1])};
+        ssize_t res0 = tar_read_file(plain, "member1", 1 << 20, dest[0], &len[0]);
+        if (tar_send_member(tar, "member1", fds[1], 1 << 20, &len[1]) != res0 || len[1] != len[0]
+            || read(fds[0], dest[1], len[1]) != (ssize_t) len[1] || memcmp(dest[0], dest[1], len[1])) { errors++; }
+        close(fds[0]);
+        close(fds[1]);
+        if (round == 2) {
+            // two handles on the same archive take turns, then the first one goes away
+            tar_t *again = tar_open_index(gz_fd, idx_path, 0);
+            for (int i = 0; i < 4 && again != NULL; i++) {
+                len[1] = sizeof(dest[1]);
+                if (tar_read_file(i % 2 ? again : tar, "member1", (1 << 20) + i, dest[1], &len[1]) != res0 - i
+                    || memcmp(&dest[0][i], dest[1], len[1] - i)) {
+                    errors++;
+                }
+            }
+            tar_close(tar);
+            tar = again;
+            len[1] = sizeof(dest[1]);
+            if (tar == NULL || tar_read_file(tar, "member1", 1 << 20, dest[1], &len[1]) != res0
+                || memcmp(dest[0], dest[1], len[1])) {
+                errors++;
+            }
+        }
+        tar_close(tar);
+    }
+    tar_close(plain);
+
+    size_t len = 4;
+    if (!exists(gz_fd, "member2") || read_file(gz_fd, "last", 0, dest[0], &len) != 0 || memcmp(dest[0], "last", 4)) { errors++; }
+    tar_member_digest_t *digests[2];
+    size_t no_digests[2];
+    if (tar_verify(fd, 2, &digests[0], &no_digests[0]) != 4 || tar_verify(gz_fd, 2, &digests[1], &no_digests[1]) != 4
+        || digests[0][2].crc32c != digests[1][2].crc32c) {
+        errors++;
+    }
+    free(digests[0]);
+    free(digests[1]);
+    free(content);
+    close(fd);
+    close(gz_fd);
+    unlink(path);
+    unlink(gz_path);
+    unlink(idx_path);
+    return errors;
+}
+
+// ========== EXTRACTION TESTING ==========
+
+// a directory, a file replaced by a later one of the same name, links and a refused '..' member
+int extract_test(char *path, char *dir) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    write_member(fd, "d/", DIRTYPE, NULL, NULL);
+    write_member(fd, "d/f", REGTYPE, NULL, "first");
+    write_member(fd, "d/s", SYMTYPE, "f", NULL);
+    write_member(fd, "h", LNKTYPE, "d/f", NULL);
+    write_member(fd, "../evil", REGTYPE, NULL, "evil");
+    write_member(fd, "e/deep/f", REGTYPE, NULL, "implicit");
+    write_member(fd, "d/f", REGTYPE, NULL, "second");
+    char end[1024] = {0};
+    write(fd, end, sizeof(end));
+
+    int errors = 0;
+    mkdir(dir, 0755);
+    if (tar_extract(fd, dir, 4) != -5) { errors++; } // the '..' member is refused, the others are extracted
+    close(fd);
+    char file[256], content[16] = {0};
+    snprintf(file, sizeof(file), "%s/d/f", dir);
+    int out = open(file, O_RDONLY);
+    if (out == -1 || read(out, content, sizeof(content)) != 6 || memcmp(content, "second", 6)) { errors++; }
+    if (out != -1) { close(out); }
+    struct stat st_file, st_hard;
+    if (stat(file, &st_file) || (st_file.st_mode & 07777) != 0644) { errors++; }
+    snprintf(file, sizeof(file), "%s/h", dir);
+    if (stat(file, &st_hard) || st_hard.st_ino != st_file.st_ino) { errors++; }
+    snprintf(file, sizeof(file), "%s/d/s", dir);
+    ssize_t len = readlink(file, content, sizeof(content));
+    if (len != 1 || content[0] != 'f') { errors++; }
+    snprintf(file, sizeof(file), "%s/e/deep/f", dir);
+    if (access(file, F_OK)) { errors++; }
+    snprintf(file, sizeof(file), "%s/../evil", dir);
+    if (!access(file, F_OK)) { errors++; unlink(file); }
+
+    snprintf(file, sizeof(file), "%s/d", dir);
+    chmod(file, 0755); // 0644 from the header, not searchable
+    char *paths[] = {"d/f", "d/s", "h", "e/deep/f", "e/deep", "e", "d"};
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        snprintf(file, sizeof(file), "%s/%s", dir, paths[i]);
+        if (unlink(file)) { rmdir(file); }
+    }
+    rmdir(dir);
+    unlink(path);
+    return errors;
+}
+
+// ========== LAZY TESTING ==========
+
+// a lazy handle answers like a full one, whatever the order of the lookups
+int lazy_test(int fd) {
+    char *paths[] = {"lib_tar.h", "coucoucfolder/sub/d", "coucoucfolder/", "coucoucfolder", "lib_link.c", "folder/",
+                     "coucouclinklink", "notarealfile", "test_yey/a", "coucouclink/sub/d"};
+    size_t no_paths = sizeof(paths) / sizeof(paths[0]);
+    tar_t *full = tar_open(fd, 0);
+    int errors = 0;
+    for (int order = 0; order < 2; order++) {
+        tar_t *lazy = tar_open(fd, TAR_LAZY);
+        if (full == NULL || lazy == NULL) { tar_close(full); return -1; }
+        for (size_t j = 0; j < no_paths; j++) {
+            char *p = paths[order == 0 ? j : no_paths - 1 - j];
+            errors += tar_exists(lazy, p) != tar_exists(full, p);
+            errors += tar_is_dir(lazy, p) != tar_is_dir(full, p);
+            errors += tar_is_file(lazy, p) != tar_is_file(full, p);
+            errors += tar_is_symlink(lazy, p) != tar_is_symlink(full, p);
+            uint8_t dest[2][64];
+            size_t len[2] = {64, 64};
+            errors += tar_read_file(lazy, p, 0, dest[0], &len[0]) != tar_read_file(full, p, 0, dest[1], &len[1]);
+            errors += len[0] != len[1] || memcmp(dest[0], dest[1], len[0]);
+        }
+        char entries_data[2][10][TAR_PATH_MAX];
+        char *entries[2][10];
+        for (int i = 0; i < 10; i++) { entries[0][i] = entries_data[0][i]; entries[1][i] = entries_data[1][i]; }
+        size_t no_entries[2] = {10, 10};
+        errors += tar_list(lazy, "coucouclinklink", entries[0], &no_entries[0]) != tar_list(full, "coucouclinklink", entries[1], &no_entries[1]);
+        errors += no_entries[0] != no_entries[1];
+        tar_close(lazy);
+    }
+    tar_close(full);
+    return errors;
+}
+
+// a lazy handle whose scan fails to read the archive: every lookup fails, none reads as a missing entry
+int lazy_error_test(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    size_t big_len = 2 * 1024 * 1024; // past the first chunk the scan reads
+    uint8_t *big = calloc(big_len, 1);
+    tar_writer_t *writer = tar_writer_open(fd, NULL, NULL, 0);
+    int errors = writer == NULL || tar_writer_add(writer, "big.bin", big, big_len)
+                 || tar_writer_add_entry(writer, "dir/", DIRTYPE, NULL) || tar_writer_add(writer, "dir/late", "late", 4)
+                 || tar_writer_close(writer);
+    free(big);
+    tar_t *tar = tar_open(fd, TAR_LAZY);
+    if (errors || tar == NULL) { return errors + 1; }
+    errors += tar_exists(tar, "big.bin") != 1;
+
+    // the descriptor of the handle now refuses pread()
+    int pipe_fds[2];
+    if (pipe(pipe_fds) || dup2(pipe_fds[0], fd) == -1) { return errors + 1; }
+    uint8_t dest[8];
+    size_t len = sizeof(dest);
+    errors += tar_exists(tar, "dir/late") != -4 || tar_is_file(tar, "big.bin") != -4;
+    errors += tar_read_file(tar, "dir/late", 0, dest, &len) != -3 || len != 0;
+    char entry[TAR_PATH_MAX];
+    char *entries[1] = {entry};
+    size_t no_entries = 1;
+    errors += tar_list(tar, "dir", entries, &no_entries) != -4 || no_entries != 0;
+    errors += tar_writer_open(fd, tar, NULL, TAR_WRITER_APPEND) != NULL;
+    tar_close(tar);
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(fd);
+    unlink(path);
+    return errors;
+}
+
+// ========== STATISTICS TESTING ==========
+
+void *stats_thread(void *arg) {
+    tar_is_dir((tar_t *) arg, "no/such/dir/");
+    return NULL;
+}
+
+// the counters of a few calls, one of them from a thread that exits before tar_stats_get()
+int stats_test(int fd, char *path, int no_headers) {
+    tar_stats_t stats;
+    tar_stats_reset();
+    if (tar_stats_get(&stats) == -1) { return stats.headers_scanned != 0; } // built without TAR_STATS
+    int errors = stats.headers_scanned != 0 || stats.calls[TAR_OP_OPEN] != 0;
+
+    tar_t *tar = tar_open(fd, 0);
+    uint8_t buffer[16];
+    size_t len = sizeof(buffer);
+    tar_read_file(tar, path, 0, buffer, &len);
+    pthread_t thread;
+    pthread_create(&thread, NULL, stats_thread, tar);
+    pthread_join(thread, NULL);
+    tar_close(tar);
+
+    tar_stats_get(&stats);
+    errors += stats.headers_scanned != (uint64_t) no_headers;
+    errors += stats.read_calls == 0 || stats.bytes_read < (uint64_t) no_headers * 512;
+    errors += stats.calls[TAR_OP_OPEN] != 1 || stats.calls[TAR_OP_TAR_READ_FILE] != 1;
+    errors += stats.calls[TAR_OP_TAR_IS_DIR] != 1; // from the thread
+    for (int op = 0; op < TAR_NO_OPS; op++) {
+        uint64_t total = 0;
+        for (int i = 0; i < TAR_STATS_BUCKETS; i++) { total += stats.latency[op][i]; }
+        errors += total != stats.calls[op];
+    }
+    errors += strcmp(tar_op_name(TAR_OP_OPEN), "tar_open") != 0 || tar_op_name(TAR_NO_OPS) != NULL;
+    return errors;
+}
+
+// ========== QUERY TESTING ==========
+
+typedef struct query_count {
+    int no_matches;
+    int sorted;         // zero once a path comes before the previous one
+    int stop_after;     // stop the query after that many matches, zero to never stop
+    char last[256];
+} query_count_t;
+
+int count_match(const tar_match_t *match, void *arg) {
+    query_count_t *count = arg;
+    if (strcmp(count->last, match->path) > 0) { count->sorted = 0; }
+    strncpy(count->last, match->path, sizeof(count->last) - 1);
+    count->no_matches++;
+    return count->stop_after != 0 && count->no_matches == count->stop_after ? 7 : 0;
+}
+
+// the matches of a prefix or glob query, -1 if they are not in the order of the paths
+int count_query(tar_t *tar, int glob, char *query, int stop_after, int *res) {
+    query_count_t count = {0, 1, stop_after, ""};
+    *res = glob ? tar_find_glob(tar, query, count_match, &count) : tar_find_prefix(tar, query, count_match, &count);
+    return count.sorted ? count.no_matches : -1;
+}
+
+// recursive prefixes, globs and a stopped query, on the members written by query_test()
+int query_check(tar_t *tar) {
+    int res;
+    int errors = count_query(tar, 0, "logs/2026/", 0, &res) != 3 || res != 0;
+    errors += count_query(tar, 0, "logs/2026", 0, &res) != 4; // byte for byte, "logs/2026-old/c.json" too
+    errors += count_query(tar, 0, "", 0, &res) != 11;
+    errors += count_query(tar, 0, "nothing/", 0, &res) != 0 || res != 0;
+    errors += count_query(tar, 1, "*.c", 0, &res) != 3;
+    errors += count_query(tar, 1, "src/lib.?", 0, &res) != 2;
+    errors += count_query(tar, 1, "logs/*/?.json", 0, &res) != 3;
+    errors += count_query(tar, 1, "*", 2, &res) != 2 || res != 7;
+    return errors;
+}
+
+// the queries on an archive written here, through a handle, a mapped handle and its sidecar index
+int query_test(char *path, char *idx_path) {
+    char *members[] = {"logs/", "logs/2026/", "logs/2026/a.json", "logs/2026/b.json", "logs/2026-old/c.json",
+                       "logs/readme", "src/", "src/lib.c", "src/lib.h", "src/main.c", "top.c", "src/lib.c"};
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    tar_writer_t *writer = fd == -1 ? NULL : tar_writer_open(fd, NULL, NULL, 0);
+    if (writer == NULL) { return -1; }
+    int errors = 0;
+    for (size_t i = 0; i < sizeof(members) / sizeof(members[0]); i++) {
+        size_t len = strlen(members[i]);
+        errors += members[i][len - 1] == '/' ? tar_writer_add_entry(writer, members[i], DIRTYPE, NULL)
+                                             : tar_writer_add(writer, members[i], "x", 1);
+    }
+    errors += tar_writer_close(writer);
+
+    unlink(idx_path);
+    for (int i = 0; i < 4; i++) { // a handle, a mapped one, then the sidecar index written, then mapped back
+        tar_t *tar = i < 2 ? tar_open(fd, i == 0 ? 0 : TAR_MMAP) : tar_open_index(fd, idx_path, 0);
+        errors += tar == NULL ? 1 : query_check(tar);
+        tar_close(tar);
+    }
+    close(fd);
+    unlink(path);
+    unlink(idx_path);
+    return errors;
+}
+
+// the 4 bytes at offset of the sidecar index overwritten: the handle must not trust the index, it scans the archive
+// again, answers as before and writes a good index back. The offsets follow lib_tar_index.h: the header, a record for
+// the archive, then the entries
+int sidecar_corrupt_test(int fd, char *idx_path, off_t offset, uint32_t value) {
+    uint32_t read_back = value;
+    int idx = open(idx_path, O_RDWR);
+    if (idx == -1 || pwrite(idx, &value, 4, offset) != 4) { return 1; }
+    close(idx);
+    tar_t *tar = tar_open_index(fd, idx_path, 0);
+    tar_t *scanned = tar_open(fd, 0);
+    int res;
+    int errors = tar == NULL || scanned == NULL || !tar_is_dir(tar, "test_yey/") || !tar_is_symlink(tar, "lib_link.c")
+                 || count_query(tar, 0, "", 0, &res) != count_query(scanned, 0, "", 0, &res);
+    tar_close(tar);
+    tar_close(scanned);
+    idx = open(idx_path, O_RDONLY); // renamed over by the index written again
+    errors += idx == -1 || pread(idx, &read_back, 4, offset) != 4 || read_back == value;
+    close(idx);
+    return errors;
+}
+
+// ========== OVERLAY TESTING ==========
+
+// the content of the file at path in the handle is expected
+int read_is(tar_t *tar, char *path, char *expected) {
+    uint8_t dest[64];
+    size_t len = sizeof(dest);
+    return tar_read_file(tar, path, 0, dest, &len) == 0 && len == strlen(expected) && !memcmp(dest, expected, len);
+}
+
+// shadowed files, whiteouts of a file and of a directory, an opaque directory and a file replaced by a directory
+int overlay_check(tar_t *tar) {
+    char entries_data[4][TAR_PATH_MAX];
+    char *entries[4] = {entries_data[0], entries_data[1], entries_data[2], entries_data[3]};
+    int errors = !read_is(tar, "etc/passwd", "root,user") + !read_is(tar, "usr/bin/app", "v3");
+    errors += !read_is(tar, "usr/bin/app2", "v2") + !read_is(tar, "hard", "v3") + !read_is(tar, "var/cache/b", "b");
+    errors += tar_exists(tar, "etc/hosts") + tar_exists(tar, "etc/.wh.hosts") + tar_exists(tar, "var/cache/a");
+    errors += tar_exists(tar, "usr/share/doc/readme") + tar_exists(tar, "usr/share/doc/") + tar_is_file(tar, "link");
+    errors += !tar_is_dir(tar, "lib/") + tar_is_file(tar, "lib") + !tar_is_file(tar, "lib/x");
+    size_t no_entries = 4;
+    errors += !tar_list(tar, "var/cache/", entries, &no_entries) || no_entries != 1 || strcmp(entries[0], "var/cache/b");
+    no_entries = 4;
+    errors += !tar_list(tar, "usr/bin/", entries, &no_entries) || no_entries != 2;
+    int res;
+    errors += count_query(tar, 0, "usr/", 0, &res) != 3; // usr/, usr/bin/app and usr/bin/app2
+    return errors;
+}
+
+int overlay_test(char *paths[3], char *idx_path) {
+    int fds[3];
+    for (int i = 0; i < 3; i++) {
+        fds[i] = open(paths[i], O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fds[i] == -1) { return -1; }
+    }
+    char end[1024] = {0};
+    write_member(fds[0], "etc/", DIRTYPE, NULL, NULL);
+    write_member(fds[0], "etc/passwd", REGTYPE, NULL, "root");
+    write_member(fds[0], "etc/hosts", REGTYPE, NULL, "localhost");
+    write_member(fds[0], "usr/", DIRTYPE, NULL, NULL);
+    write_member(fds[0], "usr/bin/app", REGTYPE, NULL, "v1");
+    write_member(fds[0], "usr/share/doc/readme", REGTYPE, NULL, "doc");
+    write_member(fds[0], "var/cache/a", REGTYPE, NULL, "a");
+    write_member(fds[0], "lib", REGTYPE, NULL, "lib");
+    write_member(fds[0], "link", SYMTYPE, "etc/hosts", NULL);
+    write(fds[0], end, sizeof(end));
+    write_member(fds[1], "etc/passwd", REGTYPE, NULL, "root,user");
+    write_member(fds[1], "etc/.wh.hosts", REGTYPE, NULL, NULL);
+    write_member(fds[1], "usr/bin/app2", REGTYPE, NULL, "v2");
+    write_member(fds[1], "usr/share/.wh.doc", REGTYPE, NULL, NULL);
+    write_member(fds[1], "var/cache/.wh..wh..opq", REGTYPE, NULL, NULL);
+    write_member(fds[1], "var/cache/b", REGTYPE, NULL, "b");
+    write_member(fds[1], "lib/", DIRTYPE, NULL, NULL);
+    write_member(fds[1], "lib/x", REGTYPE, NULL, "x");
+    write_member(fds[1], "hard", LNKTYPE, "usr/bin/app", NULL);
+    write(fds[1], end, sizeof(end));
+    write_member(fds[2], "usr/bin/app", REGTYPE, NULL, "v3");
+    write(fds[2], end, sizeof(end));
+
+    int errors = 0;
+    unlink(idx_path);
+    for (int round = 0; round < 3; round++) { // scanned, then scanned and indexed, then mapped from the index
+        tar_t *tar = tar_open_layers(fds, 3, round == 0 ? NULL : idx_path, round == 2 ? TAR_MMAP : 0);
+        if (tar == NULL) { errors++; break; }
+        errors += overlay_check(tar);
+        errors += tar_check(tar) != check_archive(fds[0]) + check_archive(fds[1]) + check_archive(fds[2]);
+        tar_close(tar);
+    }
+    // an index of three layers is stale for two of them
+    tar_t *tar = tar_open_layers(fds, 2, idx_path, 0);
+    if (tar == NULL || !read_is(tar, "usr/bin/app", "v1") || !read_is(tar, "hard", "v1")) { errors++; }
+    tar_close(tar);
+    for (int i = 0; i < 3; i++) {
+        close(fds[i]);
+        unlink(paths[i]);
+    }
+    unlink(idx_path);
+    return errors;
+}
+
+// ========== DUPLICATE MEMBERS TESTING ==========
+
+// a file added again, and a file replaced by a symlink: the fd-based functions, the batches and the handle all
+// answer from the last member of a path, as tar extracts it
+int duplicate_test(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    write_member(fd, "dup", REGTYPE, NULL, "first");
+    write_member(fd, "other", REGTYPE, NULL, "other");
+    write_member(fd, "replaced", REGTYPE, NULL, "a file");
+    write_member(fd, "dup", REGTYPE, NULL, "second!");
+    write_member(fd, "replaced", SYMTYPE, "other", NULL);
+    char end[1024] = {0};
+    write(fd, end, sizeof(end));
+
+    uint8_t dest[16];
+    size_t len = sizeof(dest);
+    int errors = read_file(fd, "dup", 0, dest, &len) != 0 || len != 7 || memcmp(dest, "second!", 7);
+    len = sizeof(dest);
+    errors += read_file(fd, "replaced", 0, dest, &len) != 0 || len != 5 || memcmp(dest, "other", 5);
+    errors += !is_symlink(fd, "replaced") + is_file(fd, "replaced") + !is_file(fd, "dup");
+    tar_stats_t stats;
+    tar_stats_reset();
+    errors += !exists(fd, "dup");
+    if (tar_stats_get(&stats) == 0) { errors += stats.headers_scanned != 1; } // the first member of the path is enough
+    char *paths[3] = {"dup", "replaced", "dup"};
+    tar_lookup_t results[3];
+    errors += tar_lookup_batch(fd, paths, 3, results, 0) != 3 || results[0].size != 7 || results[1].typeflag != SYMTYPE;
+    errors += results[2].data_offset != results[0].data_offset || results[0].data_offset != 7 * 512;
+    // answered from the first members, the pass stops at the third header
+    tar_stats_reset();
+    errors += tar_lookup_batch(fd, paths, 3, results, TAR_LOOKUP_FIRST) != 3 || results[0].size != 5;
+    errors += results[1].typeflag != REGTYPE || results[2].data_offset != 512;
+    if (tar_stats_get(&stats) == 0) { errors += stats.headers_scanned != 3; }
+    tar_read_req_t reqs[2] = {{"dup", 0, dest, 7}, {"replaced", 0, &dest[8], 5}};
+    errors += tar_read_batch(fd, reqs, 2) || reqs[0].status != 0 || memcmp(dest, "second!", 7) || memcmp(&dest[8], "other", 5);
+    tar_t *tar = tar_open(fd, 0);
+    if (tar == NULL) { close(fd); return errors + 1; }
+    errors += !read_is(tar, "dup", "second!") + !read_is(tar, "replaced", "other") + !tar_is_symlink(tar, "replaced");
+    tar_close(tar);
+    close(fd);
+    unlink(path);
+    return errors;
+}
+
+// ========== LIST SCAN TESTING ==========
+
+// list() scans the headers without a handle: it must file the entries as the tree of a handle does
+int list_scan_test(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    write_member(fd, "named", DIRTYPE, NULL, NULL);     // a directory without its '/', then its entries
+    write_member(fd, "named/a", REGTYPE, NULL, "a");
+    write_member(fd, "late/a", REGTYPE, NULL, "a");     // an implicit "late/", then a directory "late" apart
+    write_member(fd, "late", DIRTYPE, NULL, NULL);
+    write_member(fd, "late/b", REGTYPE, NULL, "b");
+    write_member(fd, "file", REGTYPE, NULL, "f");       // a file, then an implicit directory of the same name
+    write_member(fd, "file/x", REGTYPE, NULL, "x");
+    write_member(fd, "deep/", DIRTYPE, NULL, NULL);
+    write_member(fd, "deep/sub/x/y", REGTYPE, NULL, "y");
+    write_member(fd, "deep/sub/", DIRTYPE, NULL, NULL);
+    write_member(fd, "deep/sub", DIRTYPE, NULL, NULL);
+    write_member(fd, "deep/z", REGTYPE, NULL, "1");
+    write_member(fd, "deep/z", REGTYPE, NULL, "2");
+    write_member(fd, "link", SYMTYPE, "deep", NULL);    // answered by a handle
+    write_member(fd, "turned/a", REGTYPE, NULL, "a");
+    write_member(fd, "turned/", REGTYPE, NULL, "a");     // no directory anymore
+    write_member(fd, "empty/", DIRTYPE, NULL, NULL);
+    char end[1024] = {0};
+    write(fd, end, sizeof(end));
+
+    tar_t *tar = tar_open(fd, 0);
+    if (tar == NULL) { close(fd); return -1; }
+    char *dirs[] = {"", "named", "named/", "late", "late/", "file", "file/", "deep", "deep/sub", "deep/sub/x/", "link",
+                    "turned", "nothing", "deep/z", "empty"};
+    char entries_data[2][8][TAR_PATH_MAX];
+    char *entries[2][8];
+    int errors = 0;
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        for (int e = 0; e < 8; e++) { entries[0][e] = entries_data[0][e]; entries[1][e] = entries_data[1][e]; }
+        size_t no_entries = 8, no_listed = 8;
+        int res = list(fd, dirs[i], entries[0], &no_entries);
+        errors += res != tar_list(tar, dirs[i], entries[1], &no_listed) || no_entries != no_listed;
+        for (size_t e = 0; e < no_entries && e < no_listed; e++) { errors += strcmp(entries[0][e], entries[1][e]) != 0; }
+    }
+    size_t no_entries = 2;
+    errors += !list(fd, "", entries[0], &no_entries) || no_entries != 2; // cut at the size of entries
+    no_entries = 8;
+    errors += !list(fd, "empty/", entries[0], &no_entries) || no_entries != 0;
+    tar_close(tar);
+    close(fd);
+    unlink(path);
+
+    // an archive that cannot be read lists nothing and reads nothing
+    int dir_fd = open(".", O_RDONLY);
+    uint8_t dest[8];
+    size_t len = sizeof(dest);
+    no_entries = 8;
+    errors += list(dir_fd, "", entries[0], &no_entries) != 0 || no_entries != 0;
+    errors += read_file(dir_fd, "named/a", 0, dest, &len) != -3 || len != 0;
+    close(dir_fd);
+    return errors;
+}
+
+// ========== PATH STORAGE TESTING ==========
+
+// a path in the ustar prefix, names shared by several directories, and a directory named without its '/' whose
+// siblings sort between "lib" and "lib/x"
+int path_storage_check(tar_t *tar, char *long_dir, char *long_path) {
+    char entries_data[4][TAR_PATH_MAX];
+    char *entries[4] = {entries_data[0], entries_data[1], entries_data[2], entries_data[3]};
+    int res;
+    int errors = !read_is(tar, "a/README", "a") + !read_is(tar, "b/README", "b") + !read_is(tar, long_path, "long");
+    errors += !tar_is_dir(tar, "lib") + !read_is(tar, "lib/x", "x") + tar_exists(tar, "README");
+    size_t no_entries = 4;
+    errors += !tar_list(tar, long_dir, entries, &no_entries) || no_entries != 1 || strcmp(entries[0], long_path);
+    char arena[260];
+    tar_name_t name;
+    size_t no_names = 1, arena_size = sizeof(arena);
+    tar_cursor_t cursor = TAR_CURSOR_START;
+    errors += tar_list_arena(tar, long_dir, &cursor, &name, &no_names, arena, &arena_size) != 1 || no_names != 1
+        || name.len != strlen(long_path) || strcmp(&arena[name.offset], long_path) || cursor != TAR_CURSOR_END;
+    errors += count_query(tar, 0, long_dir, 0, &res) != 2; // the directory and its file
+    errors += count_query(tar, 0, "lib", 0, &res) != 4 || count_query(tar, 0, "", 0, &res) != 8;
+    errors += count_query(tar, 1, "*/README", 0, &res) != 2;
+    return errors;
+}
+
+int path_storage_test(char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    char long_dir[160], long_path[180];
+    memset(long_dir, 'p', 121);
+    long_dir[60] = '/';
+    strcpy(&long_dir[121], "/");
+    snprintf(long_path, sizeof(long_path), "%sfile.txt", long_dir);
+    char end[1024] = {0};
+    write_member(fd, "a/README", REGTYPE, NULL, "a");
+    write_member(fd, "b/README", REGTYPE, NULL, "b");
+    write_member(fd, "lib", DIRTYPE, NULL, NULL);
+    write_member(fd, "lib/x", REGTYPE, NULL, "x");
+    write_member(fd, "lib-dev", REGTYPE, NULL, "dev");
+    write_member(fd, "lib.so", REGTYPE, NULL, "so");
+    write_member(fd, long_dir, DIRTYPE, NULL, NULL);
+    write_member(fd, long_path, REGTYPE, NULL, "long");
+    write(fd, end, sizeof(end));
+
+    int errors = exists(fd, long_path) != 1 || is_file(fd, long_path) != 1;
+    char idx_path[256];
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    unlink(idx_path);
+    for (int round = 0; round < 3; round++) { // scanned, scanned and indexed, then mapped from the index
+        tar_t *tar = round == 0 ? tar_open(fd, 0) : tar_open_index(fd, idx_path, 0);
+        if (tar == NULL) { errors++; break; }
+        errors += path_storage_check(tar, long_dir, long_path);
+        tar_close(tar);
+    }
+    close(fd);
+    unlink(path);
+    unlink(idx_path);
+    return errors;
+}
+
+// ========== RELAYOUT TESTING ==========
+
+typedef struct relayout_order {
+    char names[8][101];
+    uint64_t offsets[8];
+    int no_names;
+} relayout_order_t;
+
+int record_member(const tar_header_t *header, uint64_t offset, void *arg) {
+    relayout_order_t *order = arg;
+    if (header->typeflag == XHDTYPE || header->typeflag == XGLTYPE || order->no_names == 8) { return 0; }
+    memcpy(order->names[order->no_names], header->name, 100);
+    order->names[order->no_names][100] = '\0';
+    order->offsets[order->no_names++] = offset;
+    return 0;
+}
+
+// grouped by directory, a large file on a page boundary, a hard link moved after its target and a shadowed member
+int relayout_test(char *path, char *out_path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int out = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || out == -1) { return -1; }
+    char big[5001];
+    memset(big, 'x', 5000);
+    big[5000] = '\0';
+    char end[1024] = {0};
+    write_member(fd, "b/", DIRTYPE, NULL, NULL);
+    write_member(fd, "b/big", REGTYPE, NULL, big);
+    write_member(fd, "a", REGTYPE, NULL, "a1");
+    write_member(fd, "hard", LNKTYPE, "z/late", NULL);
+    write_member(fd, "b/small", REGTYPE, NULL, "s");
+    write_member(fd, "z/late", REGTYPE, NULL, "late");
+    write_member(fd, "a", REGTYPE, NULL, "a2");
+    write_member(fd, "b/c/d", REGTYPE, NULL, "d");
+    write(fd, end, sizeof(end));
+
+    int errors = tar_relayout(fd, out, TAR_RELAYOUT_ALIGN | TAR_RELAYOUT_INDEX) != 7;
+    relayout_order_t order = {.no_names = 0};
+    tar_foreach_header(out, record_member, &order);
+    char *expected[7] = {"a", "b/", "b/big", "b/small", "b/c/d", "z/late", "hard"};
+    for (int i = 0; i < 7; i++) { errors += order.no_names != 7 || strcmp(order.names[i], expected[i]); }
+    errors += (order.offsets[2] + 512) % 4096 != 0;
+
+    tar_t *tar = tar_open(fd, 0);
+    tar_t *relaid = tar_open(out, 0);
+    if (tar == NULL || relaid == NULL) { return errors + 1; }
+    errors += !read_is(relaid, "a", "a2") + !read_is(relaid, "hard", "late") + !read_is(relaid, "b/c/d", "d");
+    uint8_t content[5000];
+    size_t len = sizeof(content);
+    errors += tar_read_file(relaid, "b/big", 0, content, &len) != 0 || len != 5000 || memcmp(content, big, len);
+    char entries_data[2][8][TAR_PATH_MAX];
+    char *entries[2][8];
+    for (int i = 0; i < 16; i++) { entries[i / 8][i % 8] = entries_data[i / 8][i % 8]; }
+    char *dirs[2] = {"", "b/"};
+    for (int i = 0; i < 2; i++) {
+        size_t no_entries = 8, no_relaid = 8;
+        errors += !tar_list(tar, dirs[i], entries[0], &no_entries) || !tar_list(relaid, dirs[i], entries[1], &no_relaid);
+        errors += no_entries != no_relaid;
+    }
+    errors += check_archive(out) <= 0;
+    tar_close(relaid);
+    tar_close(tar);
+    close(fd);
+    close(out);
+    unlink(path);
+    unlink(out_path);
+    return errors;
+}
+
+typedef struct relayout_headers {
+    char typeflags[16];
+    uint64_t offsets[16];
+    int no_headers;
+} relayout_headers_t;
+
+int record_header(const tar_header_t *header, uint64_t offset, void *arg) {
+    relayout_headers_t *headers = arg;
+    if (headers->no_headers == 16) { return 0; }
+    headers->typeflags[headers->no_headers] = header->typeflag;
+    headers->offsets[headers->no_headers++] = offset;
+    return 0;
+}
+
+// a pax extended header goes with its member, before the padding aligning it; comments are dropped, global records refused
+int relayout_pax_test(char *path, char *out_path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int out = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || out == -1) { return -1; }
+    char big[5001];
+    memset(big, 'x', 5000);
+    big[5000] = '\0';
+    char *mtime = "22 mtime=1700000000.5\n";
+    char end[1024] = {0};
+    write_member(fd, "z", REGTYPE, NULL, "z");
+    write_member(fd, "././@PaxHeader", XHDTYPE, NULL, "13 comment=x\n");
+    write_member(fd, "b", REGTYPE, NULL, "b");
+    write_member(fd, "././@PaxHeader", XHDTYPE, NULL, mtime);
+    write_member(fd, "a", REGTYPE, NULL, big);
+    write(fd, end, sizeof(end));
+
+    // a, with its extended header and a global padding before, b without the comment, then z
+    int errors = tar_relayout(fd, out, TAR_RELAYOUT_ALIGN) != 3;
+    relayout_headers_t headers = {.no_headers = 0};
+    tar_foreach_header(out, record_header, &headers);
+    errors += headers.no_headers != 5 || strncmp(headers.typeflags, "gx000", 5);
+    errors += (headers.offsets[2] + 512) % 4096 != 0;
+    char record[22];
+    errors += pread(out, record, sizeof(record), headers.offsets[1] + 512) != sizeof(record) || memcmp(record, mtime, 22);
+
+    // the output rewritten again: its paddings are dropped, the extended header is kept
+    int again = open(path, O_RDWR | O_TRUNC);
+    errors += tar_relayout(out, again, TAR_RELAYOUT_INDEX) != 3;
+    headers.no_headers = 0;
+    tar_foreach_header(again, record_header, &headers);
+    errors += headers.no_headers < 5 || strncmp(headers.typeflags, "x000g", 5); // the index after a padding
+    tar_t *tar = tar_open(again, 0);
+    errors += tar == NULL || !read_is(tar, "b", "b") || !read_is(tar, "z", "z");
+    tar_close(tar);
+    close(again);
+
+    // records in a global header apply to every later member: refused
+    ftruncate(fd, 0);
+    lseek(fd, 0, SEEK_SET);
+    write_member(fd, "a", REGTYPE, NULL, "a");
+    write_member(fd, "././@PaxHeader", XGLTYPE, NULL, "14 path=other\n");
+    write_member(fd, "b", REGTYPE, NULL, "b");
+    write(fd, end, sizeof(end));
+    ftruncate(out, 0);
+    errors += tar_relayout(fd, out, 0) != -6;
+    close(fd);
+    close(out);
+    unlink(path);
+    unlink(out_path);
+    return errors;
+}
+
+// ========== WRITER TESTING ==========
+
+// whether the file at path of the handle holds len bytes equal to data
+int content_is(tar_t *tar, char *path, const uint8_t *data, size_t len) {
+    uint8_t *content = malloc(len + 1);
+    size_t read_len = len + 1;
+    int same = tar_read_file(tar, path, 0, content, &read_len) == 0 && read_len == len && !memcmp(content, data, len);
+    free(content);
+    return same;
+}
+
+// an archive created, then appended to through a handle and its sidecar index, then over the index of tar_relayout()
+int writer_test(char *path, char *src_path, char *idx_path, char *out_path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int src = open(src_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int out = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || src == -1 || out == -1) { return -1; }
+    size_t big_len = 3 * 1024 * 1024 + 7; // larger than the buffer of the writer
+    uint8_t *big = malloc(big_len);
+    for (size_t i = 0; i < big_len; i++) { big[i] = i * 7 % 251; }
+    write(src, big, big_len);
+    char long_path[201];
+    memset(long_path, 'w', 200);
+    long_path[100] = '/';
+    long_path[200] = '\0';
+    char too_long[301];
+    memset(too_long, 'w', 300);
+    too_long[300] = '\0';
+    int pipe_fds[2];
+    if (pipe(pipe_fds)) { return -1; }
+
+    tar_writer_t *writer = tar_writer_open(fd, NULL, NULL, 0);
+    if (writer == NULL) { return -1; }
+    int errors = tar_writer_add_entry(writer, "dir/", DIRTYPE, NULL) + tar_writer_add(writer, "dir/a.txt", "old", 3);
+    errors += tar_writer_add(writer, long_path, "long", 4) + tar_writer_add_entry(writer, "link", SYMTYPE, "dir/a.txt");
+    errors += tar_writer_add_fd(writer, "big.bin", src) + tar_writer_add(writer, "empty", NULL, 0);
+    errors += tar_writer_add(writer, too_long, "x", 1) != -1 || tar_writer_add_entry(writer, "x", SYMTYPE, NULL) != -1;
+    errors += tar_writer_add_fd(writer, "pipe", pipe_fds[0]) != -4;
+    errors += tar_writer_close(writer) != 0;
+    errors += check_archive(fd) != 6;
+
+    // appended through a handle: the sidecar index is written again and maps without a scan
+    tar_t *tar = tar_open_index(fd, idx_path, 0);
+    if (tar == NULL) { return errors + 1; }
+    errors += !read_is(tar, "link", "old") + !read_is(tar, long_path, "long") + !content_is(tar, "big.bin", big, big_len);
+    writer = tar_writer_open(fd, tar, idx_path, TAR_WRITER_APPEND);
+    if (writer == NULL) { return errors + 1; }
+    errors += tar_writer_add(writer, "dir/b.txt", "b", 1) + tar_writer_add(writer, "dir/a.txt", "new", 3);
+    errors += tar_writer_add_entry(writer, "hard", LNKTYPE, "dir/b.txt");
+    errors += tar_writer_flush(writer) != 0;
+    errors += !read_is(tar, "link", "new") + !read_is(tar, "hard", "b") + !content_is(tar, "big.bin", big, big_len);
+    errors += tar_writer_add_fd(writer, "dir/big.bin", src) + tar_writer_close(writer);
+    errors += check_archive(fd) != 10 || !content_is(tar, "dir/big.bin", big, big_len);
+    char *entries[4] = {malloc(TAR_PATH_MAX), malloc(TAR_PATH_MAX), malloc(TAR_PATH_MAX), malloc(TAR_PATH_MAX)};
+    size_t no_entries = 4;
+    errors += !tar_list(tar, "dir", entries, &no_entries) || no_entries != 3;
+    tar_close(tar);
+    struct stat idx_st, reopened_st;
+    stat(idx_path, &idx_st);
+    tar = tar_open_index(fd, idx_path, TAR_MMAP);
+    stat(idx_path, &reopened_st);
+    errors += idx_st.st_mtim.tv_nsec != reopened_st.st_mtim.tv_nsec || idx_st.st_mtim.tv_sec != reopened_st.st_mtim.tv_sec;
+    if (tar == NULL) { return errors + 1; }
+    errors += !read_is(tar, "link", "new") + !read_is(tar, "hard", "b") + !content_is(tar, "dir/big.bin", big, big_len);
+
+    // appended to a mapped handle on an archive ending with its index, then without any handle
+    errors += tar_relayout(fd, out, TAR_RELAYOUT_INDEX) != 9;
+    tar_close(tar);
+    tar = tar_open(out, TAR_MMAP);
+    writer = tar_writer_open(out, tar, NULL, TAR_WRITER_APPEND);
+    if (tar == NULL || writer == NULL) { return errors + 1; }
+    errors += tar_writer_add(writer, "late.txt", "late", 4) + tar_writer_close(writer);
+    errors += !read_is(tar, "late.txt", "late") + !read_is(tar, "dir/a.txt", "new");
+    tar_close(tar);
+    writer = tar_writer_open(out, NULL, NULL, TAR_WRITER_APPEND);
+    errors += writer == NULL || tar_writer_add(writer, "later.txt", "later", 5) || tar_writer_close(writer);
+    tar = tar_open(out, 0);
+    if (tar == NULL) { return errors + 1; }
+    errors += !read_is(tar, "late.txt", "late") + !read_is(tar, "later.txt", "later") + !read_is(tar, "hard", "b");
+    errors += check_archive(out) != 11 || !content_is(tar, "big.bin", big, big_len);
+    tar_close(tar);
+
+    for (int i = 0; i < 4; i++) { free(entries[i]); }
+    free(big);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    close(fd);
+    close(src);
+    close(out);
+    unlink(path);
+    unlink(src_path);
+    unlink(idx_path);
+    unlink(out_path);
+    return errors;
+}
+
+// the sidecar index at idx_path is the same file, grown or not since st
+int same_index(char *idx_path, struct stat *st, int grown) {
+    struct stat now;
+    return stat(idx_path, &now) == 0 && now.st_ino == st->st_ino && (now.st_size > st->st_size) == grown;
+}
+
+// links resolved again by the flushes of a writer as the paths they name are added, in deltas appended to the sidecar
+int writer_delta_test(char *path, char *idx_path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) { return -1; }
+    unlink(idx_path);
+    tar_writer_t *writer = tar_writer_open(fd, NULL, NULL, 0);
+    if (writer == NULL) { return -1; }
+    int errors = tar_writer_add_entry(writer, "d/", DIRTYPE, NULL) + tar_writer_add_entry(writer, "l1", SYMTYPE, "d/f");
+    errors += tar_writer_add_entry(writer, "l2", SYMTYPE, "l1") + tar_writer_add_entry(writer, "dl", SYMTYPE, "d");
+    errors += tar_writer_add_entry(writer, "x", SYMTYPE, "dl/g") + tar_writer_close(writer);
+
+    // the first flush writes the index whole with room to spare, the next ones append to it
+    tar_t *tar = tar_open_index(fd, idx_path, 0);
+    writer = tar == NULL ? NULL : tar_writer_open(fd, tar, idx_path, TAR_WRITER_APPEND);
+    if (writer == NULL) { return errors + 1; }
+    errors += tar_writer_add(writer, "other", "o", 1) + tar_writer_flush(writer);
+    struct stat st;
+    stat(idx_path, &st);
+    errors += read_is(tar, "l2", "f") || read_is(tar, "x", "g");
+    errors += tar_writer_add(writer, "d/f", "f", 1) + tar_writer_add(writer, "d/g", "g", 1) + tar_writer_flush(writer);
+    errors += !read_is(tar, "l2", "f") + !read_is(tar, "x", "g") + !same_index(idx_path, &st, 1);
+    stat(idx_path, &st);
+    errors += tar_writer_add(writer, "d/f", "f2", 2) + tar_writer_add_entry(writer, "e/", DIRTYPE, NULL);
+    errors += tar_writer_add(writer, "e/g", "eg", 2) + tar_writer_add_entry(writer, "dl", SYMTYPE, "e");
+    errors += tar_writer_flush(writer) + tar_writer_close(writer);
+    errors += !read_is(tar, "l2", "f2") + !read_is(tar, "x", "eg") + !same_index(idx_path, &st, 1);
+    tar_close(tar);
+
+    // the deltas applied when the index is mapped, as a scan of the archive would find the links
+    stat(idx_path, &st);
+    tar = tar_open_index(fd, idx_path, TAR_MMAP);
+    tar_t *scanned = tar_open(fd, 0);
+    if (tar == NULL || scanned == NULL) { return errors + 1; }
+    errors += !same_index(idx_path, &st, 0);
+    char *names[] = {"l1", "l2", "x", "e/g", "d/g", "other"};
+    char *contents[] = {"f2", "f2", "eg", "eg", "g", "o"};
+    for (int i = 0; i < 6; i++) { errors += !read_is(tar, names[i], contents[i]) + !read_is(scanned, names[i], contents[i]); }
+    tar_close(scanned);
+
+    // more entries than the room left: the index is written whole again, with more room
+    writer = tar_writer_open(fd, tar, idx_path, TAR_WRITER_APPEND);
+    if (writer == NULL) { return errors + 1; }
+    char name[32];
+    for (int i = 0; i < 200; i++) {
+        sprintf(name, "many/%d", i);
+        errors += tar_writer_add(writer, name, name, strlen(name));
+    }
+    errors += tar_writer_flush(writer);
+    struct stat compacted;
+    stat(idx_path, &compacted);
+    errors += compacted.st_ino == st.st_ino;
+    errors += tar_writer_add(writer, "last", "last", 4) + tar_writer_close(writer) + !same_index(idx_path, &compacted, 1);
+    tar_close(tar);
+    tar = tar_open_index(fd, idx_path, TAR_MMAP);
+    if (tar == NULL) { return errors + 1; }
+    errors += !read_is(tar, "many/199", "many/199") + !read_is(tar, "last", "last") + !read_is(tar, "x", "eg");
+    tar_close(tar);
+
+    // a partial delta makes the index invalid: the archive is scanned again
+    stat(idx_path, &st);
+    truncate(idx_path, st.st_size - 8);
+    tar = tar_open_index(fd, idx_path, 0);
+    if (tar == NULL) { return errors + 1; }
+    errors += !read_is(tar, "last", "last") + !read_is(tar, "l2", "f2");
+    tar_close(tar);
+
+    close(fd);
+    unlink(path);
+    unlink(idx_path);
+    return errors;
+}
+
+int count_header(const tar_header_t *header, uint64_t offset, void *arg) {
+    (*(int *) arg)++;
+    return 0;
+}
+
 int main(int argc, char **argv) {
     if (argc < 2) {
         printf("Usage: %s tar_file\n", argv[0]);
@@ -41,6 +1180,8 @@ int main(int argc, char **argv) {
     // Check_archive & exists
     int ret = check_archive(fd);
     printf("check_archive returned %d\n", ret);
+    int counted = 0;
+    if (tar_foreach_header(fd, count_header, &counted) == 0 && counted == ret) {printf("Headers well visited !\n");} else {printf("Headers not visited :(\n");}
     int exst = exists(fd, "lib_tar.h");
     if (exst) {
         printf("Exists : lib_tar.h found !\n");
@@ -48,6 +1189,15 @@ int main(int argc, char **argv) {
         printf("Exists : lib_tar.h not found :(\n");
     }
 
+    // Batch lookup
+    char *batch[] = {"lib_tar.h", "test_yey/", "notarealfile", "lib_link.c", "lib_tar.h"};
+    tar_lookup_t results[5];
+    int batch_found = tar_lookup_batch(fd, batch, 5, results, 0);
+    if (batch_found == 4 && results[0].found && results[1].typeflag == DIRTYPE && !results[2].found
+        && results[3].typeflag == SYMTYPE && results[4].size == results[0].size) {
+        printf("Batch lookup ok !\n");
+    } else {printf("Batch lookup wrong (%d) :(\n", batch_found);}
+
     // ========== FILE NATURE TESTING ==========
     // Is file
     int file1 = is_file(fd, "lib_tar.h");
@@ -70,7 +1220,7 @@ int main(int argc, char **argv) {
     // ========== LIST TESTING ==========
     // List -- good (folder)
     size_t no_entries = 10;
-    char *entries[10]; for (int i=0; i<10; i++){ entries[i] = malloc(sizeof(char)*100);}
+    char *entries[10]; for (int i=0; i<10; i++){ entries[i] = malloc(sizeof(char)*TAR_PATH_MAX);}
     int listresult = list(fd, "coucoucfolder/", (char **)entries, &no_entries);
     if (listresult) {
         printf("List well built ! (%d)\n", (int)no_entries);
@@ -163,5 +1313,238 @@ int main(int argc, char **argv) {
     printf("Content of the file : %s\n", dest);
     printf("Number written bytes/len : %ld\n", len);
 
+    // Read many files at once, each request must give the same result as read_file()
+    uint8_t dests[4][10];
+    tar_read_req_t reqs[4] = {
+        {path, offset, dests[0], 10}, {"lib_link.c", 0, dests[1], 10}, {"test_yey/", 0, dests[2], 10}, {path, 1000, dests[3], 10}
+    };
+    uint8_t expected[10];
+    size_t expected_len = 10;
+    ssize_t expected_res = read_file(fd, "lib_tar.c", 0, expected, &expected_len);
+    if (tar_read_batch(fd, reqs, 4) == 0 && reqs[0].status == read_res && reqs[0].len == len && !memcmp(dests[0], dest, len)
+        && reqs[1].status == expected_res && reqs[1].len == expected_len && !memcmp(dests[1], expected, expected_len)
+        && reqs[2].status == -1 && reqs[3].status == -2) {
+        printf("Batch read ok !\n");
+    } else {printf("Batch read wrong :(\n");}
+
+    // ========== HANDLE TESTING ==========
+    printf("\n");
+    tar_t *tar = tar_open(fd, 0);
+    if (tar == NULL) {printf("Handle not opened :(\n"); return -1;}
+    if (tar_exists(tar, "lib_tar.h") && !tar_exists(tar, "notarealfile")) {printf("Handle exists ok !\n");} else {printf("Handle exists wrong :(\n");}
+    if (tar_is_file(tar, "lib_tar.h") && !tar_is_file(tar, "folder/")) {printf("Handle is_file ok !\n");} else {printf("Handle is_file wrong :(\n");}
+    if (tar_is_dir(tar, "test_yey/") && !tar_is_dir(tar, "lib_tar.h")) {printf("Handle is_dir ok !\n");} else {printf("Handle is_dir wrong :(\n");}
+    if (tar_is_symlink(tar, "lib_link.c") && !tar_is_symlink(tar, "lib_tar.h")) {printf("Handle is_symlink ok !\n");} else {printf("Handle is_symlink wrong :(\n");}
+
+    no_entries = 10;
+    listresult = tar_list(tar, "coucouclinklink", (char **)entries, &no_entries);
+    if (listresult) {printf("Handle list well built ! (%d)\n", (int)no_entries);} else {printf("Handle list not built :(\n");}
+    no_entries = 10;
+    listresult = tar_list(tar, "lib_tar.c", (char **)entries, &no_entries);
+    if (!listresult) {printf("Handle list well not built !\n");} else {printf("Handle list wrongly built (%d) :(\n", (int)no_entries);}
+
+    // paging through the root, 3 entries at a time, must list the same entries as one call
+    size_t total = 0;
+    int pages_ok = 1;
+    tar_cursor_t cursor = TAR_CURSOR_START;
+    do {
+        size_t page = 3;
+        pages_ok &= tar_list_page(tar, "", &cursor, (char **)entries, &page) != 0;
+        total += page;
+    } while (cursor != TAR_CURSOR_END && pages_ok);
+    no_entries = 10;
+    tar_list(tar, "", (char **)entries, &no_entries);
+    if (pages_ok && total == no_entries) {printf("Handle list pages ok ! (%d)\n", (int)total);} else {printf("Handle list pages wrong :(\n");}
+
+    // the same entries in an arena of 64 bytes, whole, a path that does not fit asks for more space
+    char arena[64];
+    tar_name_t names[10];
+    int arena_ok = 1;
+    total = 0;
+    cursor = TAR_CURSOR_START;
+    do {
+        size_t no_names = 10, arena_size = sizeof(arena);
+        arena_ok &= tar_list_arena(tar, "", &cursor, names, &no_names, arena, &arena_size) == 1 && no_names > 0;
+        for (size_t i = 0; i < no_names && arena_ok; i++, total++) {
+            arena_ok &= names[i].offset + names[i].len < arena_size && arena[names[i].offset + names[i].len] == '\0'
+                && !strcmp(entries[total], &arena[names[i].offset]);
+        }
+    } while (cursor != TAR_CURSOR_END && arena_ok);
+    size_t no_names = 10, arena_size = 1;
+    cursor = TAR_CURSOR_START;
+    arena_ok &= tar_list_arena(tar, "", &cursor, names, &no_names, arena, &arena_size) == -1 && no_names == 0
+        && arena_size == strlen(entries[0]) + 1 && cursor == TAR_CURSOR_START;
+    if (arena_ok && total == no_entries) {printf("Handle list arena ok ! (%d)\n", (int)total);} else {printf("Handle list arena wrong :(\n");}
+
+    uint8_t dest2[10];
+    size_t len2 = 10;
+    ssize_t read_res2 = tar_read_file(tar, path, offset, dest2, &len2);
+    if (read_res2 == read_res && len2 == len && !memcmp(dest, dest2, len)) {printf("Handle read_file ok !\n");} else {printf("Handle read_file wrong (%ld) :(\n", read_res2);}
+
+    // the same range sent to a pipe (splice) and to a socket (sendfile)
+    int send_ok = 1;
+    for (int kind = 0; kind < 2; kind++) {
+        int fds[2];
+        if (kind == 0 ? pipe(fds) : socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) { send_ok = 0; break; }
+        size_t send_len = 10;
+        ssize_t send_res = tar_send_member(tar, path, fds[1], offset, &send_len);
+        uint8_t sent[10];
+        send_ok &= send_res == read_res && send_len == len && read(fds[0], sent, send_len) == (ssize_t) len && !memcmp(sent, dest, len);
+        send_len = SIZE_MAX;
+        send_ok &= tar_send_member(tar, "folder/", fds[1], 0, &send_len) == -1 && send_len == 0;
+        close(fds[0]);
+        close(fds[1]);
+    }
+    if (send_ok) {printf("Handle send_member ok !\n");} else {printf("Handle send_member wrong :(\n");}
+
+    if (query_test("query_test.tar", "query_test.tar.idx") == 0) {printf("Handle queries ok !\n");} else {printf("Handle queries wrong :(\n");}
+
+    int errors = stress_test(tar, fd, path);
+    if (errors == 0) {printf("Stress test ok !\n");} else {printf("Stress test wrong (%d errors) :(\n", errors);}
+    tar_close(tar);
+
+    // ========== LAZY TESTING ==========
+    errors = lazy_test(fd);
+    if (errors == 0) {printf("Lazy handle ok !\n");} else {printf("Lazy handle wrong (%d errors) :(\n", errors);}
+    errors = lazy_error_test("lazy_error_test.tar");
+    if (errors == 0) {printf("Lazy handle read error ok !\n");} else {printf("Lazy handle read error wrong (%d errors) :(\n", errors);}
+
+    // ========== ASYNC TESTING ==========
+    tar = tar_open(fd, 0);
+    int backends[2] = {0, TAR_AIO_THREADS};
+    for (int b = 0; b < 2; b++) {
+        tar_aio_t *aio = tar_aio_create(tar, 4, backends[b]);
+        uint8_t aio_dests[6][10];
+        tar_aio_req_t aio_reqs[6];
+        tar_aio_req_t *completed[6];
+        int aio_errors = 0;
+        for (int i = 0; i < 6; i++) {
+            aio_reqs[i] = (tar_aio_req_t) {i == 5 ? "notarealfile" : path, offset, aio_dests[i], 10};
+            while (tar_aio_submit(aio, &aio_reqs[i])) { // full: make room
+                int n = tar_aio_complete(aio, completed, 6, 1);
+                if (n < 1) { aio_errors++; break; }
+            }
+        }
+        while (tar_aio_complete(aio, completed, 6, 6) > 0) {}
+        for (int i = 0; i < 6; i++) {
+            if (i < 5 && (aio_reqs[i].status != read_res || aio_reqs[i].len != len || memcmp(aio_dests[i], dest, len))) { aio_errors++; }
+            if (i == 5 && aio_reqs[i].status != -1) { aio_errors++; }
+        }
+        if (aio_errors == 0) {printf("Async read ok ! (%s)\n", tar_aio_backend(aio) == TAR_AIO_URING ? "io_uring" : "threads");}
+        else {printf("Async read wrong (%d errors) :(\n", aio_errors);}
+        tar_aio_destroy(aio);
+    }
+    tar_close(tar);
+
+    // ========== MMAP TESTING ==========
+    tar = tar_open(fd, TAR_MMAP | TAR_RANDOM);
+    if (tar == NULL) {printf("Mapped handle not opened :(\n"); return -1;}
+    if (tar_check(tar) == ret) {printf("Mapped check ok !\n");} else {printf("Mapped check wrong :(\n");}
+    const uint8_t *view;
+    size_t view_size;
+    if (tar_file_view(tar, path, &view, &view_size) == 0 && view_size > offset + len && !memcmp(&view[offset], dest, len)) {
+        printf("File view ok !\n");
+    } else {printf("File view wrong :(\n");}
+    if (tar_file_view(tar, "test_yey/", &view, &view_size) == -1) {printf("File view well refused !\n");} else {printf("File view wrongly given :(\n");}
+    errors = stress_test(tar, fd, path);
+    if (errors == 0) {printf("Mapped stress test ok !\n");} else {printf("Mapped stress test wrong (%d errors) :(\n", errors);}
+    tar_close(tar);
+
+    // ========== SIDECAR INDEX TESTING ==========
+    char idx_path[256];
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", argv[1]);
+    unlink(idx_path);
+    tar_close(tar_open_index(fd, idx_path, 0)); // no index yet: scans the archive and writes it
+    tar = tar_open_index(fd, idx_path, 0);
+    if (tar == NULL) {printf("Indexed handle not opened :(\n"); return -1;}
+    len2 = 10;
+    if (tar_is_dir(tar, "test_yey/") && tar_is_symlink(tar, "lib_link.c") && !tar_exists(tar, "notarealfile")
+        && tar_read_file(tar, path, offset, dest2, &len2) == read_res && !memcmp(dest, dest2, len)) {
+        printf("Sidecar index ok !\n");
+    } else {printf("Sidecar index wrong :(\n");}
+    tar_t *scanned = tar_open(fd, 0);
+    int res_query;
+    if (scanned != NULL && count_query(tar, 1, "*", 0, &res_query) == count_query(scanned, 1, "*", 0, &res_query)
+        && count_query(tar, 0, "", 0, &res_query) == count_query(scanned, 0, "", 0, &res_query)) {
+        printf("Sidecar index queries ok !\n");
+    } else {printf("Sidecar index queries wrong :(\n");}
+    tar_close(scanned);
+    tar_close(tar);
+    // another byte order, a parent after its entry, a sibling loop and a name out of the string pool
+    off_t first_entry = sizeof(tar_index_header_t) + sizeof(tar_index_layer_t);
+    errors = sidecar_corrupt_test(fd, idx_path, offsetof(tar_index_header_t, byte_order), 0x04030201)
+             + sidecar_corrupt_test(fd, idx_path, first_entry + sizeof(tar_entry_t) + offsetof(tar_entry_t, parent), 1);
+    errors += sidecar_corrupt_test(fd, idx_path, first_entry + sizeof(tar_entry_t) + offsetof(tar_entry_t, next_sibling), 1)
+              + sidecar_corrupt_test(fd, idx_path, first_entry + 2 * sizeof(tar_entry_t) + offsetof(tar_entry_t, name), 1 << 30);
+    if (errors == 0) {printf("Sidecar index checks ok !\n");} else {printf("Sidecar index checks wrong (%d errors) :(\n", errors);}
+    unlink(idx_path);
+
+    // ========== LINK TESTING ==========
+    errors = link_test("links_test.tar");
+    if (errors == 0) {printf("Links resolution ok !\n");} else {printf("Links resolution wrong (%d errors) :(\n", errors);}
+
+    // ========== DUPLICATE MEMBERS TESTING ==========
+    errors = duplicate_test("duplicate_test.tar");
+    if (errors == 0) {printf("Duplicate members ok !\n");} else {printf("Duplicate members wrong (%d errors) :(\n", errors);}
+
+    // ========== LIST SCAN TESTING ==========
+    errors = list_scan_test("list_scan_test.tar");
+    if (errors == 0) {printf("List scan ok !\n");} else {printf("List scan wrong (%d errors) :(\n", errors);}
+
+    // ========== LARGE ARCHIVE TESTING ==========
+    errors = large_test("large_test.tar");
+    if (errors == 0) {printf("Large archive ok !\n");} else {printf("Large archive wrong (%d errors) :(\n", errors);}
+
+    // ========== COMPRESSED TESTING ==========
+    errors = compressed_test("compressed_test.tar", "compressed_test.tar.gz", "compressed_test.tar.gz.idx");
+    if (errors == 0) {printf("Compressed archive ok !\n");} else {printf("Compressed archive wrong (%d errors) :(\n", errors);}
+
+    // ========== EXTRACTION TESTING ==========
+    errors = extract_test("extract_test.tar", "extract_test");
+    if (errors == 0) {printf("Extraction ok !\n");} else {printf("Extraction wrong (%d errors) :(\n", errors);}
+
+    // ========== OVERLAY TESTING ==========
+    char *layer_paths[3] = {"layer0_test.tar", "layer1_test.tar", "layer2_test.tar"};
+    errors = overlay_test(layer_paths, "layers_test.idx");
+    if (errors == 0) {printf("Overlay ok !\n");} else {printf("Overlay wrong (%d errors) :(\n", errors);}
+
+    // ========== PATH STORAGE TESTING ==========
+    errors = path_storage_test("paths_test.tar");
+    if (errors == 0) {printf("Path storage ok !\n");} else {printf("Path storage wrong (%d errors) :(\n", errors);}
+
+    // ========== RELAYOUT TESTING ==========
+    errors = relayout_test("relayout_in_test.tar", "relayout_out_test.tar");
+    if (errors == 0) {printf("Relayout ok !\n");} else {printf("Relayout wrong (%d errors) :(\n", errors);}
+    errors = relayout_pax_test("relayout_pax_test.tar", "relayout_pax_out_test.tar");
+    if (errors == 0) {printf("Relayout of pax headers ok !\n");} else {printf("Relayout of pax headers wrong (%d errors) :(\n", errors);}
+
+    // ========== WRITER TESTING ==========
+    errors = writer_test("writer_test.tar", "writer_src_test.bin", "writer_test.tar.idx", "writer_out_test.tar");
+    if (errors == 0) {printf("Writer ok !\n");} else {printf("Writer wrong (%d errors) :(\n", errors);}
+    errors = writer_delta_test("writer_delta_test.tar", "writer_delta_test.tar.idx");
+    if (errors == 0) {printf("Writer deltas ok !\n");} else {printf("Writer deltas wrong (%d errors) :(\n", errors);}
+
+    // ========== STATISTICS TESTING ==========
+    errors = stats_test(fd, path, ret);
+    if (errors == 0) {printf("Statistics ok !\n");} else {printf("Statistics wrong (%d errors) :(\n", errors);}
+
+    // ========== VERIFICATION TESTING ==========
+    tar_member_digest_t *digests;
+    size_t no_digests;
+    int verified = tar_verify(fd, 4, &digests, &no_digests);
+    uint8_t content[4096];
+    size_t content_size = sizeof(content);
+    tar = tar_open(fd, 0);
+    tar_read_file(tar, path, 0, content, &content_size);
+    tar_close(tar);
+    int crc_found = 0;
+    for (size_t i = 0; i < no_digests; i++) {
+        if (digests[i].size == content_size && digests[i].crc32c == tar_crc32c(0, content, content_size)) { crc_found = 1; }
+    }
+    if (verified == ret && no_digests == (size_t) ret && crc_found) {
+        printf("Verification ok !\n");
+    } else {printf("Verification wrong (%d) :(\n", verified);}
+    free(digests);
+
     return 0;
 }
\ No newline at end of file